@@ -0,0 +1,96 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: ActivityGate.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Decides which frames of a camera are recorded, by the
+// activity in its scene.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "ActivityGate.h"
+
+#include <algorithm>
+#include <limits>
+
+// width of the gray image frames are compared at; enough to see a moving hand or head
+#define ACTIVITY_WIDTH 64
+
+ActivityGate::ActivityGate () :
+  mThreshold      (0),
+  mIdleIntervalNs (0),
+  mHoldNs         (0),
+  mMoved          (false),
+  mLastMotionNs   (0),
+  mNextIdleNs     (0),
+  mActivity       (0)
+{
+}
+
+void ActivityGate::Configure (double _threshold, double _idleFps, int64_t _holdNs)
+{
+  mThreshold      = std::max (0.0, _threshold);
+  mIdleIntervalNs = _idleFps > 0 ? static_cast<int64_t> (1e9 / _idleFps) : 0;
+  mHoldNs         = std::max<int64_t> (0, _holdNs);
+  Reset ();
+}
+
+void ActivityGate::Reset ()
+{
+  mReference.release ();
+  mMoved      = false;
+  mNextIdleNs = 0;
+  mActivity   = 0;
+}
+
+bool ActivityGate::Keep (const cv::Mat& _image, int64_t _timeNs, bool& _static)
+{
+  _static = false;
+  if (!Enabled () || _image.empty ())
+    return true;
+
+  // shrink first, so that only the small image is converted to gray
+  int width  = std::min (ACTIVITY_WIDTH, _image.cols);
+  int height = std::max (1, _image.rows * width / _image.cols);
+  cv::resize (_image, mSmall, cv::Size (width, height), 0, 0, cv::INTER_AREA);
+  if (mSmall.channels () == 3)
+    cv::cvtColor (mSmall, mGray, cv::COLOR_BGR2GRAY);
+  else
+    mSmall.copyTo (mGray);
+
+  bool motion = mReference.empty () || mReference.size () != mGray.size ();
+  mActivity   = motion ? 0 : cv::norm (mGray, mReference, cv::NORM_L1) / mGray.total ();
+  if (motion || mActivity > mThreshold)
+  {
+    mMoved        = true;
+    mLastMotionNs = _timeNs;
+  }
+
+  bool active = mMoved && _timeNs - mLastMotionNs <= mHoldNs;
+  bool idle   = !active && mIdleIntervalNs > 0 && _timeNs >= mNextIdleNs;
+  if (!active && !idle)
+    return false;
+
+  mGray.copyTo (mReference);
+  mNextIdleNs = mIdleIntervalNs > 0 ? _timeNs + mIdleIntervalNs : std::numeric_limits<int64_t>::max ();
+  _static     = !active;
+  return true;
+}
@@ -0,0 +1,71 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: ActivityGate.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Decides which frames of a camera are recorded, by the
+// activity in its scene. Each frame is shrunk to a small gray image, and
+// its mean absolute difference to the last recorded frame is compared with
+// a threshold. While there is motion, and for a while after, every frame
+// is kept; on a static scene frames are kept only at a low idle rate.
+// Comparing with the last recorded frame, rather than the previous one,
+// also catches changes that are too slow to show from frame to frame.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef ACTIVITYGATE_H
+#define ACTIVITYGATE_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+
+class ActivityGate
+{
+public:
+  ActivityGate ();
+
+  // _threshold is a mean difference in gray levels, 0 to keep every frame. While static,
+  //   _idleFps frames per second are kept, none if 0; full rate continues for _holdNs
+  //   after the last motion.
+  void   Configure (double _threshold, double _idleFps, int64_t _holdNs);
+  bool   Enabled   () const { return mThreshold > 0; }
+  // forget the scene, so that the next frame is kept
+  void   Reset     ();
+
+  // true if the frame is to be recorded; _static is set if it is kept only at the idle rate
+  bool   Keep      (const cv::Mat& _image, int64_t _timeNs, bool& _static);
+  // difference measured for the last frame
+  double Activity  () const { return mActivity; }
+
+private:
+  double   mThreshold;
+  int64_t  mIdleIntervalNs;
+  int64_t  mHoldNs;
+
+  cv::Mat  mSmall;
+  cv::Mat  mGray;
+  cv::Mat  mReference;   // the last kept frame, shrunk
+  bool     mMoved;       // mLastMotionNs is valid
+  int64_t  mLastMotionNs;
+  int64_t  mNextIdleNs;
+  double   mActivity;
+};
+
+#endif // ACTIVITYGATE_H
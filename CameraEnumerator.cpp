@@ -0,0 +1,363 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: CameraEnumerator.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Keeps a process-wide list of the cameras connected to the
+// system together with their capture formats and resolutions.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "CameraEnumerator.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+# include <dirent.h>
+# include <fcntl.h>
+# include <sys/ioctl.h>
+# include <sys/stat.h>
+# include <unistd.h>
+# include <linux/videodev2.h>
+#elif defined(_WIN32)
+# include <windows.h>
+# include <cfgmgr32.h>
+#endif
+
+// number of indices probed where devices cannot be listed directly
+#define MAX_PROBED_CAMERAS 10
+
+// DirectShow only exists on Windows; elsewhere UseDirectShow leaves the choice to OpenCV
+#ifdef _WIN32
+# define DIRECTSHOW_API cv::CAP_DSHOW
+#else
+# define DIRECTSHOW_API cv::CAP_ANY
+#endif
+
+bool CameraInfo::Supports (int _width, int _height) const
+{
+  if (formats.empty ())
+    return true;
+  for (size_t f = 0; f < formats.size (); f++)
+  {
+    const Format& format = formats[f];
+    if (format.stepwise && format.sizes.size () == 2)
+    {
+      if (_width  >= format.sizes[0].width  && _width  <= format.sizes[1].width
+       && _height >= format.sizes[0].height && _height <= format.sizes[1].height)
+        return true;
+    }
+    else
+    {
+      for (size_t s = 0; s < format.sizes.size (); s++)
+        if (format.sizes[s].width == _width && format.sizes[s].height == _height)
+          return true;
+    }
+  }
+  return false;
+}
+
+//==========================================================================================
+// Platform specific device discovery
+//==========================================================================================
+#ifdef __linux__
+static std::string FourccToString (uint32_t _fourcc)
+{
+  char text[5] = { char (_fourcc & 0xff), char ((_fourcc >> 8) & 0xff),
+                   char ((_fourcc >> 16) & 0xff), char ((_fourcc >> 24) & 0xff), 0 };
+  return text;
+}
+
+static int Xioctl (int _fd, unsigned long _request, void* _arg)
+{
+  int r;
+  do r = ::ioctl (_fd, _request, _arg);
+  while (r == -1 && errno == EINTR);
+  return r;
+}
+
+// indices of /dev/videoN nodes, in increasing order
+static std::vector<int> VideoNodes ()
+{
+  std::vector<int> nodes;
+  DIR* dir = ::opendir ("/dev");
+  if (!dir)
+    return nodes;
+  while (struct dirent* entry = ::readdir (dir))
+  {
+    if (::strncmp (entry->d_name, "video", 5) != 0)
+      continue;
+    char* end = nullptr;
+    long  n   = ::strtol (entry->d_name + 5, &end, 10);
+    if (end != entry->d_name + 5 && *end == '\0')
+      nodes.push_back (static_cast<int> (n));
+  }
+  ::closedir (dir);
+  std::sort (nodes.begin (), nodes.end ());
+  return nodes;
+}
+
+static bool QueryDevice (int _node, CameraInfo& _info)
+{
+  _info.index = _node;
+  _info.path  = "/dev/video" + std::to_string (_node);
+
+  std::ifstream nameFile ("/sys/class/video4linux/video" + std::to_string (_node) + "/name");
+  std::getline (nameFile, _info.name);
+
+  // opening the node for queries does not start a stream
+  int fd = ::open (_info.path.c_str (), O_RDWR | O_NONBLOCK);
+  if (fd < 0)
+    return !_info.name.empty ();
+
+  struct v4l2_capability cap;
+  ::memset (&cap, 0, sizeof (cap));
+  if (Xioctl (fd, VIDIOC_QUERYCAP, &cap) != 0)
+  {
+    ::close (fd);
+    return false;
+  }
+  uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+  if (!(caps & V4L2_CAP_VIDEO_CAPTURE))
+  {
+    // metadata and output nodes are not cameras
+    ::close (fd);
+    return false;
+  }
+  if (_info.name.empty ())
+    _info.name = reinterpret_cast<const char*> (cap.card);
+  _info.bus = reinterpret_cast<const char*> (cap.bus_info);
+
+  struct v4l2_fmtdesc fmt;
+  ::memset (&fmt, 0, sizeof (fmt));
+  fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  for (fmt.index = 0; Xioctl (fd, VIDIOC_ENUM_FMT, &fmt) == 0; fmt.index++)
+  {
+    CameraInfo::Format format;
+    format.fourcc      = FourccToString (fmt.pixelformat);
+    format.description = reinterpret_cast<const char*> (fmt.description);
+    format.stepwise    = false;
+
+    struct v4l2_frmsizeenum size;
+    ::memset (&size, 0, sizeof (size));
+    size.pixel_format = fmt.pixelformat;
+    for (size.index = 0; Xioctl (fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0; size.index++)
+    {
+      if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE)
+      {
+        format.sizes.push_back (cv::Size (size.discrete.width, size.discrete.height));
+      }
+      else
+      {
+        format.stepwise = true;
+        format.sizes.push_back (cv::Size (size.stepwise.min_width, size.stepwise.min_height));
+        format.sizes.push_back (cv::Size (size.stepwise.max_width, size.stepwise.max_height));
+        break;
+      }
+    }
+    _info.formats.push_back (format);
+  }
+  ::close (fd);
+  return true;
+}
+#endif // __linux__
+
+#ifdef _WIN32
+// KSCATEGORY_VIDEO, under which DirectShow and Media Foundation capture devices register
+static const GUID VideoDeviceCategory =
+  { 0x6994ad05, 0x93ef, 0x11d0, { 0xa3, 0xcc, 0x00, 0xa0, 0xc9, 0x22, 0x31, 0x96 } };
+
+// interface paths of the present video devices, separated by '\0'
+static bool VideoInterfaces (std::string& _list)
+{
+  GUID category = VideoDeviceCategory;
+  for (int attempt = 0; attempt < 3; attempt++)
+  {
+    ULONG length = 0;
+    if (::CM_Get_Device_Interface_List_SizeA (&length, &category, nullptr,
+          CM_GET_DEVICE_INTERFACE_LIST_PRESENT) != CR_SUCCESS)
+      return false;
+    std::vector<char> buffer (length + 1, 0);
+    CONFIGRET result = ::CM_Get_Device_Interface_ListA (&category, nullptr, buffer.data (), length,
+                                                        CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
+    // the list may grow between the two calls when a device arrives
+    if (result == CR_BUFFER_SMALL)
+      continue;
+    if (result != CR_SUCCESS)
+      return false;
+    _list.assign (buffer.data (), length);
+    return true;
+  }
+  return false;
+}
+#endif // _WIN32
+
+//==========================================================================================
+// CameraEnumerator member function implementaion
+//==========================================================================================
+CameraEnumerator& CameraEnumerator::Instance ()
+{
+  static CameraEnumerator instance;
+  return instance;
+}
+
+CameraEnumerator::CameraEnumerator () :
+  mValid         (false),
+  mUseDirectShow (false)
+{
+}
+
+bool CameraEnumerator::Signature (std::string& _signature) const
+{
+#ifdef __linux__
+  // device nodes are recreated when a camera is plugged in or out
+  std::ostringstream signature;
+  std::vector<int> nodes = VideoNodes ();
+  for (size_t i = 0; i < nodes.size (); i++)
+  {
+    struct stat st;
+    std::string path = "/dev/video" + std::to_string (nodes[i]);
+    if (::stat (path.c_str (), &st) == 0)
+      signature << nodes[i] << ':' << st.st_rdev << ':' << st.st_ctime << ';';
+  }
+  _signature = signature.str ();
+  return true;
+#elif defined(_WIN32)
+  // interface paths contain the device instance, so they change when a camera is plugged in or out
+  return VideoInterfaces (_signature);
+#else
+  _signature.clear ();
+  return false;
+#endif
+}
+
+std::vector<CameraInfo> CameraEnumerator::Scan (bool _useDirectShow) const
+{
+  std::vector<CameraInfo> cameras;
+#ifdef __linux__
+  std::vector<int> nodes = VideoNodes ();
+  for (size_t i = 0; i < nodes.size (); i++)
+  {
+    CameraInfo info;
+    if (QueryDevice (nodes[i], info))
+      cameras.push_back (info);
+  }
+#else
+  for (int i = 0; i < MAX_PROBED_CAMERAS; i++)
+  {
+    cv::VideoCapture temp_camera;
+    temp_camera.open (i, CaptureApi (_useDirectShow));
+
+    if (temp_camera.isOpened ())
+    {
+      CameraInfo info;
+      info.index = i;
+      info.name  = "Camera " + std::to_string (i);
+      cameras.push_back (info);
+      temp_camera.release ();
+    }
+  }
+#endif
+  return cameras;
+}
+
+std::vector<CameraInfo> CameraEnumerator::Cameras (bool _useDirectShow, bool* _rescanned)
+{
+  mMutex.Acquire ();
+  // without a signature, changes cannot be noticed, so the devices are probed every time
+  std::string signature;
+  bool known  = Signature (signature);
+  bool rescan = !known || !mValid || signature != mSignature || _useDirectShow != mUseDirectShow;
+  if (rescan)
+  {
+    mCameras       = Scan (_useDirectShow);
+    mSignature     = signature;
+    mUseDirectShow = _useDirectShow;
+    mValid         = true;
+  }
+  std::vector<CameraInfo> cameras = mCameras;
+  mMutex.Release ();
+
+  if (_rescanned)
+    *_rescanned = rescan;
+  return cameras;
+}
+
+int CameraEnumerator::CaptureApi (bool _useDirectShow)
+{
+  return _useDirectShow ? DIRECTSHOW_API : cv::CAP_ANY;
+}
+
+bool CameraEnumerator::Find (const std::vector<CameraInfo>& _cameras, int _index, CameraInfo& _info)
+{
+  for (size_t i = 0; i < _cameras.size (); i++)
+  {
+    if (_cameras[i].index == _index)
+    {
+      _info = _cameras[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+void CameraEnumerator::Invalidate ()
+{
+  mMutex.Acquire ();
+  mValid = false;
+  mMutex.Release ();
+}
+
+std::string CameraEnumerator::Describe (const std::vector<CameraInfo>& _cameras)
+{
+  std::ostringstream oss;
+  oss << "WebcamLogger: Enumeration of cameras connected to system:\n";
+  for (size_t i = 0; i < _cameras.size (); i++)
+  {
+    const CameraInfo& camera = _cameras[i];
+    oss << "  Camera detected at index " << camera.index;
+    if (!camera.name.empty ())
+      oss << ": " << camera.name;
+    if (!camera.bus.empty ())
+      oss << " (" << camera.bus << ")";
+    oss << "\n";
+    for (size_t f = 0; f < camera.formats.size (); f++)
+    {
+      const CameraInfo::Format& format = camera.formats[f];
+      oss << "    " << format.fourcc;
+      if (format.stepwise && format.sizes.size () == 2)
+        oss << " " << format.sizes[0].width << "x" << format.sizes[0].height
+            << " to " << format.sizes[1].width << "x" << format.sizes[1].height;
+      else
+        for (size_t s = 0; s < format.sizes.size (); s++)
+          oss << " " << format.sizes[s].width << "x" << format.sizes[s].height;
+      oss << "\n";
+    }
+  }
+  if (_cameras.empty ())
+    oss << "  No cameras were detected\n";
+  return oss.str ();
+}
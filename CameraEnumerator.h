@@ -0,0 +1,97 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: CameraEnumerator.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Keeps a process-wide list of the cameras connected to the
+// system together with their capture formats and resolutions. The list is
+// built once and rebuilt only when the set of devices changes, so that
+// Preflight can validate the Connections parameter without opening streams.
+//
+// On Linux, devices are found from /dev/video* and sysfs, and formats are
+// queried with V4L2 enumeration ioctls, which do not start streaming. Other
+// platforms fall back to probing indices with cv::VideoCapture. On Windows,
+// that list is kept while the present video device interfaces stay the
+// same; where devices cannot be listed at all, it is probed on every call.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef CAMERAENUMERATOR_H
+#define CAMERAENUMERATOR_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+#include "Mutex.h"
+
+struct CameraInfo
+{
+  struct Format
+  {
+    std::string           fourcc;
+    std::string           description;
+    std::vector<cv::Size> sizes;       // discrete sizes, or min and max if stepwise
+    bool                  stepwise;
+  };
+
+  CameraInfo () : index (-1) {}
+
+  // true if no formats are known or any format offers this resolution
+  bool Supports (int _width, int _height) const;
+
+  int                 index;    // index to pass to cv::VideoCapture
+  std::string         name;
+  std::string         path;
+  std::string         bus;
+  std::vector<Format> formats;
+};
+
+class CameraEnumerator
+{
+public:
+  static CameraEnumerator& Instance ();
+
+  // The cached camera list, rescanned first if devices were added or removed.
+  // _rescanned is set to whether that happened.
+  std::vector<CameraInfo> Cameras    (bool _useDirectShow, bool* _rescanned = nullptr);
+  void                    Invalidate ();
+
+  // the OpenCV backend used to open camera indices, for enumeration and capture alike
+  static int              CaptureApi (bool _useDirectShow);
+  // looks up _index in a list returned by Cameras (), without probing the devices again
+  static bool             Find       (const std::vector<CameraInfo>& _cameras, int _index, CameraInfo& _info);
+  static std::string      Describe   (const std::vector<CameraInfo>& _cameras);
+
+private:
+  CameraEnumerator ();
+
+  // false if the platform offers no way to notice device changes
+  bool                    Signature  (std::string& _signature) const;
+  std::vector<CameraInfo> Scan       (bool _useDirectShow) const;
+
+  Tiny::Mutex             mMutex;
+  bool                    mValid;
+  bool                    mUseDirectShow;
+  std::string             mSignature;
+  std::vector<CameraInfo> mCameras;
+};
+
+#endif // CAMERAENUMERATOR_H
@@ -0,0 +1,233 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: CaptureReactor.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Services the capture stage of many cameras from a small,
+// fixed number of threads instead of one thread per camera.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "CaptureReactor.h"
+#include "WebcamThread.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#ifdef __linux__
+# include <sys/epoll.h>
+# include <unistd.h>
+#endif
+
+// longest a worker waits before checking whether it should terminate
+#define REACTOR_WAIT_MS 50
+
+typedef std::chrono::steady_clock Clock;
+
+//==========================================================================================
+// CaptureReactor::Worker member function implementaion
+//==========================================================================================
+CaptureReactor::Worker::Worker (int _id) :
+  mId      (_id),
+  mWaitAny (true),
+  mEpoll   (-1)
+{
+#ifdef __linux__
+  mEpoll = ::epoll_create1 (EPOLL_CLOEXEC);
+#endif
+}
+
+CaptureReactor::Worker::~Worker ()
+{
+#ifdef __linux__
+  if (mEpoll >= 0)
+    ::close (mEpoll);
+#endif
+}
+
+void CaptureReactor::Worker::Add (WebcamThread* _camera)
+{
+  mCameras.push_back (_camera);
+  if (_camera->IsVirtual ())
+  {
+    mVirtual.push_back (_camera);
+    return;
+  }
+#ifdef __linux__
+  if (_camera->PollFd () >= 0 && mEpoll >= 0)
+  {
+    epoll_event event;
+    event.events   = EPOLLIN;
+    event.data.u32 = static_cast<uint32_t> (mPollable.size ());
+    if (::epoll_ctl (mEpoll, EPOLL_CTL_ADD, _camera->PollFd (), &event) == 0)
+    {
+      mPollable.push_back (_camera);
+      return;
+    }
+  }
+#endif
+  mDevices.push_back (_camera);
+  mStreams.push_back (*_camera->Capture ());
+}
+
+void CaptureReactor::Worker::ServicePollable (int _timeoutMs)
+{
+#ifdef __linux__
+  epoll_event events[16];
+  int count = ::epoll_wait (mEpoll, events, sizeof (events) / sizeof (*events), _timeoutMs);
+  for (int i = 0; i < count; i++)
+    mPollable[events[i].data.u32]->CaptureFrame ();
+#endif
+}
+
+void CaptureReactor::Worker::Place ()
+{
+  std::vector<int>          cores;
+  ThreadPlacement::Priority priority = ThreadPlacement::Normal;
+  bool                      pinned   = !mCameras.empty ();
+  for (size_t i = 0; i < mCameras.size (); i++)
+  {
+    const ThreadPlacement& placement = mCameras[i]->CapturePlacement ();
+    pinned   = pinned && !placement.Cores ().empty ();
+    priority = std::max (priority, placement.Level ());
+    cores.insert (cores.end (), placement.Cores ().begin (), placement.Cores ().end ());
+  }
+  std::sort (cores.begin (), cores.end ());
+  cores.erase (std::unique (cores.begin (), cores.end ()), cores.end ());
+  mPlacement.Configure (pinned ? cores : std::vector<int> (), priority);
+}
+
+void CaptureReactor::Worker::ServiceDevices (int64_t _timeoutNs)
+{
+  if (mWaitAny)
+  {
+    std::vector<int> ready;
+    try
+    {
+      if (cv::VideoCapture::waitAny (mStreams, ready, _timeoutNs))
+        for (size_t i = 0; i < ready.size (); i++)
+          mDevices[ready[i]]->CaptureFrame ();
+      return;
+    }
+    catch (const cv::Exception& e)
+    {
+      bciwarn << "WebcamLogger: Capture thread " << mId << " cannot wait on its cameras ("
+              << e.what () << "); reading them in turn instead" << std::endl;
+      mWaitAny = false;
+    }
+  }
+
+  // grab () blocks until each camera has its next frame
+  for (size_t i = 0; i < mDevices.size (); i++)
+    mDevices[i]->CaptureFrame ();
+}
+
+int CaptureReactor::Worker::OnExecute ()
+{
+  mPlacement.Apply ();
+  bciout << "Capture thread " << mId << " started for "
+         << mPollable.size () + mDevices.size () + mVirtual.size () << " camera(s)"
+         << (mPlacement.Configured () ? " on " + mPlacement.Report () : std::string ());
+  if (!mPlacement.Succeeded ())
+    bciwarn << "WebcamLogger: Capture thread " << mId << " runs on " << mPlacement.Report () << std::endl;
+  while (!this->Terminating ())
+  {
+    // wait no longer than until the next virtual frame is due
+    Clock::time_point now      = Clock::now ();
+    Clock::time_point deadline = now + std::chrono::milliseconds (REACTOR_WAIT_MS);
+    for (size_t i = 0; i < mVirtual.size (); i++)
+      deadline = std::min (deadline, mVirtual[i]->NextFrameTime ());
+
+    int64_t timeoutNs = std::max<int64_t> (0, std::chrono::duration_cast<std::chrono::nanoseconds> (deadline - now).count ());
+    if (!mDevices.empty ())
+    {
+      // OpenCV devices and descriptors cannot be waited on together; check the latter after
+      ServiceDevices (timeoutNs);
+      if (!mPollable.empty ())
+        ServicePollable (0);
+    }
+    else if (!mPollable.empty ())
+      ServicePollable (static_cast<int> ((timeoutNs + 999999) / 1000000));
+    else
+      std::this_thread::sleep_until (deadline);
+
+    now = Clock::now ();
+    for (size_t i = 0; i < mVirtual.size (); i++)
+      if (mVirtual[i]->NextFrameTime () <= now)
+        mVirtual[i]->CaptureFrame ();
+  }
+  bciout << "Capture thread " << mId << " ended";
+  return 0;
+}
+
+//==========================================================================================
+// CaptureReactor member function implementaion
+//==========================================================================================
+CaptureReactor::CaptureReactor ()
+{
+}
+
+CaptureReactor::~CaptureReactor ()
+{
+  Stop ();
+}
+
+bool CaptureReactor::CanWait (const std::string& _source)
+{
+  if (VirtualCamera::IsVirtual (_source) || V4l2Camera::IsV4l2 (_source))
+    return true;
+#ifdef __linux__
+  // OpenCV picks its V4L2 backend here, the only one that implements waitAny ()
+  return true;
+#else
+  // DirectShow and Media Foundation devices can only be read in turn
+  return false;
+#endif
+}
+
+void CaptureReactor::Start (const std::vector<WebcamThread*>& _cameras, int _threads)
+{
+  Stop ();
+  if (_cameras.empty ())
+    return;
+
+  size_t threads = std::min (_cameras.size (), static_cast<size_t> (std::max (1, _threads)));
+  for (size_t i = 0; i < threads; i++)
+    mWorkers.push_back (new Worker (static_cast<int> (i)));
+  for (size_t i = 0; i < _cameras.size (); i++)
+    mWorkers[i % threads]->Add (_cameras[i]);
+  for (size_t i = 0; i < mWorkers.size (); i++)
+  {
+    mWorkers[i]->Place ();
+    mWorkers[i]->Start ();
+  }
+}
+
+void CaptureReactor::Stop ()
+{
+  for (size_t i = 0; i < mWorkers.size (); i++)
+  {
+    mWorkers[i]->TerminateAndWait ();
+    delete mWorkers[i];
+  }
+  mWorkers.clear ();
+}
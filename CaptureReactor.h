@@ -0,0 +1,96 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: CaptureReactor.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Services the capture stage of many cameras from a small,
+// fixed number of threads instead of one thread per camera. Cameras are
+// distributed over the reactor's workers; each worker waits until one of
+// its cameras has a frame ready and hands that frame to the camera's
+// pipeline, so idle cameras cost no CPU.
+//
+// Cameras on the native v4l2 backend expose their device descriptor and
+// are waited on with epoll. Readiness of OpenCV V4L2 devices is taken from
+// cv::VideoCapture::waitAny (), which polls the descriptors OpenCV keeps
+// to itself. Virtual cameras are ready when their next frame is due. Where
+// neither is available (other backends and platforms) a worker reads its
+// devices in turn, which keeps cameras of equal frame rate in step.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef CAPTUREREACTOR_H
+#define CAPTUREREACTOR_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+#include "Thread.h"
+#include "ThreadPlacement.h"
+
+class WebcamThread;
+
+class CaptureReactor
+{
+public:
+  CaptureReactor  ();
+  ~CaptureReactor ();
+
+  // Distributes _cameras over at most _threads workers and starts them. The
+  //   cameras must be initialized with external capture and outlive Stop ().
+  void   Start   (const std::vector<WebcamThread*>& _cameras, int _threads);
+  void   Stop    ();
+  size_t Threads () const { return mWorkers.size (); }
+
+  // Whether a worker can wait for frames of a camera with this Source, rather
+  //   than reading it in turn with the worker's other cameras.
+  static bool CanWait (const std::string& _source);
+
+private:
+  class Worker : public Thread
+  {
+  public:
+    explicit Worker (int _id);
+    ~Worker ();
+    void Add       (WebcamThread* _camera);
+    // the cores of all its cameras, if each of them is pinned, at the highest of their priorities
+    void Place     ();
+    int  OnExecute () override;
+
+  private:
+    // wait for the cameras of each kind for at most the given time
+    void ServiceDevices  (int64_t _timeoutNs);
+    void ServicePollable (int _timeoutMs);
+
+    int                         mId;
+    bool                        mWaitAny;
+    int                         mEpoll;
+    std::vector<WebcamThread*>  mPollable;   // cameras with a device descriptor
+    std::vector<WebcamThread*>  mDevices;
+    std::vector<cv::VideoCapture> mStreams;   // handles onto the devices, for waitAny ()
+    std::vector<WebcamThread*>  mVirtual;
+    std::vector<WebcamThread*>  mCameras;
+    ThreadPlacement             mPlacement;
+  };
+
+  std::vector<Worker*> mWorkers;
+};
+
+#endif // CAPTUREREACTOR_H
@@ -0,0 +1,227 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: EncoderPool.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A pool of encoder threads shared by all cameras, encoding
+// independent chunks of each camera's frames concurrently.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "EncoderPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+// how long an idle worker, or an encoder waiting for frames, sleeps
+#define POOL_IDLE_MS 1
+
+//==========================================================================================
+// EncodeChunk member function implementaion
+//==========================================================================================
+EncodeChunk::EncodeChunk (const std::string& _file, int _fourcc, double _fps, cv::Size _size, bool _isColor) :
+  mFile      (_file),
+  mFourcc    (_fourcc),
+  mFps       (_fps),
+  mSize      (_size),
+  mIsColor   (_isColor),
+  mFinished  (false),
+  mAbandoned (false),
+  mDone      (false),
+  mSucceeded (false)
+{
+}
+
+void EncodeChunk::Add (WebcamFrame& _frame)
+{
+  mTimes.push_back (_frame.captureTimeNs);
+  mMutex.Acquire ();
+  mFrames.push_back (std::move (_frame));
+  mMutex.Release ();
+}
+
+void EncodeChunk::Finish ()
+{
+  mMutex.Acquire ();
+  mFinished = true;
+  mMutex.Release ();
+}
+
+void EncodeChunk::Encode (const std::atomic<bool>& _abort)
+{
+  if (mAbandoned)
+    return;
+  cv::VideoWriter writer;
+  bool ok = writer.open (mFile, mFourcc, mFps, mSize, mIsColor);
+  while (!_abort && !mAbandoned)
+  {
+    // scoped to the iteration so that the pooled buffer goes back right after encoding
+    WebcamFrame frame;
+    mMutex.Acquire ();
+    bool got_frame = !mFrames.empty ();
+    bool finished  = mFinished;
+    if (got_frame)
+    {
+      frame = std::move (mFrames.front ());
+      mFrames.pop_front ();
+    }
+    mMutex.Release ();
+
+    if (got_frame && ok)
+      writer << frame.image;
+    else if (!got_frame && finished)
+      break;
+    else if (!got_frame)
+      std::this_thread::sleep_for (std::chrono::milliseconds (POOL_IDLE_MS));
+  }
+  writer.release ();
+
+  // the file of an abandoned chunk is removed by whichever of Encode () and Abandon () ends last
+  mMutex.Acquire ();
+  bool abandoned = mAbandoned;
+  if (!abandoned)
+  {
+    mSucceeded = ok && !_abort;
+    mDone      = true;
+  }
+  mMutex.Release ();
+  if (abandoned)
+    std::remove (mFile.c_str ());
+}
+
+void EncodeChunk::Abandon ()
+{
+  mMutex.Acquire ();
+  mAbandoned = true;
+  mFrames.clear ();
+  bool encoded = mDone;
+  mSucceeded = false;
+  mDone      = true;
+  mMutex.Release ();
+  if (encoded)
+    std::remove (mFile.c_str ());
+}
+
+//==========================================================================================
+// EncoderPool member function implementaion
+//==========================================================================================
+EncoderPool& EncoderPool::Instance ()
+{
+  static EncoderPool instance;
+  return instance;
+}
+
+EncoderPool::EncoderPool () :
+  mThreads  (0),
+  mPriority (ThreadPlacement::Normal),
+  mStopping (false),
+  mInFlight (0),
+  mEncoders (0)
+{
+}
+
+EncoderPool::~EncoderPool ()
+{
+  Shutdown ();
+}
+
+void EncoderPool::Configure (int _threads)
+{
+  mThreads = std::max (0, _threads);
+}
+
+int EncoderPool::Threads () const
+{
+  return mThreads > 0 ? mThreads : std::max (1, static_cast<int> (std::thread::hardware_concurrency ()));
+}
+
+void EncoderPool::Start ()
+{
+  mMutex.Acquire ();
+  if (mWorkers.empty ())
+  {
+    for (int i = 0; i < Threads (); i++)
+    {
+      mWorkers.push_back (new Worker (*this));
+      mWorkers.back ()->Start ();
+    }
+  }
+  mMutex.Release ();
+}
+
+void EncoderPool::Enqueue (const std::shared_ptr<EncodeChunk>& _chunk)
+{
+  ++mInFlight;
+  mMutex.Acquire ();
+  mPending.push_back (_chunk);
+  mMutex.Release ();
+  Start ();
+}
+
+std::shared_ptr<EncodeChunk> EncoderPool::Next ()
+{
+  std::shared_ptr<EncodeChunk> chunk;
+  mMutex.Acquire ();
+  if (!mPending.empty ())
+  {
+    chunk = mPending.front ();
+    mPending.pop_front ();
+  }
+  mMutex.Release ();
+  return chunk;
+}
+
+void EncoderPool::Shutdown ()
+{
+  mMutex.Acquire ();
+  std::vector<Worker*> workers;
+  workers.swap (mWorkers);
+  mMutex.Release ();
+
+  mStopping = true;
+  for (size_t i = 0; i < workers.size (); i++)
+  {
+    workers[i]->TerminateAndWait ();
+    delete workers[i];
+  }
+  mStopping = false;
+
+  std::shared_ptr<EncodeChunk> chunk;
+  while ((chunk = Next ()))
+    chunk->Abandon ();
+}
+
+int EncoderPool::Worker::OnExecute ()
+{
+  mPlacement.Configure (std::vector<int> (), mPool.mPriority);
+  mPlacement.Apply ();
+  while (!this->Terminating ())
+  {
+    std::shared_ptr<EncodeChunk> chunk = mPool.Next ();
+    if (chunk)
+      chunk->Encode (mPool.mStopping);
+    else
+      std::this_thread::sleep_for (std::chrono::milliseconds (POOL_IDLE_MS));
+  }
+  return 0;
+}
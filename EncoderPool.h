@@ -0,0 +1,142 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: EncoderPool.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A pool of encoder threads shared by all cameras. Work is
+// handed out in EncodeChunks: runs of consecutive frames of one camera that
+// are encoded into a file of their own, by a fresh cv::VideoWriter, so that
+// each chunk starts with a key frame and refers to no frame outside of it
+// (a closed GOP). Chunks of one camera are encoded concurrently on
+// different threads; GopEncoder joins them back together in order.
+//
+// A worker takes a chunk as soon as it is free, while the camera may still
+// be adding frames to it, so frames are encoded as they arrive and only
+// wait in memory while all workers are busy.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef ENCODERPOOL_H
+#define ENCODERPOOL_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Thread.h"
+#include "Mutex.h"
+#include "WebcamFrame.h"
+#include "ThreadPlacement.h"
+
+class EncodeChunk
+{
+public:
+  EncodeChunk (const std::string& _file, int _fourcc, double _fps, cv::Size _size, bool _isColor);
+
+  // called by the camera's writer thread
+  void   Add          (WebcamFrame& _frame);   // takes over the frame
+  void   Finish       ();                      // no more frames will be added
+  size_t Frames       () const { return mTimes.size (); }
+  // capture times of the added frames, in the order they were added
+  const std::vector<int64_t>& CaptureTimes () const { return mTimes; }
+
+  // called by a pool worker; returns once all frames are encoded, or _abort is set
+  void   Encode       (const std::atomic<bool>& _abort);
+  // gives up on the chunk; a worker encoding it stops at the next frame
+  void   Abandon      ();
+
+  bool   Done         () const { return mDone; }
+  bool   Succeeded    () const { return mSucceeded; }
+  const std::string& File () const { return mFile; }
+
+private:
+  std::string             mFile;
+  int                     mFourcc;
+  double                  mFps;
+  cv::Size                mSize;
+  bool                    mIsColor;
+
+  Tiny::Mutex             mMutex;
+  std::deque<WebcamFrame> mFrames;      // added, not yet encoded
+  bool                    mFinished;
+  std::atomic<bool>       mAbandoned;
+  std::vector<int64_t>    mTimes;       // writer thread only
+
+  std::atomic<bool>       mDone;
+  std::atomic<bool>       mSucceeded;
+};
+
+class EncoderPool
+{
+public:
+  static EncoderPool& Instance ();
+
+  // 0 for one thread per processor core; takes effect when the workers are next started
+  void Configure (int _threads);
+  int  Threads   () const;
+  // scheduling priority of the workers; takes effect when they are next started
+  void SetPriority (ThreadPlacement::Priority _priority) { mPriority = _priority; }
+
+  // starts the workers if they are not running
+  void Start     ();
+  // queues a chunk, starting the workers if they are not running
+  void Enqueue   (const std::shared_ptr<EncodeChunk>& _chunk);
+
+  // Chunks in flight, from Enqueue () until their encoder retires them, are bounded
+  //   across all cameras: there is room for the chunk each open encoder fills and one
+  //   more per worker. Each camera also holds at most Threads () + 1 chunks.
+  void Attach    () { ++mEncoders; }      // an encoder was opened
+  void Detach    () { --mEncoders; }
+  bool HasRoom   () const { return mInFlight < Threads () + mEncoders; }
+  void Retire    () { --mInFlight; }      // the encoder is done with a chunk
+  // stops the workers; chunks that are not encoded by then fail
+  void Shutdown  ();
+
+private:
+  EncoderPool  ();
+  ~EncoderPool ();
+
+  class Worker : public Thread
+  {
+  public:
+    explicit Worker (EncoderPool& _pool) : mPool (_pool) {}
+    int OnExecute () override;
+
+  private:
+    EncoderPool&    mPool;
+    ThreadPlacement mPlacement;
+  };
+
+  std::shared_ptr<EncodeChunk> Next ();
+
+  Tiny::Mutex                                mMutex;
+  std::deque<std::shared_ptr<EncodeChunk> >  mPending;
+  std::vector<Worker*>                       mWorkers;
+  int                                        mThreads;
+  ThreadPlacement::Priority                  mPriority;
+  std::atomic<bool>                          mStopping;
+  std::atomic<int>                           mInFlight;
+  std::atomic<int>                           mEncoders;
+};
+
+#endif // ENCODERPOOL_H
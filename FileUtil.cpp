@@ -0,0 +1,45 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: FileUtil.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Small helpers for the files the WebcamLogger writes.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "FileUtil.h"
+
+#ifdef _WIN32
+# include <io.h>
+#else
+# include <unistd.h>
+#endif
+
+bool FlushToDisk (std::FILE* _file)
+{
+  if (!_file || ::fflush (_file) != 0)
+    return false;
+#ifdef _WIN32
+  return ::_commit (::_fileno (_file)) == 0;
+#else
+  return ::fsync (::fileno (_file)) == 0;
+#endif
+}
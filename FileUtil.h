@@ -0,0 +1,35 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: FileUtil.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Small helpers for the files the WebcamLogger writes.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef FILEUTIL_H
+#define FILEUTIL_H
+
+#include <cstdio>
+
+// writes what the C library buffers for _file through to the disk
+bool FlushToDisk (std::FILE* _file);
+
+#endif // FILEUTIL_H
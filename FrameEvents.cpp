@@ -0,0 +1,146 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: FrameEvents.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Emits the WebcamFrame<n> events of all cameras, in batches,
+// from one thread.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "FrameEvents.h"
+#include "FrameIndex.h"
+#include "BCIEvent.h"
+
+#include <algorithm>
+#include <chrono>
+
+// longest the emitter waits for events before checking whether it should terminate
+#define FRAMEEVENT_WAIT_MS 100
+// events a camera may have waiting for the emitter; at 1000 fps, a quarter second
+#define FRAMEEVENT_QUEUE_LENGTH 256
+
+//==========================================================================================
+// FrameEventChannel member function implementaion
+//==========================================================================================
+FrameEventChannel::FrameEventChannel (int _camIndex) :
+  mName      ("WebcamFrame" + std::to_string (_camIndex) + " "),
+  mQueue     (FRAMEEVENT_QUEUE_LENGTH, FrameQueue<FrameEvent>::Block),
+  mTelemetry (nullptr)
+{
+}
+
+void FrameEventChannel::Post (uint32_t _frameNumber, int64_t _captureTimeNs)
+{
+  FrameEvent event;
+  event.frameNumber   = _frameNumber;
+  event.captureTimeNs = _captureTimeNs;
+  mQueue.Push (event);
+  FrameEvents::Instance ().Notify ();
+}
+
+//==========================================================================================
+// FrameEvents member function implementaion
+//==========================================================================================
+FrameEvents& FrameEvents::Instance ()
+{
+  static FrameEvents instance;
+  return instance;
+}
+
+FrameEvents::~FrameEvents ()
+{
+  Shutdown ();
+}
+
+void FrameEvents::Attach (FrameEventChannel* _channel)
+{
+  mMutex.Acquire ();
+  if (std::find (mChannels.begin (), mChannels.end (), _channel) == mChannels.end ())
+    mChannels.push_back (_channel);
+  mMutex.Release ();
+  this->StartIfNotRunning ();
+}
+
+void FrameEvents::Detach (FrameEventChannel* _channel)
+{
+  mMutex.Acquire ();
+  std::vector<FrameEventChannel*>::iterator i = std::find (mChannels.begin (), mChannels.end (), _channel);
+  if (i != mChannels.end ())
+    mChannels.erase (i);
+  Emit (*_channel);
+  mMutex.Release ();
+}
+
+void FrameEvents::Shutdown ()
+{
+  this->Terminate ();
+  mWake.Set ();
+  this->TerminateAndWait ();
+  mMutex.Acquire ();
+  for (size_t i = 0; i < mChannels.size (); i++)
+    Emit (*mChannels[i]);
+  mMutex.Release ();
+}
+
+void FrameEvents::Notify ()
+{
+  // released with the event, so that a pass that sees the count also finds the event
+  mPosted.fetch_add (1, std::memory_order_release);
+  mWake.Notify ();
+}
+
+void FrameEvents::Emit (FrameEventChannel& _channel)
+{
+  // the state only holds one value at a time, so a pass sets it once, to the last frame
+  FrameEvent event;
+  bool       emit = false;
+  uint32_t   last = 0;
+  while (_channel.mQueue.TryPop (event))
+  {
+    emit = true;
+    last = event.frameNumber;
+    if (_channel.mTelemetry)
+    {
+      int64_t eventTimeNs = FrameIndexTime (std::chrono::steady_clock::now ());
+      if (eventTimeNs > event.captureTimeNs)
+        _channel.mTelemetry->eventLatencyUs.Record ((eventTimeNs - event.captureTimeNs) / 1000);
+    }
+  }
+  if (emit)
+    bcievent << _channel.mName << last;
+}
+
+int FrameEvents::OnExecute ()
+{
+  while (!this->Terminating ())
+  {
+    uint64_t posted = mPosted.load (std::memory_order_acquire);
+    mMutex.Acquire ();
+    for (size_t i = 0; i < mChannels.size (); i++)
+      Emit (*mChannels[i]);
+    mMutex.Release ();
+    mWake.WaitFor (FRAMEEVENT_WAIT_MS, [this, posted] () {
+      return mPosted.load (std::memory_order_acquire) != posted;
+    });
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: FrameEvents.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Emits the WebcamFrame<n> events of all cameras from one
+// thread. A writer posts the number and capture time of each frame it wrote
+// to its camera's FrameEventChannel, a lock-free queue, wakes the emitter
+// and goes on with the next frame. The emitter drains all channels and sets
+// each camera's state once per pass, to the last frame written; the frame
+// index has every frame. The event name of a camera is built once, when its
+// channel is created, instead of for every frame.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef FRAMEEVENTS_H
+#define FRAMEEVENTS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Thread.h"
+#include "Mutex.h"
+#include "FrameQueue.h"
+#include "PipelineTelemetry.h"
+#include "WakeSignal.h"
+
+struct FrameEvent
+{
+  uint32_t frameNumber;
+  int64_t  captureTimeNs;   // for the event latency
+};
+
+class FrameEventChannel
+{
+public:
+  explicit FrameEventChannel (int _camIndex);
+
+  // called from the writer thread; waits only while the emitter is a whole queue behind
+  void Post         (uint32_t _frameNumber, int64_t _captureTimeNs);
+  // event latency is recorded here; not owned
+  void SetTelemetry (PipelineTelemetry* _telemetry) { mTelemetry = _telemetry; }
+
+private:
+  friend class FrameEvents;
+
+  std::string            mName;        // "WebcamFrame<n> "
+  FrameQueue<FrameEvent> mQueue;
+  PipelineTelemetry*     mTelemetry;
+};
+
+class FrameEvents : public Thread
+{
+public:
+  static FrameEvents& Instance ();
+
+  // starts the emitter if it is not running
+  void Attach   (FrameEventChannel* _channel);
+  // emits what is left in the channel before returning
+  void Detach   (FrameEventChannel* _channel);
+  // stops the emitter; channels that are still attached are emitted first
+  void Shutdown ();
+  // called by a channel after it queued an event
+  void Notify   ();
+
+  int  OnExecute () override;
+
+private:
+  FrameEvents  () : mPosted (0) {}
+  ~FrameEvents ();
+
+  void Emit    (FrameEventChannel& _channel);
+
+  Tiny::Mutex                      mMutex;
+  std::vector<FrameEventChannel*>  mChannels;
+  std::atomic<uint64_t>            mPosted;   // events queued on all channels
+  WakeSignal                       mWake;
+};
+
+#endif // FRAMEEVENTS_H
@@ -0,0 +1,218 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: FrameIndex.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A binary sidecar index written next to each recorded video,
+// with one fixed-size record per written frame.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "FrameIndex.h"
+#include "FileUtil.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+//==========================================================================================
+// FrameIndexWriter member function implementaion
+//==========================================================================================
+FrameIndexWriter::FrameIndexWriter () :
+  mFile (nullptr)
+{
+}
+
+FrameIndexWriter::~FrameIndexWriter ()
+{
+  Close ();
+}
+
+bool FrameIndexWriter::Open (const std::string& _file, int _cameraIndex, double _nominalFps)
+{
+  Close ();
+  mFile = ::fopen (_file.c_str (), "wb");
+  if (!mFile)
+    return false;
+
+  FrameIndexHeader header;
+  ::memset (&header, 0, sizeof (header));
+  ::memcpy (header.magic, FRAMEINDEX_MAGIC, sizeof (header.magic));
+  header.version         = FRAMEINDEX_VERSION;
+  header.headerSize      = sizeof (FrameIndexHeader);
+  header.recordSize      = sizeof (FrameIndexRecord);
+  header.cameraIndex     = _cameraIndex;
+  header.nominalFps      = _nominalFps;
+  header.startTimeNs     = FrameIndexTime (std::chrono::steady_clock::now ());
+  header.startWallTimeUs = std::chrono::duration_cast<std::chrono::microseconds> (
+    std::chrono::system_clock::now ().time_since_epoch ()).count ();
+
+  if (::fwrite (&header, sizeof (header), 1, mFile) != 1)
+  {
+    Close ();
+    return false;
+  }
+  return true;
+}
+
+void FrameIndexWriter::Append (const FrameIndexRecord& _record)
+{
+  if (mFile)
+    ::fwrite (&_record, sizeof (_record), 1, mFile);
+}
+
+void FrameIndexWriter::Flush ()
+{
+  FlushToDisk (mFile);
+}
+
+void FrameIndexWriter::Close ()
+{
+  if (mFile)
+    ::fclose (mFile);
+  mFile = nullptr;
+}
+
+//==========================================================================================
+// FrameIndexReader member function implementaion
+//==========================================================================================
+FrameIndexReader::FrameIndexReader () :
+  mHeader  (nullptr),
+  mRecords (nullptr),
+  mCount   (0),
+  mLength  (0),
+  mMapping (nullptr)
+#ifdef _WIN32
+  , mFileHandle (INVALID_HANDLE_VALUE),
+  mMapHandle  (nullptr)
+#endif
+{
+}
+
+FrameIndexReader::~FrameIndexReader ()
+{
+  Close ();
+}
+
+bool FrameIndexReader::Open (const std::string& _file)
+{
+  Close ();
+
+#ifdef _WIN32
+  mFileHandle = ::CreateFileA (_file.c_str (), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                               nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (mFileHandle == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size;
+  if (!::GetFileSizeEx (mFileHandle, &size) || size.QuadPart < (LONGLONG)sizeof (FrameIndexHeader))
+  {
+    Close ();
+    return false;
+  }
+  mLength    = static_cast<size_t> (size.QuadPart);
+  mMapHandle = ::CreateFileMappingA (mFileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mMapHandle)
+    mMapping = ::MapViewOfFile (mMapHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+  int fd = ::open (_file.c_str (), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (::fstat (fd, &st) != 0 || st.st_size < (off_t)sizeof (FrameIndexHeader))
+  {
+    ::close (fd);
+    return false;
+  }
+  mLength  = static_cast<size_t> (st.st_size);
+  mMapping = ::mmap (nullptr, mLength, PROT_READ, MAP_SHARED, fd, 0);
+  ::close (fd);
+  if (mMapping == MAP_FAILED)
+    mMapping = nullptr;
+#endif
+
+  if (!mMapping)
+  {
+    Close ();
+    return false;
+  }
+
+  mHeader = static_cast<const FrameIndexHeader*> (mMapping);
+  if (::memcmp (mHeader->magic, FRAMEINDEX_MAGIC, sizeof (mHeader->magic)) != 0
+      || mHeader->recordSize != sizeof (FrameIndexRecord)
+      || mHeader->headerSize < sizeof (FrameIndexHeader)
+      || mHeader->headerSize > mLength)
+  {
+    Close ();
+    return false;
+  }
+
+  mRecords = reinterpret_cast<const FrameIndexRecord*> (
+    static_cast<const char*> (mMapping) + mHeader->headerSize);
+  // a partially written trailing record is ignored
+  mCount   = (mLength - mHeader->headerSize) / sizeof (FrameIndexRecord);
+  return true;
+}
+
+void FrameIndexReader::Close ()
+{
+#ifdef _WIN32
+  if (mMapping)
+    ::UnmapViewOfFile (mMapping);
+  if (mMapHandle)
+    ::CloseHandle (mMapHandle);
+  if (mFileHandle != INVALID_HANDLE_VALUE)
+    ::CloseHandle (mFileHandle);
+  mMapHandle  = nullptr;
+  mFileHandle = INVALID_HANDLE_VALUE;
+#else
+  if (mMapping)
+    ::munmap (mMapping, mLength);
+#endif
+  mMapping = nullptr;
+  mHeader  = nullptr;
+  mRecords = nullptr;
+  mCount   = 0;
+  mLength  = 0;
+}
+
+size_t FrameIndexReader::FindByCaptureTime (int64_t _timeNs) const
+{
+  const FrameIndexRecord* end = mRecords + mCount;
+  const FrameIndexRecord* it  = std::lower_bound (mRecords, end, _timeNs,
+    [] (const FrameIndexRecord& r, int64_t t) { return r.captureTimeNs < t; });
+  return it - mRecords;
+}
+
+size_t FrameIndexReader::FindByDriverTime (double _timeMs) const
+{
+  const FrameIndexRecord* end = mRecords + mCount;
+  const FrameIndexRecord* it  = std::lower_bound (mRecords, end, _timeMs,
+    [] (const FrameIndexRecord& r, double t) { return r.driverTimeMs < t; });
+  return it - mRecords;
+}
@@ -0,0 +1,145 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: FrameIndex.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A binary sidecar index written next to each recorded video,
+// with one fixed-size record per written frame. Analysis tools can map the
+// file and binary-search frames by time without decoding the video.
+//
+// File layout (little endian, no padding):
+//   FrameIndexHeader   - 64 bytes, once
+//   FrameIndexRecord   - 40 bytes, once per frame written to the video,
+//                        in frame order
+// The number of records follows from the file size. Monotonic times are
+// nanoseconds of the recording machine's steady clock; the PrecisionTime
+// fields are the same 16 bit millisecond clock as the SourceTime state.
+// Camera frame numbers count every frame the camera delivered, so gaps
+// between records show which frames were not recorded.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef FRAMEINDEX_H
+#define FRAMEINDEX_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#define FRAMEINDEX_MAGIC   "WCFIDX\0\0"
+#define FRAMEINDEX_VERSION 2
+
+// FrameIndexRecord flags
+#define FRAMEINDEX_FLAG_STATIC 0x1   // recorded at the idle rate of a static scene, see ActivityGate
+
+#pragma pack(push, 1)
+struct FrameIndexHeader
+{
+  char     magic[8];          // FRAMEINDEX_MAGIC
+  uint32_t version;           // FRAMEINDEX_VERSION
+  uint32_t headerSize;        // sizeof (FrameIndexHeader)
+  uint32_t recordSize;        // sizeof (FrameIndexRecord)
+  int32_t  cameraIndex;
+  double   nominalFps;        // frame rate the video file was opened with
+  int64_t  startTimeNs;       // monotonic time when recording started
+  int64_t  startWallTimeUs;   // microseconds since 1970-01-01 UTC at the same instant
+  uint8_t  reserved[16];
+};
+
+struct FrameIndexRecord
+{
+  uint32_t frameNumber;       // position of the frame in the recording, starting at 1
+  uint16_t capturePrecisionTime;
+  uint16_t encodedPrecisionTime;
+  int64_t  captureTimeNs;     // monotonic time the frame arrived from the device
+  double   driverTimeMs;      // CAP_PROP_POS_MSEC as reported by the capture backend
+  int64_t  encodedTimeNs;     // monotonic time the encoder accepted the frame; with chunked
+                              //   encoding, the time its chunk was copied into the file
+  uint32_t cameraFrame;       // number of the frame among all that the camera delivered; value of WebcamFrame<n>
+  uint32_t flags;             // FRAMEINDEX_FLAG_*
+};
+#pragma pack(pop)
+
+static_assert (sizeof (FrameIndexHeader) == 64, "FrameIndexHeader must be 64 bytes");
+static_assert (sizeof (FrameIndexRecord) == 40, "FrameIndexRecord must be 40 bytes");
+
+// monotonic time in the unit used by the index
+inline int64_t FrameIndexTime (std::chrono::steady_clock::time_point _t)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds> (_t.time_since_epoch ()).count ();
+}
+
+class FrameIndexWriter
+{
+public:
+  FrameIndexWriter  ();
+  ~FrameIndexWriter ();
+
+  bool Open   (const std::string& _file, int _cameraIndex, double _nominalFps);
+  void Append (const FrameIndexRecord& _record);
+  void Flush  ();   // through to the disk
+  void Close  ();
+  bool IsOpen () const { return mFile != nullptr; }
+
+private:
+  FrameIndexWriter (const FrameIndexWriter&);
+  FrameIndexWriter& operator= (const FrameIndexWriter&);
+
+  FILE* mFile;
+};
+
+// Read-only view of an index file. The file is memory mapped, so opening is
+// cheap regardless of recording length.
+class FrameIndexReader
+{
+public:
+  FrameIndexReader  ();
+  ~FrameIndexReader ();
+
+  bool Open  (const std::string& _file);
+  void Close ();
+
+  const FrameIndexHeader& Header () const { return *mHeader; }
+  size_t                  Count  () const { return mCount; }
+  const FrameIndexRecord& operator[] (size_t _i) const { return mRecords[_i]; }
+
+  // Index of the first record captured at or after _timeNs, or Count () if
+  // there is none. Capture times are increasing, so this is a binary search.
+  size_t FindByCaptureTime (int64_t _timeNs) const;
+  // The same search on the driver timestamp.
+  size_t FindByDriverTime  (double _timeMs) const;
+
+private:
+  FrameIndexReader (const FrameIndexReader&);
+  FrameIndexReader& operator= (const FrameIndexReader&);
+
+  const FrameIndexHeader* mHeader;
+  const FrameIndexRecord* mRecords;
+  size_t                  mCount;
+  size_t                  mLength;
+  void*                   mMapping;
+#ifdef _WIN32
+  void*                   mFileHandle;
+  void*                   mMapHandle;
+#endif
+};
+
+#endif // FRAMEINDEX_H
@@ -0,0 +1,164 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: FramePool.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A fixed set of preallocated image buffers for one camera.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "FramePool.h"
+
+//==========================================================================================
+// WebcamFrame lease handling
+//==========================================================================================
+WebcamFrame::WebcamFrame () :
+  captureTime   (0),
+  captureTimeNs (0),
+  driverTimeMs  (0),
+  cameraFrame   (0),
+  flags         (0),
+  mPool         (nullptr),
+  mPoolSlot     (-1)
+{
+}
+
+WebcamFrame::WebcamFrame (WebcamFrame&& _other) :
+  image         (std::move (_other.image)),
+  captureTime   (_other.captureTime),
+  captureTimeNs (_other.captureTimeNs),
+  driverTimeMs  (_other.driverTimeMs),
+  cameraFrame   (_other.cameraFrame),
+  flags         (_other.flags),
+  mPool         (_other.mPool),
+  mPoolSlot     (_other.mPoolSlot)
+{
+  _other.mPool     = nullptr;
+  _other.mPoolSlot = -1;
+}
+
+WebcamFrame::~WebcamFrame ()
+{
+  Release ();
+}
+
+WebcamFrame& WebcamFrame::operator= (WebcamFrame&& _other)
+{
+  if (this != &_other)
+  {
+    Release ();
+    image         = std::move (_other.image);
+    captureTime   = _other.captureTime;
+    captureTimeNs = _other.captureTimeNs;
+    driverTimeMs  = _other.driverTimeMs;
+    cameraFrame   = _other.cameraFrame;
+    flags         = _other.flags;
+    mPool         = _other.mPool;
+    mPoolSlot     = _other.mPoolSlot;
+    _other.mPool     = nullptr;
+    _other.mPoolSlot = -1;
+  }
+  return *this;
+}
+
+void WebcamFrame::Release ()
+{
+  // drop our reference to the buffer before the pool hands it out again
+  image.release ();
+  if (mPool)
+    mPool->Return (mPoolSlot);
+  mPool     = nullptr;
+  mPoolSlot = -1;
+}
+
+void WebcamFrame::Attach (FrameOwner* _owner, int _slot)
+{
+  mPool     = _owner;
+  mPoolSlot = _slot;
+}
+
+//==========================================================================================
+// FramePool member function implementaion
+//==========================================================================================
+FramePool::FramePool () :
+  mFrameType (0),
+  mHighWater (0),
+  mMisses    (0)
+{
+}
+
+FramePool::~FramePool ()
+{
+}
+
+void FramePool::Allocate (size_t _count, cv::Size _size, int _type)
+{
+  mBuffers.clear ();
+  mFree.reset (new FrameQueue<int> (_count, FrameQueue<int>::Block));
+  mFree->Open ();
+  mFrameSize = _size;
+  mFrameType = _type;
+  mHighWater = 0;
+  mMisses    = 0;
+
+  for (size_t i = 0; i < _count; i++)
+  {
+    // touching the memory now saves page faults while capturing, and places it on the
+    //   memory node of the allocating thread
+    mBuffers.push_back (cv::Mat (_size, _type, cv::Scalar::all (0)));
+    int slot = static_cast<int> (i);
+    mFree->Push (slot);
+  }
+}
+
+void FramePool::Lease (WebcamFrame& _frame)
+{
+  _frame.Release ();
+
+  int slot = -1;
+  if (mFree && mFree->TryPop (slot))
+  {
+    // a header onto the pooled buffer; reading into it reuses the memory as
+    // long as the camera keeps delivering the negotiated size and format
+    _frame.image = mBuffers[slot];
+    _frame.Attach (this, slot);
+
+    size_t in_use = InUse ();
+    if (in_use > mHighWater.load (std::memory_order_relaxed))
+      mHighWater.store (in_use, std::memory_order_relaxed);
+  }
+  else
+  {
+    _frame.image.create (mFrameSize, mFrameType);
+    mMisses.fetch_add (1, std::memory_order_relaxed);
+  }
+}
+
+size_t FramePool::InUse () const
+{
+  return mFree ? mBuffers.size () - mFree->Depth () : 0;
+}
+
+void FramePool::Return (int _slot)
+{
+  if (mFree && _slot >= 0)
+    mFree->Push (_slot);
+}
@@ -0,0 +1,78 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: FramePool.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A fixed set of preallocated image buffers for one camera.
+// The capture stage leases a buffer for each frame it reads; the buffer
+// travels through overlay, display and encoding inside a WebcamFrame and is
+// returned to the pool when that frame is released. The pool is sized once,
+// from the negotiated width, height and pixel format, so steady-state
+// capture does not allocate.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "WebcamFrame.h"
+#include "FrameQueue.h"
+
+class FramePool : public FrameOwner
+{
+public:
+  FramePool  ();
+  ~FramePool ();
+
+  // (Re)allocates the buffers. Must not be called while frames are leased.
+  void     Allocate  (size_t _count, cv::Size _size, int _type);
+
+  // Attaches a free buffer to _frame. If the pool is exhausted, _frame gets
+  // a freshly allocated image instead and the miss is counted.
+  void     Lease     (WebcamFrame& _frame);
+
+  size_t   Size      () const { return mBuffers.size (); }
+  size_t   InUse     () const;
+  size_t   HighWater () const { return mHighWater.load (std::memory_order_relaxed); }
+  uint64_t Misses    () const { return mMisses.load (std::memory_order_relaxed); }
+  cv::Size FrameSize () const { return mFrameSize; }
+  int      FrameType () const { return mFrameType; }
+
+private:
+  void     Return    (int _slot) override;
+
+  FramePool (const FramePool&);
+  FramePool& operator= (const FramePool&);
+
+  std::vector<cv::Mat>              mBuffers;
+  std::unique_ptr<FrameQueue<int> > mFree;
+  cv::Size                          mFrameSize;
+  int                               mFrameType;
+
+  std::atomic<size_t>               mHighWater;
+  std::atomic<uint64_t>             mMisses;
+};
+
+#endif // FRAMEPOOL_H
@@ -0,0 +1,221 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: FrameQueue.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A bounded, lock-free ring of frames that connects the capture
+// stage of a WebcamThread to its writer stage. There is exactly one producer
+// (the capture thread) and one consumer (the writer thread). When the ring is
+// full the producer either discards the oldest queued frame (DropOldest) or
+// waits for the consumer to make room (Block).
+//
+// The ring is a sequence-numbered cell array, so the producer may act as a
+// second consumer when it discards the oldest entry without racing the writer.
+// An idle consumer sleeps in Pop () or Wait () until the producer pushes.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef FRAMEQUEUE_H
+#define FRAMEQUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "WakeSignal.h"
+
+template<class T>
+class FrameQueue
+{
+public:
+  enum DropPolicy
+  {
+    DropOldest = 0,
+    Block      = 1,
+  };
+
+  FrameQueue (size_t _capacity, DropPolicy _policy) :
+    mPolicy (_policy),
+    mClosed (false),
+    mHead   (0),
+    mTail   (0),
+    mPushed (0),
+    mDropped(0),
+    mHighWater(0)
+  {
+    // round the capacity up to a power of two so that indexing is a mask
+    size_t capacity = 2;
+    while (capacity < _capacity)
+      capacity <<= 1;
+    mMask  = capacity - 1;
+    mCells.reset (new Cell[capacity]);
+    for (size_t i = 0; i < capacity; i++)
+      mCells[i].seq.store (i, std::memory_order_relaxed);
+  }
+
+  // Producer side. Returns false if the frame was not queued, which only
+  // happens while the queue is closed.
+  bool Push (T& _item)
+  {
+    if (mClosed.load (std::memory_order_acquire))
+      return false;
+
+    while (!TryPush (_item))
+    {
+      if (mClosed.load (std::memory_order_acquire))
+        return false;
+
+      if (mPolicy == DropOldest)
+      {
+        T discarded;
+        if (TryPop (discarded))
+          mDropped.fetch_add (1, std::memory_order_relaxed);
+      }
+      else
+      {
+        std::this_thread::yield ();
+      }
+    }
+    mPushed.fetch_add (1, std::memory_order_relaxed);
+    mWake.Notify ();
+
+    size_t depth = Depth ();
+    if (depth > mHighWater.load (std::memory_order_relaxed))
+      mHighWater.store (depth, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Consumer side. Returns false if the queue is empty.
+  bool TryPop (T& _item)
+  {
+    Cell*  cell = nullptr;
+    size_t pos  = mTail.load (std::memory_order_relaxed);
+    for (;;)
+    {
+      cell = &mCells[pos & mMask];
+      size_t   seq = cell->seq.load (std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (dif == 0)
+      {
+        if (mTail.compare_exchange_weak (pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (dif < 0)
+        return false;
+      else
+        pos = mTail.load (std::memory_order_relaxed);
+    }
+    _item = std::move (cell->data);
+    cell->seq.store (pos + mMask + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Waits up to _timeoutMs for an item while the queue is empty;
+  //   returns false if none arrived, or Wake () was called.
+  bool Pop (T& _item, int _timeoutMs)
+  {
+    return TryPop (_item) || (Wait (_timeoutMs) && TryPop (_item));
+  }
+
+  // Consumer side. Returns true once the queue holds an item, false after _timeoutMs
+  //   or when Wake () was called.
+  bool Wait (int _timeoutMs)
+  {
+    mWake.WaitFor (_timeoutMs, [this] () { return !Empty (); });
+    return !Empty ();
+  }
+
+  // lets a consumer waiting in Pop () or Wait () return, e.g. to terminate
+  void Wake () { mWake.Set (); }
+
+  // Closing the queue releases a producer that is blocked on a full queue.
+  void Close () { mClosed.store (true,  std::memory_order_release); }
+  void Open  () { mClosed.store (false, std::memory_order_release); }
+
+  size_t   Capacity  () const { return mMask + 1; }
+  size_t   Depth     () const { return mHead.load (std::memory_order_relaxed) - mTail.load (std::memory_order_relaxed); }
+  bool     Empty     () const { return Depth () == 0; }
+  uint64_t Pushed    () const { return mPushed.load (std::memory_order_relaxed); }
+  uint64_t Dropped   () const { return mDropped.load (std::memory_order_relaxed); }
+  size_t   HighWater () const { return mHighWater.load (std::memory_order_relaxed); }
+
+  void ResetStatistics ()
+  {
+    mPushed.store    (0, std::memory_order_relaxed);
+    mDropped.store   (0, std::memory_order_relaxed);
+    mHighWater.store (0, std::memory_order_relaxed);
+  }
+
+private:
+  FrameQueue (const FrameQueue&);
+  FrameQueue& operator= (const FrameQueue&);
+
+  bool TryPush (T& _item)
+  {
+    Cell*  cell = nullptr;
+    size_t pos  = mHead.load (std::memory_order_relaxed);
+    for (;;)
+    {
+      cell = &mCells[pos & mMask];
+      size_t   seq = cell->seq.load (std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif == 0)
+      {
+        if (mHead.compare_exchange_weak (pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (dif < 0)
+        return false;
+      else
+        pos = mHead.load (std::memory_order_relaxed);
+    }
+    cell->data = std::move (_item);
+    cell->seq.store (pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  struct Cell
+  {
+    std::atomic<size_t> seq;
+    T                   data;
+  };
+
+  DropPolicy               mPolicy;
+  std::unique_ptr<Cell[]>  mCells;
+  size_t                   mMask;
+  std::atomic<bool>        mClosed;
+  WakeSignal               mWake;
+
+  // producer and consumer indices live on separate cache lines
+  char                     mPad0[64];
+  std::atomic<size_t>      mHead;
+  char                     mPad1[64];
+  std::atomic<size_t>      mTail;
+  char                     mPad2[64];
+
+  std::atomic<uint64_t>    mPushed;
+  std::atomic<uint64_t>    mDropped;
+  std::atomic<size_t>      mHighWater;
+};
+
+#endif // FRAMEQUEUE_H
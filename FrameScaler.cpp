@@ -0,0 +1,121 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: FrameScaler.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Crops and resizes camera frames to the recorded size.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "FrameScaler.h"
+
+#include <cstdio>
+
+namespace
+{
+  bool IsNone (const std::string& _text)
+  {
+    return _text.empty () || _text == "0" || _text == "none";
+  }
+}
+
+bool FrameScaler::ParseSize (const std::string& _text, cv::Size& _size, std::string& _error)
+{
+  _size = cv::Size ();
+  if (IsNone (_text))
+    return true;
+  int  w = 0, h = 0;
+  char end = 0;
+  if (::sscanf (_text.c_str (), "%dx%d%c", &w, &h, &end) != 2 || w < 2 || h < 2)
+  {
+    _error = "expected <width>x<height>, e.g. 640x480";
+    return false;
+  }
+  _size = cv::Size (w, h);
+  return true;
+}
+
+bool FrameScaler::ParseRect (const std::string& _text, cv::Rect& _rect, std::string& _error)
+{
+  _rect = cv::Rect ();
+  if (IsNone (_text))
+    return true;
+  int  x = 0, y = 0, w = 0, h = 0;
+  char end = 0;
+  if (::sscanf (_text.c_str (), "%d,%d,%d,%d%c", &x, &y, &w, &h, &end) != 4
+      || x < 0 || y < 0 || w < 2 || h < 2)
+  {
+    _error = "expected <x>,<y>,<width>,<height>, e.g. 640,300,640,480";
+    return false;
+  }
+  _rect = cv::Rect (x, y, w, h);
+  return true;
+}
+
+FrameScaler::FrameScaler () :
+  mEnabled       (false),
+  mInterpolation (cv::INTER_AREA)
+{
+}
+
+bool FrameScaler::Configure (cv::Size _source, cv::Rect _crop, cv::Size _output, std::string& _error)
+{
+  mEnabled = false;
+  mSource  = _source;
+  mCrop    = cv::Rect (0, 0, _source.width, _source.height);
+  mOutput  = _source;
+  if (_crop.empty () && (_output.width <= 0 || _output == _source))
+    return true;
+
+  if (!_crop.empty ())
+  {
+    if (_crop.x + _crop.width > _source.width || _crop.y + _crop.height > _source.height)
+    {
+      _error = "the crop region lies outside of the camera's " + std::to_string (_source.width)
+               + "x" + std::to_string (_source.height) + " image";
+      return false;
+    }
+    mCrop = _crop;
+  }
+  mOutput = _output.width > 0 ? _output : mCrop.size ();
+  mOutput = cv::Size (mOutput.width & ~1, mOutput.height & ~1);
+
+  // area interpolation averages all source pixels when shrinking; it only blurs when enlarging
+  bool shrinking = mOutput.width <= mCrop.width && mOutput.height <= mCrop.height;
+  mInterpolation = shrinking ? cv::INTER_AREA : cv::INTER_LINEAR;
+  mEnabled = true;
+  return true;
+}
+
+void FrameScaler::Apply (const cv::Mat& _in, cv::Mat& _out) const
+{
+  // frames of another size than configured are cropped as far as they reach
+  cv::Mat region = _in (mCrop & cv::Rect (0, 0, _in.cols, _in.rows));
+  if (region.empty ())
+  {
+    _out.create (mOutput, _in.type ());
+    _out.setTo (cv::Scalar::all (0));
+  }
+  else if (region.size () == mOutput)
+    region.copyTo (_out);
+  else
+    cv::resize (region, _out, mOutput, 0, 0, mInterpolation);
+}
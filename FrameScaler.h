@@ -0,0 +1,67 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: FrameScaler.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Crops and resizes camera frames to the recorded size, ahead
+// of the overlay and the encoder, so that a camera can run in a large mode
+// for its exposure and field of view while only the region of interest is
+// encoded and written. The crop is a view into the camera image; the one
+// copy made is cv::resize with area interpolation when shrinking, which is
+// vectorized by OpenCV, or a plain copy when the sizes match.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef FRAMESCALER_H
+#define FRAMESCALER_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+class FrameScaler
+{
+public:
+  // "<width>x<height>"; empty or "0" for none
+  static bool ParseSize (const std::string& _text, cv::Size& _size, std::string& _error);
+  // "<x>,<y>,<width>,<height>" in camera pixels; empty or "0" for none
+  static bool ParseRect (const std::string& _text, cv::Rect& _rect, std::string& _error);
+
+  FrameScaler ();
+
+  // An empty _crop records the whole frame, an empty _output the crop at its own size.
+  //   Recorded sizes are rounded down to even numbers, which most encoders need.
+  bool     Configure  (cv::Size _source, cv::Rect _crop, cv::Size _output, std::string& _error);
+  // false if frames are recorded as the camera delivers them
+  bool     Enabled    () const { return mEnabled; }
+  cv::Size OutputSize () const { return mOutput; }
+  cv::Rect Crop       () const { return mCrop; }
+
+  // _out keeps its buffer if it has the output size and the type of _in
+  void     Apply      (const cv::Mat& _in, cv::Mat& _out) const;
+
+private:
+  bool     mEnabled;
+  cv::Size mSource;
+  cv::Rect mCrop;
+  cv::Size mOutput;
+  int      mInterpolation;
+};
+
+#endif // FRAMESCALER_H
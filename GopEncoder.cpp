@@ -0,0 +1,225 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: GopEncoder.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Encodes one camera's stream as independent chunks on the
+// shared EncoderPool and joins them into one video file.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "GopEncoder.h"
+#include "BCIStream.h"
+#include "PrecisionTime.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+// how long Close () sleeps between checks for finished chunks
+#define GOP_WAIT_MS 1
+
+GopEncoder::GopEncoder (int _camIndex) :
+  mCameraIndex   (_camIndex),
+  mFourcc        (0),
+  mFps           (0),
+  mIsColor       (true),
+  mChunkFrames   (0),
+  mChunkCount    (0),
+  mIndex         (nullptr),
+  mLost          (0),
+  mEntryMismatch (false),
+  mAttached      (false)
+{
+}
+
+GopEncoder::~GopEncoder ()
+{
+  Close (std::chrono::steady_clock::time_point::max ());
+}
+
+bool GopEncoder::Open (const std::string& _videoFile, int _fourcc, double _fps,
+                       cv::Size _size, bool _isColor, int _chunkFrames)
+{
+  Close (std::chrono::steady_clock::time_point::max ());
+  mFile          = _videoFile;
+  mFourcc        = _fourcc;
+  mFps           = _fps;
+  mSize          = _size;
+  mIsColor       = _isColor;
+  mChunkFrames   = std::max (1, _chunkFrames);
+  mChunkCount    = 0;
+  mLost          = 0;
+  mEntryMismatch = false;
+  if (!mMuxer.Open (_videoFile, Mp4Muxer::Copy, _size.width, _size.height, _fps))
+    return false;
+  EncoderPool::Instance ().Attach ();
+  mAttached = true;
+  return true;
+}
+
+void GopEncoder::Add (WebcamFrame& _frame, const FrameIndexRecord& _record)
+{
+  if (!mCurrent)
+  {
+    // chunks are queued right away, so that encoding keeps up with the camera
+    std::string file = mFile + ".chunk" + std::to_string (mChunkCount++) + ".mp4";
+    mCurrent = std::make_shared<EncodeChunk> (file, mFourcc, mFps, mSize, mIsColor);
+    mOutstanding.push_back (mCurrent);
+    EncoderPool::Instance ().Enqueue (mCurrent);
+  }
+  mCurrent->Add (_frame);
+  mRecords.push_back (_record);
+  if (mCurrent->Frames () >= static_cast<size_t> (mChunkFrames))
+  {
+    mCurrent->Finish ();
+    mCurrent.reset ();
+  }
+}
+
+bool GopEncoder::Busy () const
+{
+  // The chunk being filled always takes frames, or its worker would wait for them forever.
+  //   Encoders check for room at the same time, so the pool may go over by a chunk or two.
+  const EncoderPool& pool = EncoderPool::Instance ();
+  return !mCurrent && (mOutstanding.size () > static_cast<size_t> (pool.Threads ()) || !pool.HasRoom ());
+}
+
+void GopEncoder::Collect ()
+{
+  while (!mOutstanding.empty () && mOutstanding.front ()->Done ())
+  {
+    const EncodeChunk& chunk = *mOutstanding.front ();
+    uint64_t samples = mMuxer.Samples ();
+    if (chunk.Succeeded ())
+      Remux (chunk);
+    else
+    {
+      bciwarn << "WebcamLogger: Could not encode " << chunk.Frames () << " frames of camera "
+              << mCameraIndex << std::endl;
+      mLost += chunk.Frames ();
+    }
+    Index (chunk.Frames (), static_cast<size_t> (mMuxer.Samples () - samples));
+    std::remove (chunk.File ().c_str ());
+    mOutstanding.pop_front ();
+    EncoderPool::Instance ().Retire ();
+  }
+}
+
+void GopEncoder::Index (size_t _frames, size_t _written)
+{
+  // The frames of a chunk reach the file only when the whole chunk is copied, which is
+  //   the time the index gives them. Frames that did not make it are not indexed.
+  int64_t  now       = FrameIndexTime (std::chrono::steady_clock::now ());
+  uint16_t precision = PrecisionTime::Now ();
+  uint64_t position  = mMuxer.Samples () - _written;
+  for (size_t i = 0; i < _frames && !mRecords.empty (); i++)
+  {
+    FrameIndexRecord record = mRecords.front ();
+    mRecords.pop_front ();
+    if (i >= _written || !mIndex)
+      continue;
+    record.frameNumber          = static_cast<uint32_t> (++position);
+    record.encodedPrecisionTime = precision;
+    record.encodedTimeNs        = now;
+    mIndex->Append (record);
+  }
+}
+
+void GopEncoder::Remux (const EncodeChunk& _chunk)
+{
+  const std::vector<int64_t>& times = _chunk.CaptureTimes ();
+  if (!mReader.Open (_chunk.File ()))
+  {
+    bciwarn << "WebcamLogger: Could not read encoded chunk " << _chunk.File () << std::endl;
+    mLost += times.size ();
+    return;
+  }
+
+  // every chunk comes from an encoder with the same settings, so the first one describes all
+  if (mMuxer.Samples () == 0)
+    mMuxer.SetSampleEntry (mReader.SampleEntry ());
+  else if (!mEntryMismatch && mReader.SampleEntry () != mMuxer.SampleEntry ())
+    mEntryMismatch = true;
+
+  // Samples are stored in decode order. The frame shown at position k of the chunk has the
+  //   k-th capture time; an encoder with reordered frames decodes some frames before it
+  //   shows them, which the presentation times tell.
+  const std::vector<Mp4Reader::Sample>& samples = mReader.Samples ();
+  size_t count = std::min (samples.size (), times.size ());
+  std::vector<size_t> shown (samples.size ());
+  for (size_t i = 0; i < shown.size (); i++)
+    shown[i] = i;
+  std::stable_sort (shown.begin (), shown.end (), [&samples] (size_t a, size_t b)
+    { return samples[a].presentationTime < samples[b].presentationTime; });
+  std::vector<size_t> rank (samples.size ());
+  for (size_t k = 0; k < shown.size (); k++)
+    rank[shown[k]] = k;
+
+  for (size_t i = 0; i < count; i++)
+  {
+    if (!mReader.Read (samples[i], mSample))
+      break;
+    int64_t presentation = rank[i] < count ? times[rank[i]] : times[i];
+    mMuxer.WriteSample (mSample.data (), mSample.size (), times[i], presentation, samples[i].sync);
+  }
+  if (times.size () > count)
+    mLost += times.size () - count;
+  mReader.Close ();
+}
+
+void GopEncoder::Close (std::chrono::steady_clock::time_point _deadline)
+{
+  if (mCurrent)
+    mCurrent->Finish ();
+  mCurrent.reset ();
+
+  Collect ();
+  while (!mOutstanding.empty () && std::chrono::steady_clock::now () < _deadline)
+  {
+    std::this_thread::sleep_for (std::chrono::milliseconds (GOP_WAIT_MS));
+    Collect ();
+  }
+  // chunks not encoded by the deadline are given up, and their frames are lost
+  uint64_t abandoned = 0;
+  for (const std::shared_ptr<EncodeChunk>& chunk : mOutstanding)
+  {
+    chunk->Abandon ();
+    abandoned += chunk->Frames ();
+    EncoderPool::Instance ().Retire ();
+  }
+  mOutstanding.clear ();
+  mRecords.clear ();
+  if (abandoned > 0)
+    bciwarn << "WebcamLogger: Gave up on " << abandoned << " frames of camera " << mCameraIndex
+            << " that were not encoded in time" << std::endl;
+  mLost += abandoned;
+  if (mEntryMismatch)
+    bciwarn << "WebcamLogger: The encoder of camera " << mCameraIndex
+            << " changed its stream parameters between chunks; " << mFile
+            << " may not play correctly" << std::endl;
+  mEntryMismatch = false;
+  mMuxer.Close ();
+  if (mAttached)
+    EncoderPool::Instance ().Detach ();
+  mAttached = false;
+}
@@ -0,0 +1,105 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: GopEncoder.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Encodes one camera's stream on the shared EncoderPool. The
+// stream is cut into chunks of a fixed number of frames, each encoded
+// independently as a closed GOP, so that one fast or high resolution
+// camera can use as many cores as there are chunks in flight. Finished
+// chunks are copied, in order and without re-encoding, into the camera's
+// video file, where each frame gets its own capture time.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef GOPENCODER_H
+#define GOPENCODER_H
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "EncoderPool.h"
+#include "FrameIndex.h"
+#include "Mp4Muxer.h"
+#include "Mp4Reader.h"
+#include "WebcamFrame.h"
+
+class GopEncoder
+{
+public:
+  explicit GopEncoder (int _camIndex);
+  ~GopEncoder ();
+
+  bool     Open        (const std::string& _videoFile, int _fourcc, double _fps,
+                        cv::Size _size, bool _isColor, int _chunkFrames);
+  bool     IsOpen      () const { return mMuxer.IsOpen (); }
+  // see Mp4Muxer::SetFragments (); takes effect at Open ()
+  void     SetFragments (int64_t _durationNs, SegmentManifest* _manifest) { mMuxer.SetFragments (_durationNs, _manifest); }
+  // see Mp4Muxer::SetVideoIo (); takes effect at Open ()
+  void     SetVideoIo   (const VideoIoOptions& _options) { mMuxer.SetVideoIo (_options); }
+  bool     DirectIo     () const { return mMuxer.DirectIo (); }
+  // index records of frames are appended to _index once the frames are in the file
+  void     SetFrameIndex (FrameIndexWriter* _index) { mIndex = _index; }
+
+  // called from the writer thread
+  // takes over the frame; _record is completed and indexed when the frame is in the file
+  void     Add         (WebcamFrame& _frame, const FrameIndexRecord& _record);
+  void     Collect     ();                      // copies finished chunks into the file, in order
+  bool     Busy        () const;                // a new chunk is due, but the pool has no room for it
+  // waits for the remaining chunks; those not encoded by _deadline are abandoned and
+  //   their frames counted as lost
+  void     Close       (std::chrono::steady_clock::time_point _deadline);
+
+  uint64_t LostFrames  () const { return mLost; }
+
+private:
+  GopEncoder (const GopEncoder&);
+  GopEncoder& operator= (const GopEncoder&);
+
+  void     Remux       (const EncodeChunk& _chunk);
+  void     Index       (size_t _frames, size_t _written);
+
+  int                                        mCameraIndex;
+  std::string                                mFile;
+  int                                        mFourcc;
+  double                                     mFps;
+  cv::Size                                   mSize;
+  bool                                       mIsColor;
+  int                                        mChunkFrames;
+  unsigned int                               mChunkCount;
+
+  std::shared_ptr<EncodeChunk>               mCurrent;       // receiving frames
+  std::deque<std::shared_ptr<EncodeChunk> >  mOutstanding;   // in stream order, including mCurrent
+  std::deque<FrameIndexRecord>               mRecords;       // of the frames in mOutstanding, in order
+  FrameIndexWriter*                          mIndex;
+
+  Mp4Muxer                                   mMuxer;
+  Mp4Reader                                  mReader;
+  std::vector<uint8_t>                       mSample;
+  uint64_t                                   mLost;
+  bool                                       mEntryMismatch;
+  bool                                       mAttached;      // counted by the pool as an open encoder
+};
+
+#endif // GOPENCODER_H
@@ -2,6 +2,36 @@
 ## $Id: IncludeExtension.cmake 5828 2018-11-28 16:45:06Z abelsten $
 ## Authors: jezhill@gmail.com
 
+# capture/encode pipeline, shared by the extension and the benchmark
+set( WEBCAMLOGGER_PIPELINE_FILES
+   ${BCI2000_EXTENSION_DIR}/WebcamThread.cpp
+   ${BCI2000_EXTENSION_DIR}/WebcamWriter.cpp
+   ${BCI2000_EXTENSION_DIR}/FramePool.cpp
+   ${BCI2000_EXTENSION_DIR}/FrameIndex.cpp
+   ${BCI2000_EXTENSION_DIR}/TimestampOverlay.cpp
+   ${BCI2000_EXTENSION_DIR}/WebcamDisplay.cpp
+   ${BCI2000_EXTENSION_DIR}/CameraEnumerator.cpp
+   ${BCI2000_EXTENSION_DIR}/VirtualCamera.cpp
+   ${BCI2000_EXTENSION_DIR}/PipelineTelemetry.cpp
+   ${BCI2000_EXTENSION_DIR}/CaptureReactor.cpp
+   ${BCI2000_EXTENSION_DIR}/V4l2Device.cpp
+   ${BCI2000_EXTENSION_DIR}/V4l2Camera.cpp
+   ${BCI2000_EXTENSION_DIR}/Mp4Muxer.cpp
+   ${BCI2000_EXTENSION_DIR}/Mp4Reader.cpp
+   ${BCI2000_EXTENSION_DIR}/VideoSink.cpp
+   ${BCI2000_EXTENSION_DIR}/EncoderPool.cpp
+   ${BCI2000_EXTENSION_DIR}/FrameEvents.cpp
+   ${BCI2000_EXTENSION_DIR}/GopEncoder.cpp
+   ${BCI2000_EXTENSION_DIR}/SegmentManifest.cpp
+   ${BCI2000_EXTENSION_DIR}/FileUtil.cpp
+   ${BCI2000_EXTENSION_DIR}/PreTriggerBuffer.cpp
+   ${BCI2000_EXTENSION_DIR}/FrameScaler.cpp
+   ${BCI2000_EXTENSION_DIR}/ActivityGate.cpp
+   ${BCI2000_EXTENSION_DIR}/ThreadPlacement.cpp
+   ${BCI2000_EXTENSION_DIR}/SharedFrameRing.cpp
+   ${BCI2000_EXTENSION_DIR}/VideoFeatures.cpp
+)
+
 if( MSVC )
 
 if( CMAKE_SIZEOF_VOID_P EQUAL 8 )
@@ -15,14 +45,10 @@ endif()
 set( OPENCV_LIBDIR 
   ${PROJECT_SRC_DIR}/extlib/opencv/lib/msvc/${OPENCV_ARCH}
 )
+set( WEBCAMLOGGER_OPENCV_INCLUDE ${PROJECT_SRC_DIR}/extlib/opencv/include )
+set( WEBCAMLOGGER_SYSTEM_LIBS cfgmgr32 )
 
-list( APPEND BCI2000_SIGSRC_FILES
-   ${PROJECT_SRC_DIR}/extlib/opencv/include
-   ${BCI2000_EXTENSION_DIR}/WebcamLogger.cpp
-   ${BCI2000_EXTENSION_DIR}/WebcamThread.cpp
-)
-
-list( APPEND BCI2000_SIGSRC_LIBS 
+set( WEBCAMLOGGER_OPENCV_LIBS
   ${OPENCV_LIBDIR}/$<$<CONFIG:Debug>:debug/>opencv_core451$<$<CONFIG:Debug>:d>.lib
   ${OPENCV_LIBDIR}/$<$<CONFIG:Debug>:debug/>opencv_highgui451$<$<CONFIG:Debug>:d>.lib
   ${OPENCV_LIBDIR}/$<$<CONFIG:Debug>:debug/>opencv_imgcodecs451$<$<CONFIG:Debug>:d>.lib
@@ -41,11 +67,70 @@ list( APPEND BCI2000_SIGSRC_FILES
   ${OPENCV_LIBDIR}/$<$<CONFIG:Debug>:debug/>opencv_videoio451$<$<CONFIG:Debug>:d>.dll 
 )
 
-else( MSVC )
+elseif( CMAKE_SYSTEM_NAME STREQUAL "Linux" )
+
+# the native v4l2 backend, epoll, timerfd and O_DIRECT I/O are Linux only;
+# OpenCV comes from the system there
+find_package( OpenCV QUIET COMPONENTS core highgui imgcodecs imgproc video videoio )
+find_package( Threads )
+if( OpenCV_FOUND )
+  set( WEBCAMLOGGER_OPENCV_INCLUDE ${OpenCV_INCLUDE_DIRS} )
+  set( WEBCAMLOGGER_OPENCV_LIBS ${OpenCV_LIBS} )
+  # shm_open is in librt before glibc 2.34
+  set( WEBCAMLOGGER_SYSTEM_LIBS Threads::Threads rt )
+else()
+  utils_warn( "WebcamLogger: OpenCV was not found; install its development package to build the WebcamLogger." )
+endif()
+
+else()
 
   utils_warn( "WebcamLogger: OpenCV libraries are only present for MSVC on Windows." )
 
-endif( MSVC )
+endif()
 
+if( WEBCAMLOGGER_OPENCV_LIBS )
 
+list( APPEND BCI2000_SIGSRC_FILES
+   ${WEBCAMLOGGER_OPENCV_INCLUDE}
+   ${BCI2000_EXTENSION_DIR}/WebcamLogger.cpp
+   ${WEBCAMLOGGER_PIPELINE_FILES}
+)
+
+list( APPEND BCI2000_SIGSRC_LIBS 
+  ${WEBCAMLOGGER_OPENCV_LIBS}
+  ${WEBCAMLOGGER_SYSTEM_LIBS}
+)
+
+# Headless benchmark of the pipeline on virtual cameras, see WebcamBenchmark.cpp
+option( WEBCAMLOGGER_BENCHMARK "Build the WebcamLogger pipeline benchmark" OFF )
+if( WEBCAMLOGGER_BENCHMARK )
+  add_executable( WebcamBenchmark
+    ${BCI2000_EXTENSION_DIR}/WebcamBenchmark.cpp
+    ${WEBCAMLOGGER_PIPELINE_FILES}
+  )
+  target_include_directories( WebcamBenchmark PRIVATE
+    ${WEBCAMLOGGER_OPENCV_INCLUDE}
+    ${BCI2000_EXTENSION_DIR}
+  )
+  target_link_libraries( WebcamBenchmark
+    BCI2000FrameworkCore
+    ${WEBCAMLOGGER_OPENCV_LIBS}
+    ${WEBCAMLOGGER_SYSTEM_LIBS}
+  )
+  if( MSVC )
+    target_link_libraries( WebcamBenchmark psapi )
+    add_custom_command( TARGET WebcamBenchmark POST_BUILD
+      COMMAND ${CMAKE_COMMAND} -E copy_if_different
+        ${OPENCV_LIBDIR}/${OPENCV_FFMPEG}.dll
+        ${OPENCV_LIBDIR}/$<$<CONFIG:Debug>:debug/>opencv_core451$<$<CONFIG:Debug>:d>.dll
+        ${OPENCV_LIBDIR}/$<$<CONFIG:Debug>:debug/>opencv_imgcodecs451$<$<CONFIG:Debug>:d>.dll
+        ${OPENCV_LIBDIR}/$<$<CONFIG:Debug>:debug/>opencv_imgproc451$<$<CONFIG:Debug>:d>.dll
+        ${OPENCV_LIBDIR}/$<$<CONFIG:Debug>:debug/>opencv_highgui451$<$<CONFIG:Debug>:d>.dll
+        ${OPENCV_LIBDIR}/$<$<CONFIG:Debug>:debug/>opencv_video451$<$<CONFIG:Debug>:d>.dll
+        ${OPENCV_LIBDIR}/$<$<CONFIG:Debug>:debug/>opencv_videoio451$<$<CONFIG:Debug>:d>.dll
+        $<TARGET_FILE_DIR:WebcamBenchmark>
+    )
+  endif()
+endif()
 
+endif( WEBCAMLOGGER_OPENCV_LIBS )
@@ -0,0 +1,675 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: Mp4Muxer.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Writes video that a camera has already compressed into an
+// MP4 file, without decoding and re-encoding it.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "Mp4Muxer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+
+// media time units per second; the customary clock of MP4 video tracks
+#define MP4_TIMESCALE       90000
+
+// movie header time units per second
+#define MP4_MOVIE_TIMESCALE 1000
+
+// MPEG-4 systems object type of JPEG images
+#define MP4_OBJECT_TYPE_JPEG 0x6C
+
+// track run sample flags: a sync sample, and a sample that depends on others
+#define MP4_SAMPLE_FLAGS_SYNC     0x02000000
+#define MP4_SAMPLE_FLAGS_NON_SYNC 0x01010000
+
+namespace
+{
+  // big-endian box serialization into a byte vector
+  void Put8  (std::vector<uint8_t>& _out, uint32_t _v) { _out.push_back (static_cast<uint8_t> (_v)); }
+  void Put16 (std::vector<uint8_t>& _out, uint32_t _v) { Put8 (_out, _v >> 8);   Put8 (_out, _v); }
+  void Put32 (std::vector<uint8_t>& _out, uint32_t _v) { Put16 (_out, _v >> 16); Put16 (_out, _v); }
+  void Put64 (std::vector<uint8_t>& _out, uint64_t _v) { Put32 (_out, static_cast<uint32_t> (_v >> 32)); Put32 (_out, static_cast<uint32_t> (_v)); }
+  void PutTag (std::vector<uint8_t>& _out, const char* _tag) { _out.insert (_out.end (), _tag, _tag + 4); }
+  void PutZeros (std::vector<uint8_t>& _out, size_t _n) { _out.insert (_out.end (), _n, 0); }
+
+  // starts a box and returns its position, to be passed to EndBox ()
+  size_t BeginBox (std::vector<uint8_t>& _out, const char* _type)
+  {
+    size_t start = _out.size ();
+    Put32 (_out, 0);
+    PutTag (_out, _type);
+    return start;
+  }
+
+  size_t BeginFullBox (std::vector<uint8_t>& _out, const char* _type, int _version, uint32_t _flags)
+  {
+    size_t start = BeginBox (_out, _type);
+    Put32 (_out, (uint32_t (_version) << 24) | (_flags & 0xffffff));
+    return start;
+  }
+
+  void EndBox (std::vector<uint8_t>& _out, size_t _start)
+  {
+    uint32_t size = static_cast<uint32_t> (_out.size () - _start);
+    for (int i = 0; i < 4; i++)
+      _out[_start + i] = static_cast<uint8_t> (size >> (24 - 8 * i));
+  }
+
+  void PutMatrix (std::vector<uint8_t>& _out)
+  {
+    static const uint32_t unity[9] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+    for (int i = 0; i < 9; i++)
+      Put32 (_out, unity[i]);
+  }
+
+  bool StartCodeAt (const uint8_t* _data, size_t _bytes, size_t _pos)
+  {
+    return _pos + 2 < _bytes && _data[_pos] == 0 && _data[_pos + 1] == 0 && _data[_pos + 2] == 1;
+  }
+}
+
+//==========================================================================================
+// Mp4Muxer member function implementaion
+//==========================================================================================
+bool Mp4Muxer::CodecFor (int _fourcc, Codec& _codec)
+{
+  char c[4];
+  for (int i = 0; i < 4; i++)
+    c[i] = static_cast<char> (::toupper ((_fourcc >> (8 * i)) & 0xff));
+
+  if (!::memcmp (c, "MJPG", 4))
+    _codec = Jpeg;
+  else if (!::memcmp (c, "H264", 4) || !::memcmp (c, "AVC1", 4) || !::memcmp (c, "X264", 4))
+    _codec = H264;
+  else
+    return false;
+  return true;
+}
+
+bool Mp4Muxer::IsSample (Codec _codec, const uint8_t* _data, size_t _bytes)
+{
+  if (_codec == Jpeg)
+    return _bytes > 2 && _data[0] == 0xff && _data[1] == 0xd8;   // start of image marker
+  return StartCodeAt (_data, _bytes, 0) || (_bytes > 3 && _data[0] == 0 && StartCodeAt (_data, _bytes, 1));
+}
+
+Mp4Muxer::Mp4Muxer () :
+  mCodec     (Jpeg),
+  mWidth     (0),
+  mHeight    (0),
+  mFps       (0),
+  mMdatStart (0),
+  mOffset    (0),
+  mSkipped   (0),
+  mSampleCount   (0),
+  mFragmentNs    (0),
+  mManifest      (nullptr),
+  mFragmented    (false),
+  mInitWritten   (false),
+  mBaseTime      (0),
+  mLastDts       (0),
+  mFragmentCount (0),
+  mFragmentFirst (1)
+{
+}
+
+Mp4Muxer::~Mp4Muxer ()
+{
+  Close ();
+}
+
+void Mp4Muxer::SetFragments (int64_t _durationNs, SegmentManifest* _manifest)
+{
+  mFragmentNs = std::max<int64_t> (0, _durationNs);
+  mManifest   = _manifest;
+}
+
+bool Mp4Muxer::Open (const std::string& _file, Codec _codec, int _width, int _height, double _fps)
+{
+  Close ();
+  if (!mSink.Open (_file))
+    return false;
+
+  mCodec   = _codec;
+  mWidth   = _width;
+  mHeight  = _height;
+  mFps     = _fps;
+  mSkipped       = 0;
+  mSampleCount   = 0;
+  mFragmented    = mFragmentNs > 0;
+  mInitWritten   = false;
+  mBaseTime      = 0;
+  mLastDts       = 0;
+  mFragmentCount = 0;
+  mFragmentFirst = 1;
+  mFileName      = _file.substr (_file.find_last_of ("/\\") + 1);
+  mFragmentData.clear ();
+  mSizes.clear ();
+  mOffsets.clear ();
+  mTimes.clear ();
+  mPresentation.clear ();
+  mSyncSamples.clear ();
+  mSps.clear ();
+  mPps.clear ();
+
+  std::vector<uint8_t> head;
+  size_t ftyp = BeginBox (head, "ftyp");
+  PutTag (head, "isom");
+  Put32  (head, 0x200);
+  PutTag (head, "isom");
+  PutTag (head, mFragmented ? "iso6" : "iso2");
+  PutTag (head, _codec == H264 ? "avc1" : "mp41");
+  PutTag (head, "mp41");
+  EndBox (head, ftyp);
+
+  // media data box with a 64 bit size, patched in Close (); fragments bring their own
+  mMdatStart = head.size ();
+  if (!mFragmented)
+  {
+    Put32  (head, 1);
+    PutTag (head, "mdat");
+    Put64  (head, 0);
+  }
+
+  mOffset = head.size ();
+  if (!mSink.Write (head.data (), head.size ()))
+  {
+    mSink.Close ();
+    return false;
+  }
+  return true;
+}
+
+bool Mp4Muxer::ToLengthPrefixed (const uint8_t* _data, size_t _bytes, bool& _sync)
+{
+  mScratch.clear ();
+  _sync = false;
+
+  size_t pos = 0;
+  while (pos < _bytes && !StartCodeAt (_data, _bytes, pos))
+    pos++;
+  while (pos < _bytes)
+  {
+    size_t begin = pos + 3, end = begin;
+    while (end < _bytes && !StartCodeAt (_data, _bytes, end))
+      end++;
+    pos = end;
+
+    // zeros before the next start code belong to it, or are trailing padding
+    while (end > begin && _data[end - 1] == 0)
+      end--;
+    if (end == begin)
+      continue;
+
+    int type = _data[begin] & 0x1f;
+    if (type == 7)
+      mSps.assign (_data + begin, _data + end);
+    else if (type == 8)
+      mPps.assign (_data + begin, _data + end);
+    else if (type == 5)
+      _sync = true;
+    if (type == 9)
+      continue;   // access unit delimiters are not used in MP4
+
+    uint32_t length = static_cast<uint32_t> (end - begin);
+    Put32 (mScratch, length);
+    mScratch.insert (mScratch.end (), _data + begin, _data + end);
+  }
+  return !mScratch.empty ();
+}
+
+bool Mp4Muxer::Write (const uint8_t* _data, size_t _bytes, int64_t _timeNs)
+{
+  if (!mSink.IsOpen () || !_data || _bytes == 0)
+    return false;
+
+  const uint8_t* sample = _data;
+  size_t         size   = _bytes;
+  bool           sync   = true;
+  if (mCodec == H264)
+  {
+    if (!ToLengthPrefixed (_data, _bytes, sync))
+      return false;
+    // a decoder can only start at an IDR picture whose parameter sets it has seen
+    if (mSampleCount == 0 && (!sync || mSps.size () < 4 || mPps.empty ()))
+    {
+      mSkipped++;
+      return true;
+    }
+    sample = mScratch.data ();
+    size   = mScratch.size ();
+  }
+  return WriteSample (sample, size, _timeNs, _timeNs, sync);
+}
+
+bool Mp4Muxer::WriteSample (const uint8_t* _data, size_t _bytes, int64_t _decodeTimeNs,
+                            int64_t _presentationTimeNs, bool _sync)
+{
+  if (!mSink.IsOpen ())
+    return false;
+  if (mSampleCount == 0)
+    mBaseTime = _decodeTimeNs;
+
+  if (mFragmented)
+  {
+    // a fragment ends at the first sync sample after its duration, so that each one
+    //   can be decoded by itself
+    if (!mSizes.empty () && _sync && _decodeTimeNs - mTimes.front () >= mFragmentNs
+        && !WriteFragment (false, _decodeTimeNs))
+      return false;
+    mFragmentData.insert (mFragmentData.end (), _data, _data + _bytes);
+  }
+  else
+  {
+    if (!mSink.Write (_data, _bytes))
+      return false;
+    mOffsets.push_back (mOffset);
+    mOffset += _bytes;
+  }
+
+  if (_sync)
+    mSyncSamples.push_back (static_cast<uint32_t> (mSizes.size () + 1));
+  mSizes.push_back        (static_cast<uint32_t> (_bytes));
+  mTimes.push_back        (_decodeTimeNs);
+  mPresentation.push_back (_presentationTimeNs);
+  mSampleCount++;
+  return true;
+}
+
+int64_t Mp4Muxer::MediaTime (int64_t _timeNs) const
+{
+  return static_cast<int64_t> (std::floor ((_timeNs - mBaseTime) * (MP4_TIMESCALE / 1e9) + 0.5));
+}
+
+bool Mp4Muxer::WriteFragment (bool _final, int64_t _nextTimeNs)
+{
+  size_t count = mSizes.size ();
+  if (count == 0)
+    return true;
+
+  // the movie box is written once the sample description is known
+  if (!mInitWritten)
+  {
+    std::vector<uint8_t> movie;
+    BuildMovie (movie);
+    if (!mSink.Write (movie.data (), movie.size ()))
+      return false;
+    mOffset      += movie.size ();
+    mInitWritten  = true;
+  }
+
+  // decode times continue from the previous fragment and must strictly increase
+  std::vector<uint64_t> dts (count);
+  for (size_t i = 0; i < count; i++)
+  {
+    dts[i] = static_cast<uint64_t> (std::max<int64_t> (0, MediaTime (mTimes[i])));
+    uint64_t previous = i > 0 ? dts[i - 1] : mLastDts;
+    if ((i > 0 || mFragmentCount > 0) && dts[i] <= previous)
+      dts[i] = previous + 1;
+  }
+  int64_t lastDuration = static_cast<int64_t> (MP4_TIMESCALE / (mFps > 0 ? mFps : 30));
+  if (!_final)
+    lastDuration = MediaTime (_nextTimeNs) - static_cast<int64_t> (dts[count - 1]);
+  else if (count > 1)
+    lastDuration = static_cast<int64_t> ((dts[count - 1] - dts[0]) / (count - 1));
+  lastDuration = std::max<int64_t> (lastDuration, 1);
+
+  std::vector<uint8_t> moof;
+  size_t box  = BeginBox (moof, "moof");
+  size_t mfhd = BeginFullBox (moof, "mfhd", 0, 0);
+  Put32 (moof, mFragmentCount + 1);   // sequence numbers start at 1
+  EndBox (moof, mfhd);
+
+  size_t traf = BeginBox (moof, "traf");
+  size_t tfhd = BeginFullBox (moof, "tfhd", 0, 0x020000);   // data offsets relative to the moof box
+  Put32 (moof, 1);                    // track ID
+  EndBox (moof, tfhd);
+  size_t tfdt = BeginFullBox (moof, "tfdt", 1, 0);
+  Put64 (moof, dts[0]);
+  EndBox (moof, tfdt);
+
+  // data offset, and per sample duration, size, flags and signed composition offset
+  size_t trun = BeginFullBox (moof, "trun", 1, 0x000f01);
+  Put32 (moof, static_cast<uint32_t> (count));
+  size_t dataOffset = moof.size ();
+  Put32 (moof, 0);
+  size_t sync = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    bool isSync = sync < mSyncSamples.size () && mSyncSamples[sync] == i + 1;
+    if (isSync)
+      sync++;
+    int64_t duration = i + 1 < count ? static_cast<int64_t> (dts[i + 1] - dts[i]) : lastDuration;
+    Put32 (moof, static_cast<uint32_t> (duration));
+    Put32 (moof, mSizes[i]);
+    Put32 (moof, isSync ? MP4_SAMPLE_FLAGS_SYNC : MP4_SAMPLE_FLAGS_NON_SYNC);
+    Put32 (moof, static_cast<uint32_t> (MediaTime (mPresentation[i]) - static_cast<int64_t> (dts[i])));
+  }
+  EndBox (moof, trun);
+  EndBox (moof, traf);
+  EndBox (moof, box);
+
+  // the samples follow the 16 byte header of the media data box
+  uint32_t offset = static_cast<uint32_t> (moof.size () + 16);
+  for (int i = 0; i < 4; i++)
+    moof[dataOffset + i] = static_cast<uint8_t> (offset >> (24 - 8 * i));
+  Put32  (moof, 1);
+  PutTag (moof, "mdat");
+  Put64  (moof, 16 + mFragmentData.size ());
+
+  if (!mSink.Write (moof.data (), moof.size ())
+      || !mSink.Write (mFragmentData.data (), mFragmentData.size ()))
+    return false;
+  mSink.Sync ();
+
+  if (mManifest)
+  {
+    SegmentRecord record;
+    record.segment     = mFragmentCount;
+    record.file        = mFileName;
+    record.offset      = mOffset;
+    record.firstSample = mFragmentFirst;
+    record.samples     = count;
+    record.firstTimeNs = mTimes.front ();
+    record.lastTimeNs  = mTimes.back ();
+    mManifest->Append (record);
+  }
+
+  mOffset        += moof.size () + mFragmentData.size ();
+  mLastDts        = dts[count - 1];
+  mFragmentFirst += count;
+  mFragmentCount++;
+  mFragmentData.clear ();
+  mSizes.clear ();
+  mTimes.clear ();
+  mPresentation.clear ();
+  mSyncSamples.clear ();
+  return true;
+}
+
+void Mp4Muxer::Close ()
+{
+  if (!mSink.IsOpen ())
+    return;
+
+  if (mFragmented)
+    WriteFragment (true, 0);
+  else if (!mSizes.empty ())
+  {
+    std::vector<uint8_t> movie;
+    BuildMovie (movie);
+    mSink.Write (movie.data (), movie.size ());
+
+    // the media data box ends where the movie box begins
+    std::vector<uint8_t> size;
+    Put64 (size, mOffset - mMdatStart);
+    mSink.Patch (mMdatStart + 8, size.data (), size.size ());
+  }
+  mSink.Close ();
+}
+
+void Mp4Muxer::BuildSampleEntry (std::vector<uint8_t>& _out) const
+{
+  if (mCodec == Copy)
+  {
+    _out.insert (_out.end (), mSampleEntry.begin (), mSampleEntry.end ());
+    return;
+  }
+
+  size_t entry = BeginBox (_out, mCodec == H264 ? "avc1" : "mp4v");
+  PutZeros (_out, 6);
+  Put16    (_out, 1);            // data reference index
+  PutZeros (_out, 16);
+  Put16    (_out, mWidth);
+  Put16    (_out, mHeight);
+  Put32    (_out, 0x00480000);   // 72 dpi
+  Put32    (_out, 0x00480000);
+  Put32    (_out, 0);
+  Put16    (_out, 1);            // frames per sample
+  PutZeros (_out, 32);           // compressor name
+  Put16    (_out, 0x18);         // depth
+  Put16    (_out, 0xffff);
+
+  if (mCodec == H264)
+  {
+    size_t avcc = BeginBox (_out, "avcC");
+    Put8  (_out, 1);
+    Put8  (_out, mSps[1]);       // profile, compatibility and level from the SPS
+    Put8  (_out, mSps[2]);
+    Put8  (_out, mSps[3]);
+    Put8  (_out, 0xff);          // 4 byte NAL unit lengths
+    Put8  (_out, 0xe1);          // one SPS
+    Put16 (_out, static_cast<uint32_t> (mSps.size ()));
+    _out.insert (_out.end (), mSps.begin (), mSps.end ());
+    Put8  (_out, 1);             // one PPS
+    Put16 (_out, static_cast<uint32_t> (mPps.size ()));
+    _out.insert (_out.end (), mPps.begin (), mPps.end ());
+    EndBox (_out, avcc);
+  }
+  else
+  {
+    // elementary stream descriptor naming JPEG; it has no decoder specific info
+    size_t esds = BeginFullBox (_out, "esds", 0, 0);
+    Put8  (_out, 0x03); Put8 (_out, 3 + 2 + 13 + 2 + 1);
+    Put16 (_out, 1);             // ES ID
+    Put8  (_out, 0);
+    Put8  (_out, 0x04); Put8 (_out, 13);
+    Put8  (_out, MP4_OBJECT_TYPE_JPEG);
+    Put8  (_out, 0x11);          // visual stream
+    PutZeros (_out, 3 + 4 + 4);  // buffer size, max and average bit rate
+    Put8  (_out, 0x06); Put8 (_out, 1);
+    Put8  (_out, 0x02);
+    EndBox (_out, esds);
+  }
+  EndBox (_out, entry);
+}
+
+void Mp4Muxer::BuildMovie (std::vector<uint8_t>& _out) const
+{
+  // the movie box of a fragmented file describes no samples; the fragments do
+  size_t count = mFragmented ? 0 : mSizes.size ();
+
+  // decode times from the capture times; they must strictly increase
+  std::vector<uint64_t> dts (count);
+  std::vector<int32_t>  cts (count);
+  bool reordered = false, negative = false;
+  for (size_t i = 0; i < count; i++)
+  {
+    dts[i] = static_cast<uint64_t> (std::max<int64_t> (0, MediaTime (mTimes[i])));
+    if (i > 0 && dts[i] <= dts[i - 1])
+      dts[i] = dts[i - 1] + 1;
+
+    cts[i]    = static_cast<int32_t> (MediaTime (mPresentation[i]) - static_cast<int64_t> (dts[i]));
+    reordered = reordered || cts[i] != 0;
+    negative  = negative  || cts[i] < 0;
+  }
+  uint32_t lastDuration = static_cast<uint32_t> (MP4_TIMESCALE / (mFps > 0 ? mFps : 30));
+  if (count > 1)
+    lastDuration = static_cast<uint32_t> ((dts[count - 1] - dts[0]) / (count - 1));
+  lastDuration = std::max<uint32_t> (lastDuration, 1);
+  uint64_t mediaDuration = count > 0 ? dts[count - 1] + lastDuration : 0;
+  uint64_t movieDuration = mediaDuration * MP4_MOVIE_TIMESCALE / MP4_TIMESCALE;
+
+  size_t moov = BeginBox (_out, "moov");
+
+  size_t mvhd = BeginFullBox (_out, "mvhd", 1, 0);
+  Put64    (_out, 0);
+  Put64    (_out, 0);
+  Put32    (_out, MP4_MOVIE_TIMESCALE);
+  Put64    (_out, movieDuration);
+  Put32    (_out, 0x00010000);   // rate 1.0
+  Put16    (_out, 0x0100);       // volume 1.0
+  PutZeros (_out, 10);
+  PutMatrix (_out);
+  PutZeros (_out, 24);
+  Put32    (_out, 2);            // next track ID
+  EndBox (_out, mvhd);
+
+  size_t trak = BeginBox (_out, "trak");
+  size_t tkhd = BeginFullBox (_out, "tkhd", 1, 3);   // enabled, in movie
+  Put64    (_out, 0);
+  Put64    (_out, 0);
+  Put32    (_out, 1);            // track ID
+  Put32    (_out, 0);
+  Put64    (_out, movieDuration);
+  PutZeros (_out, 8 + 2 + 2 + 2 + 2);
+  PutMatrix (_out);
+  Put32    (_out, uint32_t (mWidth)  << 16);
+  Put32    (_out, uint32_t (mHeight) << 16);
+  EndBox (_out, tkhd);
+
+  size_t mdia = BeginBox (_out, "mdia");
+  size_t mdhd = BeginFullBox (_out, "mdhd", 1, 0);
+  Put64 (_out, 0);
+  Put64 (_out, 0);
+  Put32 (_out, MP4_TIMESCALE);
+  Put64 (_out, mediaDuration);
+  Put16 (_out, 0x55c4);          // language "und"
+  Put16 (_out, 0);
+  EndBox (_out, mdhd);
+
+  size_t hdlr = BeginFullBox (_out, "hdlr", 0, 0);
+  Put32    (_out, 0);
+  PutTag   (_out, "vide");
+  PutZeros (_out, 12);
+  const char name[] = "VideoHandler";
+  _out.insert (_out.end (), name, name + sizeof (name));
+  EndBox (_out, hdlr);
+
+  size_t minf = BeginBox (_out, "minf");
+  size_t vmhd = BeginFullBox (_out, "vmhd", 0, 1);
+  PutZeros (_out, 8);
+  EndBox (_out, vmhd);
+
+  size_t dinf = BeginBox (_out, "dinf");
+  size_t dref = BeginFullBox (_out, "dref", 0, 0);
+  Put32 (_out, 1);
+  size_t url = BeginFullBox (_out, "url ", 0, 1);   // media data in this file
+  EndBox (_out, url);
+  EndBox (_out, dref);
+  EndBox (_out, dinf);
+
+  size_t stbl = BeginBox (_out, "stbl");
+  size_t stsd = BeginFullBox (_out, "stsd", 0, 0);
+  Put32 (_out, 1);
+  BuildSampleEntry (_out);
+  EndBox (_out, stsd);
+
+  // sample durations, run-length coded
+  std::vector<std::pair<uint32_t, uint32_t> > runs;
+  for (size_t i = 0; i < count; i++)
+  {
+    uint32_t duration = i + 1 < count ? static_cast<uint32_t> (dts[i + 1] - dts[i]) : lastDuration;
+    if (!runs.empty () && runs.back ().second == duration)
+      runs.back ().first++;
+    else
+      runs.push_back (std::make_pair (1u, duration));
+  }
+  size_t stts = BeginFullBox (_out, "stts", 0, 0);
+  Put32 (_out, static_cast<uint32_t> (runs.size ()));
+  for (size_t i = 0; i < runs.size (); i++)
+  {
+    Put32 (_out, runs[i].first);
+    Put32 (_out, runs[i].second);
+  }
+  EndBox (_out, stts);
+
+  // composition offsets, signed (version 1) if a frame is shown before it is decoded
+  if (reordered)
+  {
+    std::vector<std::pair<uint32_t, int32_t> > offsets;
+    for (size_t i = 0; i < count; i++)
+    {
+      if (!offsets.empty () && offsets.back ().second == cts[i])
+        offsets.back ().first++;
+      else
+        offsets.push_back (std::make_pair (1u, cts[i]));
+    }
+    size_t ctts = BeginFullBox (_out, "ctts", negative ? 1 : 0, 0);
+    Put32 (_out, static_cast<uint32_t> (offsets.size ()));
+    for (size_t i = 0; i < offsets.size (); i++)
+    {
+      Put32 (_out, offsets[i].first);
+      Put32 (_out, static_cast<uint32_t> (offsets[i].second));
+    }
+    EndBox (_out, ctts);
+  }
+
+  // without a sync sample table every sample is a key frame
+  if (mSyncSamples.size () < count)
+  {
+    size_t stss = BeginFullBox (_out, "stss", 0, 0);
+    Put32 (_out, static_cast<uint32_t> (mSyncSamples.size ()));
+    for (size_t i = 0; i < mSyncSamples.size (); i++)
+      Put32 (_out, mSyncSamples[i]);
+    EndBox (_out, stss);
+  }
+
+  // one sample per chunk
+  size_t stsc = BeginFullBox (_out, "stsc", 0, 0);
+  Put32 (_out, count > 0 ? 1 : 0);
+  if (count > 0)
+  {
+    Put32 (_out, 1);
+    Put32 (_out, 1);
+    Put32 (_out, 1);
+  }
+  EndBox (_out, stsc);
+
+  size_t stsz = BeginFullBox (_out, "stsz", 0, 0);
+  Put32 (_out, 0);
+  Put32 (_out, static_cast<uint32_t> (count));
+  for (size_t i = 0; i < count; i++)
+    Put32 (_out, mSizes[i]);
+  EndBox (_out, stsz);
+
+  size_t co64 = BeginFullBox (_out, "co64", 0, 0);
+  Put32 (_out, static_cast<uint32_t> (count));
+  for (size_t i = 0; i < count; i++)
+    Put64 (_out, mOffsets[i]);
+  EndBox (_out, co64);
+
+  EndBox (_out, stbl);
+  EndBox (_out, minf);
+  EndBox (_out, mdia);
+  EndBox (_out, trak);
+
+  if (mFragmented)
+  {
+    // announces the fragments; their samples carry their own durations, sizes and flags
+    size_t mvex = BeginBox (_out, "mvex");
+    size_t trex = BeginFullBox (_out, "trex", 0, 0);
+    Put32 (_out, 1);             // track ID
+    Put32 (_out, 1);             // sample description index
+    Put32 (_out, 0);
+    Put32 (_out, 0);
+    Put32 (_out, 0);
+    EndBox (_out, trex);
+    EndBox (_out, mvex);
+  }
+  EndBox (_out, moov);
+}
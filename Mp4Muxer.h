@@ -0,0 +1,151 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: Mp4Muxer.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Writes video that a camera has already compressed into an
+// MP4 file, without decoding and re-encoding it. Samples are JPEG images
+// (MJPG cameras) or H.264 access units in Annex B byte stream format (H264
+// cameras). Each sample carries its own capture time, so the file's sample
+// durations follow the actual frame timing rather than a nominal rate.
+//
+// Samples of any other codec can be copied from another MP4 file together
+// with their sample description (Codec Copy); the presentation times of
+// such samples may differ from their decode times, for streams with
+// reordered frames.
+//
+// Sample data are written as they arrive; the sample tables are kept in
+// memory and written behind the media data when the file is closed.
+//
+// Fragmented files instead begin with a movie box without samples, followed
+// by movie fragments of a set duration. Each fragment starts at a sync
+// sample and is written and flushed to disk as soon as the next one begins,
+// so that a file cut short by a crash loses at most its last fragment, and
+// memory holds only the fragment being filled.
+//
+// The file is written through a VideoSink, which can batch the writes into
+// large aligned buffers written by a thread of their own.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef MP4MUXER_H
+#define MP4MUXER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "SegmentManifest.h"
+#include "VideoSink.h"
+
+class Mp4Muxer
+{
+public:
+  enum Codec
+  {
+    Jpeg = 0,
+    H264 = 1,
+    Copy = 2,   // samples formatted as described by SetSampleEntry ()
+  };
+
+  // the codec of a FOURCC, if the muxer can store it
+  static bool CodecFor (int _fourcc, Codec& _codec);
+  // true if _data looks like a compressed sample of _codec rather than pixels
+  static bool IsSample (Codec _codec, const uint8_t* _data, size_t _bytes);
+
+  Mp4Muxer  ();
+  ~Mp4Muxer ();
+
+  // fragments of at least _durationNs, 0 for an unfragmented file; each written
+  //   fragment is listed in _manifest, if given. Takes effect at Open ().
+  void     SetFragments (int64_t _durationNs, SegmentManifest* _manifest);
+  // how the file is written, see VideoSink; takes effect at Open ()
+  void     SetVideoIo   (const VideoIoOptions& _options) { mSink.SetOptions (_options); }
+  bool     DirectIo     () const { return mSink.Direct (); }
+
+  // _fps is only used for the duration of the last sample
+  bool     Open    (const std::string& _file, Codec _codec, int _width, int _height, double _fps);
+  // _timeNs is the sample's capture time on any clock that does not run backwards.
+  //   H.264 samples before the first IDR picture with parameter sets are skipped.
+  bool     Write   (const uint8_t* _data, size_t _bytes, int64_t _timeNs);
+  void     Close   ();
+  bool     IsOpen  () const { return mSink.IsOpen (); }
+
+  // for Codec Copy: the sample entry box, as found in the stsd box of the source file
+  void     SetSampleEntry (const std::vector<uint8_t>& _entry) { mSampleEntry = _entry; }
+  const std::vector<uint8_t>& SampleEntry () const { return mSampleEntry; }
+  // appends a sample as it is. Decode times must increase from sample to sample.
+  bool     WriteSample    (const uint8_t* _data, size_t _bytes, int64_t _decodeTimeNs,
+                           int64_t _presentationTimeNs, bool _sync);
+
+  uint64_t Samples   () const { return mSampleCount; }
+  uint64_t Skipped   () const { return mSkipped; }
+  uint64_t Fragments () const { return mFragmentCount; }
+
+private:
+  Mp4Muxer (const Mp4Muxer&);
+  Mp4Muxer& operator= (const Mp4Muxer&);
+
+  // converts an Annex B access unit into length-prefixed NAL units in mScratch
+  bool     ToLengthPrefixed (const uint8_t* _data, size_t _bytes, bool& _sync);
+  void     BuildMovie       (std::vector<uint8_t>& _out) const;
+  void     BuildSampleEntry (std::vector<uint8_t>& _out) const;
+  // media time of a capture time, relative to the first sample
+  int64_t  MediaTime        (int64_t _timeNs) const;
+  // writes the buffered samples as a movie fragment; unless _final, _nextTimeNs is the
+  //   decode time of the sample that follows
+  bool     WriteFragment    (bool _final, int64_t _nextTimeNs);
+
+  VideoSink              mSink;
+  Codec                  mCodec;
+  int                    mWidth;
+  int                    mHeight;
+  double                 mFps;
+  uint64_t               mMdatStart;   // file offset of the media data box
+  uint64_t               mOffset;      // file offset of the next sample
+  uint64_t               mSkipped;
+  uint64_t               mSampleCount;
+
+  int64_t                mFragmentNs;
+  SegmentManifest*       mManifest;
+  std::string            mFileName;    // without directory, for the manifest
+  bool                   mFragmented;  // of the open file
+  bool                   mInitWritten; // the movie box of a fragmented file
+  int64_t                mBaseTime;    // capture time of the first sample
+  uint64_t               mLastDts;
+  uint32_t               mFragmentCount;
+  uint64_t               mFragmentFirst; // number of the fragment's first sample, from 1
+  std::vector<uint8_t>   mFragmentData;
+
+  // per sample of the file, or of the fragment being filled
+  std::vector<uint32_t>  mSizes;
+  std::vector<uint64_t>  mOffsets;
+  std::vector<int64_t>   mTimes;       // decode times
+  std::vector<int64_t>   mPresentation;
+  std::vector<uint32_t>  mSyncSamples;  // 1-based sample numbers
+  std::vector<uint8_t>   mSampleEntry;
+
+  std::vector<uint8_t>   mSps;
+  std::vector<uint8_t>   mPps;
+  std::vector<uint8_t>   mScratch;
+};
+
+#endif // MP4MUXER_H
@@ -0,0 +1,306 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: Mp4Reader.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Reads the samples of the video track of an MP4 file without
+// decoding them.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "Mp4Reader.h"
+
+#include <cstring>
+
+namespace
+{
+  uint32_t Get32 (const uint8_t* _p) { return (uint32_t (_p[0]) << 24) | (uint32_t (_p[1]) << 16) | (uint32_t (_p[2]) << 8) | _p[3]; }
+  uint64_t Get64 (const uint8_t* _p) { return (uint64_t (Get32 (_p)) << 32) | Get32 (_p + 4); }
+
+  // a box inside a parent's payload
+  struct Box
+  {
+    const uint8_t* begin;   // start of the box header
+    const uint8_t* data;    // start of the payload
+    const uint8_t* end;
+  };
+
+  // finds the first child box of _type in [_begin, _end)
+  bool Find (const uint8_t* _begin, const uint8_t* _end, const char* _type, Box& _box)
+  {
+    const uint8_t* p = _begin;
+    while (_end - p >= 8)
+    {
+      uint64_t size   = Get32 (p);
+      size_t   header = 8;
+      if (size == 1 && _end - p >= 16)
+      {
+        size   = Get64 (p + 8);
+        header = 16;
+      }
+      else if (size == 0)
+        size = _end - p;
+      if (size < header || size > uint64_t (_end - p))
+        return false;
+      if (!::memcmp (p + 4, _type, 4))
+      {
+        _box.begin = p;
+        _box.data  = p + header;
+        _box.end   = p + size;
+        return true;
+      }
+      p += size;
+    }
+    return false;
+  }
+
+  bool FindPath (const uint8_t* _begin, const uint8_t* _end, const char* const* _path, Box& _box)
+  {
+    for (; *_path; _path++)
+    {
+      if (!Find (_begin, _end, *_path, _box))
+        return false;
+      _begin = _box.data;
+      _end   = _box.end;
+    }
+    return true;
+  }
+}
+
+//==========================================================================================
+// Mp4Reader member function implementaion
+//==========================================================================================
+Mp4Reader::Mp4Reader () :
+  mFile      (nullptr),
+  mTimescale (0)
+{
+}
+
+Mp4Reader::~Mp4Reader ()
+{
+  Close ();
+}
+
+bool Mp4Reader::Seek (uint64_t _offset)
+{
+#ifdef _WIN32
+  return ::_fseeki64 (mFile, static_cast<__int64> (_offset), SEEK_SET) == 0;
+#else
+  return ::fseeko (mFile, static_cast<off_t> (_offset), SEEK_SET) == 0;
+#endif
+}
+
+bool Mp4Reader::Open (const std::string& _file)
+{
+  Close ();
+  mFile = ::fopen (_file.c_str (), "rb");
+  if (!mFile)
+    return false;
+
+  std::vector<uint8_t> movie;
+  if (!ReadMovie (movie))
+  {
+    Close ();
+    return false;
+  }
+
+  // the first track with a video media handler
+  const uint8_t* p   = movie.data ();
+  const uint8_t* end = p + movie.size ();
+  Box trak;
+  while (Find (p, end, "trak", trak))
+  {
+    static const char* const hdlrPath[] = { "mdia", "hdlr", nullptr };
+    Box hdlr;
+    if (FindPath (trak.data, trak.end, hdlrPath, hdlr) && hdlr.end - hdlr.data >= 12
+        && !::memcmp (hdlr.data + 8, "vide", 4))
+    {
+      if (ParseTrack (trak.data, trak.end))
+        return true;
+      break;
+    }
+    p = trak.end;
+  }
+  Close ();
+  return false;
+}
+
+void Mp4Reader::Close ()
+{
+  if (mFile)
+    ::fclose (mFile);
+  mFile = nullptr;
+  mSamples.clear ();
+  mSampleEntry.clear ();
+  mTimescale = 0;
+}
+
+bool Mp4Reader::ReadMovie (std::vector<uint8_t>& _movie)
+{
+  // walk the top level boxes; the movie box may come before or after the media data
+  uint64_t offset = 0;
+  uint8_t  header[16];
+  while (Seek (offset) && ::fread (header, 8, 1, mFile) == 1)
+  {
+    uint64_t size = Get32 (header);
+    size_t   headerSize = 8;
+    if (size == 1)
+    {
+      if (::fread (header + 8, 8, 1, mFile) != 1)
+        return false;
+      size       = Get64 (header + 8);
+      headerSize = 16;
+    }
+    if (size < headerSize)
+      return false;
+    if (!::memcmp (header + 4, "moov", 4))
+    {
+      _movie.resize (static_cast<size_t> (size - headerSize));
+      return _movie.empty () || ::fread (_movie.data (), _movie.size (), 1, mFile) == 1;
+    }
+    offset += size;
+  }
+  return false;
+}
+
+bool Mp4Reader::ParseTrack (const uint8_t* _begin, const uint8_t* _end)
+{
+  static const char* const mdhdPath[] = { "mdia", "mdhd", nullptr };
+  static const char* const stblPath[] = { "mdia", "minf", "stbl", nullptr };
+  Box mdhd, stbl, stsd, stts, stsc, stsz, stco, ctts, stss;
+  if (!FindPath (_begin, _end, mdhdPath, mdhd) || !FindPath (_begin, _end, stblPath, stbl))
+    return false;
+  bool co64 = false;
+  if (!Find (stbl.data, stbl.end, "stsd", stsd) || !Find (stbl.data, stbl.end, "stts", stts)
+      || !Find (stbl.data, stbl.end, "stsc", stsc) || !Find (stbl.data, stbl.end, "stsz", stsz))
+    return false;
+  if (!Find (stbl.data, stbl.end, "stco", stco))
+  {
+    if (!Find (stbl.data, stbl.end, "co64", stco))
+      return false;
+    co64 = true;
+  }
+  bool hasCtts = Find (stbl.data, stbl.end, "ctts", ctts);
+  bool hasStss = Find (stbl.data, stbl.end, "stss", stss);
+  if (mdhd.end - mdhd.data < 24 || stts.end - stts.data < 8 || stsc.end - stsc.data < 8
+      || stsz.end - stsz.data < 12 || stco.end - stco.data < 8)
+    return false;
+
+  // media timescale follows the creation and modification times, 32 or 64 bit by version
+  mTimescale = Get32 (mdhd.data + (mdhd.data[0] == 1 ? 20 : 12));
+
+  // the first sample entry, whole
+  if (stsd.end - stsd.data < 16 || Get32 (stsd.data + 4) < 1)
+    return false;
+  uint32_t entrySize = Get32 (stsd.data + 8);
+  if (entrySize < 8 || entrySize > uint32_t (stsd.end - stsd.data - 8))
+    return false;
+  mSampleEntry.assign (stsd.data + 8, stsd.data + 8 + entrySize);
+
+  // sizes
+  uint32_t fixedSize = Get32 (stsz.data + 4);
+  uint32_t count     = Get32 (stsz.data + 8);
+  if (fixedSize == 0 && uint64_t (stsz.end - stsz.data) < 12 + 4ull * count)
+    return false;
+  mSamples.resize (count);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    mSamples[i].size             = fixedSize ? fixedSize : Get32 (stsz.data + 12 + 4 * i);
+    mSamples[i].sync             = !hasStss;
+    mSamples[i].decodeTime       = 0;
+    mSamples[i].presentationTime = 0;
+    mSamples[i].offset           = 0;
+  }
+
+  // offsets from chunk offsets and the sample-to-chunk runs
+  uint32_t chunks = Get32 (stco.data + 4);
+  uint32_t runs   = Get32 (stsc.data + 4);
+  if (uint64_t (stco.end - stco.data) < 8 + (co64 ? 8ull : 4ull) * chunks
+      || uint64_t (stsc.end - stsc.data) < 8 + 12ull * runs)
+    return false;
+  uint32_t sample = 0;
+  for (uint32_t r = 0; r < runs && sample < count; r++)
+  {
+    const uint8_t* run       = stsc.data + 8 + 12 * r;
+    uint32_t       first     = Get32 (run);
+    uint32_t       perChunk  = Get32 (run + 4);
+    uint32_t       nextFirst = r + 1 < runs ? Get32 (run + 12) : chunks + 1;
+    for (uint32_t c = first; c < nextFirst && c <= chunks && sample < count; c++)
+    {
+      uint64_t offset = co64 ? Get64 (stco.data + 8 + 8 * (c - 1)) : Get32 (stco.data + 8 + 4 * (c - 1));
+      for (uint32_t s = 0; s < perChunk && sample < count; s++, sample++)
+      {
+        mSamples[sample].offset = offset;
+        offset += mSamples[sample].size;
+      }
+    }
+  }
+  if (sample < count)
+    return false;
+
+  // decode times
+  uint32_t entries = Get32 (stts.data + 4);
+  int64_t  time    = 0;
+  sample = 0;
+  for (uint32_t e = 0; e < entries && 8 + 8 * e + 8 <= uint64_t (stts.end - stts.data); e++)
+  {
+    uint32_t n     = Get32 (stts.data + 8 + 8 * e);
+    uint32_t delta = Get32 (stts.data + 12 + 8 * e);
+    for (uint32_t i = 0; i < n && sample < count; i++, sample++)
+    {
+      mSamples[sample].decodeTime = mSamples[sample].presentationTime = time;
+      time += delta;
+    }
+  }
+
+  // composition offsets; signed in version 1, and in practice in version 0 as well
+  if (hasCtts)
+  {
+    entries = Get32 (ctts.data + 4);
+    sample  = 0;
+    for (uint32_t e = 0; e < entries && 8 + 8 * e + 8 <= uint64_t (ctts.end - ctts.data); e++)
+    {
+      uint32_t n      = Get32 (ctts.data + 8 + 8 * e);
+      int32_t  offset = static_cast<int32_t> (Get32 (ctts.data + 12 + 8 * e));
+      for (uint32_t i = 0; i < n && sample < count; i++, sample++)
+        mSamples[sample].presentationTime = mSamples[sample].decodeTime + offset;
+    }
+  }
+
+  if (hasStss)
+  {
+    entries = Get32 (stss.data + 4);
+    for (uint32_t e = 0; e < entries && 8 + 4 * e + 4 <= uint64_t (stss.end - stss.data); e++)
+    {
+      uint32_t number = Get32 (stss.data + 8 + 4 * e);
+      if (number >= 1 && number <= count)
+        mSamples[number - 1].sync = true;
+    }
+  }
+  return true;
+}
+
+bool Mp4Reader::Read (const Sample& _sample, std::vector<uint8_t>& _data)
+{
+  _data.resize (_sample.size);
+  return mFile && Seek (_sample.offset)
+      && (_sample.size == 0 || ::fread (_data.data (), _sample.size, 1, mFile) == 1);
+}
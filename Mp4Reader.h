@@ -0,0 +1,77 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: Mp4Reader.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Reads the samples of the video track of an MP4 file without
+// decoding them, so that they can be copied into another file by Mp4Muxer.
+// Only what the encoders used by the WebcamLogger write is supported: one
+// sample description, and sample tables in a movie box (no fragments).
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef MP4READER_H
+#define MP4READER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class Mp4Reader
+{
+public:
+  struct Sample
+  {
+    uint64_t offset;
+    uint32_t size;
+    int64_t  decodeTime;          // in Timescale () units
+    int64_t  presentationTime;
+    bool     sync;
+  };
+
+  Mp4Reader  ();
+  ~Mp4Reader ();
+
+  // reads the sample tables of the first video track
+  bool     Open        (const std::string& _file);
+  void     Close       ();
+  bool     Read        (const Sample& _sample, std::vector<uint8_t>& _data);
+
+  const std::vector<Sample>&  Samples     () const { return mSamples; }
+  // the sample entry box of the track, for Mp4Muxer::SetSampleEntry ()
+  const std::vector<uint8_t>& SampleEntry () const { return mSampleEntry; }
+  uint32_t                    Timescale   () const { return mTimescale; }
+
+private:
+  Mp4Reader (const Mp4Reader&);
+  Mp4Reader& operator= (const Mp4Reader&);
+
+  bool     ReadMovie   (std::vector<uint8_t>& _movie);
+  bool     ParseTrack  (const uint8_t* _begin, const uint8_t* _end);
+  bool     Seek        (uint64_t _offset);
+
+  std::FILE*            mFile;
+  std::vector<Sample>   mSamples;
+  std::vector<uint8_t>  mSampleEntry;
+  uint32_t              mTimescale;
+};
+
+#endif // MP4READER_H
@@ -0,0 +1,238 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: PipelineTelemetry.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Always-on instrumentation of one camera's capture/encode
+// pipeline, kept in lock-free histograms.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "PipelineTelemetry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+#include "BCIEvent.h"
+
+//==========================================================================================
+// TelemetryHistogram member function implementaion
+//==========================================================================================
+TelemetryHistogram::TelemetryHistogram ()
+{
+  Reset ();
+}
+
+int TelemetryHistogram::Bucket (uint64_t _value)
+{
+  if (_value < SubBuckets)
+    return static_cast<int> (_value);
+  int msb = 0;
+  for (uint64_t v = _value; v > 1; v >>= 1)
+    msb++;
+  int sub = static_cast<int> (_value >> (msb - SubBucketBits)) & (SubBuckets - 1);
+  return (msb - SubBucketBits + 1) * SubBuckets + sub;
+}
+
+uint64_t TelemetryHistogram::BucketLimit (int _bucket)
+{
+  if (_bucket < SubBuckets)
+    return _bucket;
+  int      shift = _bucket / SubBuckets - 1;
+  uint64_t lower = static_cast<uint64_t> (SubBuckets + _bucket % SubBuckets) << shift;
+  return lower + ((uint64_t (1) << shift) - 1);
+}
+
+void TelemetryHistogram::StoreMax (std::atomic<uint64_t>& _max, uint64_t _value)
+{
+  uint64_t current = _max.load (std::memory_order_relaxed);
+  while (_value > current && !_max.compare_exchange_weak (current, _value, std::memory_order_relaxed)) {}
+}
+
+void TelemetryHistogram::Record (uint64_t _value)
+{
+  mCounts[Bucket (_value)].fetch_add (1, std::memory_order_relaxed);
+  mCount.fetch_add (1, std::memory_order_relaxed);
+  mSum.fetch_add (_value, std::memory_order_relaxed);
+  StoreMax (mMax, _value);
+  StoreMax (mPeriodMax, _value);
+}
+
+void TelemetryHistogram::Reset ()
+{
+  for (int i = 0; i < Buckets; i++)
+    mCounts[i].store (0, std::memory_order_relaxed);
+  mCount.store     (0, std::memory_order_relaxed);
+  mSum.store       (0, std::memory_order_relaxed);
+  mMax.store       (0, std::memory_order_relaxed);
+  mPeriodMax.store (0, std::memory_order_relaxed);
+}
+
+double TelemetryHistogram::Mean () const
+{
+  uint64_t count = Count ();
+  return count ? double (mSum.load (std::memory_order_relaxed)) / count : 0;
+}
+
+uint64_t TelemetryHistogram::Percentile (double _fraction) const
+{
+  uint64_t count = Count ();
+  if (count == 0)
+    return 0;
+  uint64_t target = std::max<uint64_t> (1, static_cast<uint64_t> (_fraction * count + 0.5));
+  uint64_t seen   = 0;
+  for (int i = 0; i < Buckets; i++)
+  {
+    seen += mCounts[i].load (std::memory_order_relaxed);
+    if (seen >= target)
+      return std::min (BucketLimit (i), Max ());
+  }
+  return Max ();
+}
+
+uint64_t TelemetryHistogram::TakePeriodMax ()
+{
+  return mPeriodMax.exchange (0, std::memory_order_relaxed);
+}
+
+//==========================================================================================
+// PipelineTelemetry member function implementaion
+//==========================================================================================
+const char* PipelineTelemetry::StateName (Metric _metric)
+{
+  switch (_metric)
+  {
+  case QueueDepth:       return "WebcamQueueDepth";
+  case CaptureJitter:    return "WebcamCaptureJitter";
+  case OverlayTime:      return "WebcamOverlayTime";
+  case EncodeTime:       return "WebcamEncodeTime";
+  case EventLatency:     return "WebcamEventLatency";
+  case DroppedFrames:    return "WebcamDropped";
+  case DuplicatedFrames: return "WebcamDuplicated";
+  case MissedFrames:     return "WebcamMissed";
+  case FeatureLatency:   return "WebcamFeatureLatency";
+  default:               return "";
+  }
+}
+
+int PipelineTelemetry::StateBits (Metric _metric)
+{
+  switch (_metric)
+  {
+  case QueueDepth:       return 8;
+  case CaptureJitter:
+  case OverlayTime:
+  case EncodeTime:
+  case EventLatency:
+  case FeatureLatency:   return 20;   // microseconds, saturating at about one second
+  default:               return 24;
+  }
+}
+
+PipelineTelemetry::PipelineTelemetry () :
+  duplicated     (0),
+  missed         (0),
+  gated          (0),
+  mLastPublishMs (0)
+{
+}
+
+void PipelineTelemetry::Reset ()
+{
+  captureJitterUs.Reset ();
+  overlayUs.Reset ();
+  encodeUs.Reset ();
+  eventLatencyUs.Reset ();
+  featureLatencyUs.Reset ();
+  queueDepth.Reset ();
+  duplicated.store (0, std::memory_order_relaxed);
+  missed.store     (0, std::memory_order_relaxed);
+  gated.store      (0, std::memory_order_relaxed);
+  mLastPublishMs.store (0, std::memory_order_relaxed);
+}
+
+void PipelineTelemetry::Publish (int _camIndex, int _states, uint64_t _dropped, int _periodMs)
+{
+  if (_states == 0)
+    return;
+  int64_t now = std::chrono::duration_cast<std::chrono::milliseconds> (
+    std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+  if (now - mLastPublishMs.load (std::memory_order_relaxed) < _periodMs)
+    return;
+  mLastPublishMs.store (now, std::memory_order_relaxed);
+
+  for (int bit = 1; bit & AllMetrics; bit <<= 1)
+  {
+    if (!(_states & bit))
+      continue;
+    Metric   metric = static_cast<Metric> (bit);
+    uint64_t value  = 0;
+    switch (metric)
+    {
+    case QueueDepth:       value = queueDepth.TakePeriodMax ();      break;
+    case CaptureJitter:    value = captureJitterUs.TakePeriodMax (); break;
+    case OverlayTime:      value = overlayUs.TakePeriodMax ();       break;
+    case EncodeTime:       value = encodeUs.TakePeriodMax ();        break;
+    case EventLatency:     value = eventLatencyUs.TakePeriodMax ();  break;
+    case FeatureLatency:   value = featureLatencyUs.TakePeriodMax (); break;
+    case DroppedFrames:    value = _dropped;                         break;
+    case DuplicatedFrames: value = duplicated.load (std::memory_order_relaxed); break;
+    case MissedFrames:     value = missed.load (std::memory_order_relaxed);     break;
+    default:                                                         break;
+    }
+    value = std::min (value, (uint64_t (1) << StateBits (metric)) - 1);
+    bcievent << StateName (metric) + std::to_string (_camIndex) + " " << value;
+  }
+}
+
+std::string PipelineTelemetry::Summary (int _camIndex, uint64_t _dropped) const
+{
+  struct Row { const char* name; const TelemetryHistogram* histogram; const char* unit; };
+  const Row rows[] = {
+    { "capture jitter",  &captureJitterUs,  "us" },
+    { "overlay time",    &overlayUs,        "us" },
+    { "encode time",     &encodeUs,         "us" },
+    { "event latency",   &eventLatencyUs,   "us" },
+    { "feature latency", &featureLatencyUs, "us" },
+    { "queue depth",     &queueDepth,       "frames" },
+  };
+
+  std::ostringstream oss;
+  oss << "Camera " << _camIndex << " telemetry:\n";
+  for (size_t i = 0; i < sizeof (rows) / sizeof (*rows); i++)
+  {
+    const TelemetryHistogram& h = *rows[i].histogram;
+    oss << "  " << rows[i].name << " (" << rows[i].unit << "): "
+        << "mean " << (uint64_t)h.Mean ()
+        << ", p50 " << h.Percentile (0.50)
+        << ", p90 " << h.Percentile (0.90)
+        << ", p99 " << h.Percentile (0.99)
+        << ", max " << h.Max ()
+        << " (" << h.Count () << " samples)\n";
+  }
+  oss << "  frames dropped " << _dropped
+      << ", duplicated " << duplicated.load (std::memory_order_relaxed)
+      << ", missed " << missed.load (std::memory_order_relaxed);
+  if (gated.load (std::memory_order_relaxed) > 0)
+    oss << ", left out on a static scene " << gated.load (std::memory_order_relaxed);
+  return oss.str ();
+}
@@ -0,0 +1,137 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: PipelineTelemetry.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Always-on instrumentation of one camera's capture/encode
+// pipeline. The capture and writer threads record into lock-free
+// histograms with relaxed atomic increments, so measuring costs a few
+// nanoseconds per frame and never blocks either thread.
+//
+// A subset of the metrics, chosen with the TelemetryStates parameter, is
+// published as event states while recording, holding the worst value of
+// each publication period; the full summary is logged when recording stops.
+//
+// Event Variables (when enabled with TelemetryStates):
+//   WebcamQueueDepth<n>   - frames waiting for the encoder
+//   WebcamCaptureJitter<n> - deviation of the capture interval from the
+//                           camera frame interval, in microseconds
+//   WebcamOverlayTime<n>  - time to draw the date/time overlay, in microseconds
+//   WebcamEncodeTime<n>   - time to encode a frame, in microseconds
+//   WebcamEventLatency<n> - time from frame arrival to its WebcamFrame<n>
+//                           event, in microseconds
+//   WebcamDropped<n>      - frames dropped because the queue was full
+//   WebcamDuplicated<n>   - frames delivered twice by the driver
+//   WebcamMissed<n>       - camera frames that never arrived
+//   WebcamFeatureLatency<n> - time from frame arrival to its video feature
+//                           events, in microseconds, see VideoFeatures.h
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef PIPELINETELEMETRY_H
+#define PIPELINETELEMETRY_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// A histogram of non-negative integer samples with four buckets per power of
+// two, i.e. a relative resolution of 25%. Record () may be called from any
+// number of threads concurrently with the readers.
+class TelemetryHistogram
+{
+public:
+  TelemetryHistogram ();
+
+  void     Record     (uint64_t _value);
+  void     Reset      ();
+
+  uint64_t Count      () const { return mCount.load (std::memory_order_relaxed); }
+  uint64_t Max        () const { return mMax.load (std::memory_order_relaxed); }
+  double   Mean       () const;
+  // upper bound of the bucket holding the given fraction of samples
+  uint64_t Percentile (double _fraction) const;
+  // largest sample since the previous call
+  uint64_t TakePeriodMax ();
+
+private:
+  enum
+  {
+    SubBucketBits = 2,
+    SubBuckets    = 1 << SubBucketBits,
+    Buckets       = 64 * SubBuckets,
+  };
+
+  static int      Bucket      (uint64_t _value);
+  static uint64_t BucketLimit (int _bucket);
+  static void     StoreMax    (std::atomic<uint64_t>& _max, uint64_t _value);
+
+  std::atomic<uint64_t> mCounts[Buckets];
+  std::atomic<uint64_t> mCount;
+  std::atomic<uint64_t> mSum;
+  std::atomic<uint64_t> mMax;
+  std::atomic<uint64_t> mPeriodMax;
+};
+
+class PipelineTelemetry
+{
+public:
+  // bits of the TelemetryStates parameter
+  enum Metric
+  {
+    QueueDepth       = 1 << 0,
+    CaptureJitter    = 1 << 1,
+    OverlayTime      = 1 << 2,
+    EncodeTime       = 1 << 3,
+    EventLatency     = 1 << 4,
+    DroppedFrames    = 1 << 5,
+    DuplicatedFrames = 1 << 6,
+    MissedFrames     = 1 << 7,
+    FeatureLatency   = 1 << 8,
+    AllMetrics       = (1 << 9) - 1,
+  };
+
+  // state name prefix and width of a metric; the camera index is appended to the name
+  static const char* StateName (Metric _metric);
+  static int         StateBits (Metric _metric);
+
+  PipelineTelemetry ();
+
+  void        Reset   ();
+  // Emits the metrics selected in _states as events, at most every _periodMs
+  //   milliseconds. Called from the capture thread.
+  void        Publish (int _camIndex, int _states, uint64_t _dropped, int _periodMs);
+  std::string Summary (int _camIndex, uint64_t _dropped) const;
+
+  TelemetryHistogram    captureJitterUs;
+  TelemetryHistogram    overlayUs;
+  TelemetryHistogram    encodeUs;
+  TelemetryHistogram    eventLatencyUs;
+  TelemetryHistogram    featureLatencyUs;
+  TelemetryHistogram    queueDepth;
+  std::atomic<uint64_t> duplicated;
+  std::atomic<uint64_t> missed;
+  std::atomic<uint64_t> gated;        // not recorded because the scene was static
+
+private:
+  std::atomic<int64_t>  mLastPublishMs;     // reset by Reset () on another thread
+};
+
+#endif // PIPELINETELEMETRY_H
@@ -0,0 +1,168 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: PreTriggerBuffer.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Holds copies of the most recent frames of a camera while it
+// is not recording.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "PreTriggerBuffer.h"
+
+#include <algorithm>
+
+// room a new sample buffer leaves for later samples that are larger
+#define SAMPLE_HEADROOM_PERCENT 25
+
+namespace
+{
+  // compressed samples are single rows of bytes whose length varies
+  bool IsSample (const cv::Mat& _image)
+  {
+    return _image.rows == 1 && _image.type () == CV_8UC1;
+  }
+
+  // the whole buffer that a kept image is a part of
+  cv::Mat WholeBuffer (const cv::Mat& _image)
+  {
+    cv::Size  whole;
+    cv::Point offset;
+    _image.locateROI (whole, offset);
+    cv::Mat buffer = _image;
+    buffer.adjustROI (offset.y, whole.height - offset.y - _image.rows,
+                      offset.x, whole.width  - offset.x - _image.cols);
+    return buffer;
+  }
+
+  size_t BufferBytes (const cv::Mat& _buffer)
+  {
+    return _buffer.total () * _buffer.elemSize ();
+  }
+}
+
+PreTriggerBuffer::PreTriggerBuffer () :
+  mDurationNs (0),
+  mMaxBytes   (0),
+  mBytes      (0),
+  mHolding    (false)
+{
+}
+
+void PreTriggerBuffer::Configure (int64_t _durationNs, size_t _maxBytes)
+{
+  mDurationNs = std::max<int64_t> (0, _durationNs);
+  mMaxBytes   = _maxBytes;
+  Clear ();
+}
+
+cv::Mat PreTriggerBuffer::Buffer (const cv::Mat& _image)
+{
+  bool sample = IsSample (_image);
+  for (size_t i = mSpare.size (); i-- > 0;)
+  {
+    const cv::Mat& spare = mSpare[i];
+    bool fits = sample ? IsSample (spare) && spare.cols >= _image.cols
+                       : spare.size () == _image.size () && spare.type () == _image.type ();
+    if (fits)
+    {
+      // a sample takes the front of the spare buffer, which it keeps alive
+      cv::Mat buffer = sample ? spare.colRange (0, _image.cols) : spare;
+      mSpare.erase (mSpare.begin () + i);
+      return buffer;
+    }
+  }
+
+  // spares that fit nothing, e.g. after the format changed, make way for the new buffer
+  if (!mSpare.empty ())
+  {
+    Free (mSpare.front ());
+    mSpare.erase (mSpare.begin ());
+  }
+  cv::Mat buffer;
+  if (sample)
+  {
+    buffer.create (1, _image.cols + _image.cols * SAMPLE_HEADROOM_PERCENT / 100, CV_8UC1);
+    mBytes += BufferBytes (buffer);
+    return buffer.colRange (0, _image.cols);
+  }
+  buffer.create (_image.size (), _image.type ());
+  mBytes += BufferBytes (buffer);
+  return buffer;
+}
+
+void PreTriggerBuffer::Free (const cv::Mat& _buffer)
+{
+  mBytes -= std::min (mBytes, BufferBytes (_buffer));
+}
+
+void PreTriggerBuffer::Keep (const WebcamFrame& _frame)
+{
+  if (!mHolding)
+  {
+    while (!mFrames.empty () && _frame.captureTimeNs - mFrames.front ().captureTimeNs > mDurationNs)
+    {
+      mSpare.push_back (WholeBuffer (mFrames.front ().image));
+      mFrames.pop_front ();
+    }
+  }
+
+  mFrames.emplace_back ();
+  WebcamFrame& kept = mFrames.back ();
+  kept.image = Buffer (_frame.image);
+  _frame.image.copyTo (kept.image);
+
+  // over the memory limit, spare buffers go first, then the oldest frames, even while held
+  while (mBytes > mMaxBytes && !mSpare.empty ())
+  {
+    Free (mSpare.back ());
+    mSpare.pop_back ();
+  }
+  while (mBytes > mMaxBytes && mFrames.size () > 1)
+  {
+    Free (WholeBuffer (mFrames.front ().image));
+    mFrames.pop_front ();
+  }
+
+  kept.captureTime   = _frame.captureTime;
+  kept.captureTimeNs = _frame.captureTimeNs;
+  kept.driverTimeMs  = _frame.driverTimeMs;
+  kept.cameraFrame   = _frame.cameraFrame;
+  kept.flags         = _frame.flags;
+}
+
+void PreTriggerBuffer::Take (std::deque<WebcamFrame>& _frames)
+{
+  while (!mFrames.empty ())
+  {
+    Free (WholeBuffer (mFrames.front ().image));
+    _frames.push_back (std::move (mFrames.front ()));
+    mFrames.pop_front ();
+  }
+  mHolding = false;
+}
+
+void PreTriggerBuffer::Clear ()
+{
+  mFrames.clear ();
+  mSpare.clear ();
+  mBytes = 0;
+}
@@ -0,0 +1,88 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: PreTriggerBuffer.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Holds copies of the most recent frames of a camera while it
+// is not recording, so that a recording can begin with the seconds before
+// it was started. Frames are kept as they would be written: compressed
+// samples in passthrough mode, images with their overlay otherwise.
+// Buffers of frames that age out are reused for new ones; a sample goes
+// into any spare buffer large enough for it. The buffers held never take
+// more than a set number of bytes; beyond that, the oldest frames go.
+//
+// While held, for the time it takes to open a camera's video file, no
+// frame ages out, so the frames captured in the meantime are not lost even
+// without a pre-trigger duration.
+//
+// Only the capture thread keeps and takes frames.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef PRETRIGGERBUFFER_H
+#define PRETRIGGERBUFFER_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "WebcamFrame.h"
+
+class PreTriggerBuffer
+{
+public:
+  PreTriggerBuffer ();
+
+  // how far back frames are kept, 0 for not at all, and the most memory their buffers
+  //   may take; called while nothing is captured
+  void   Configure (int64_t _durationNs, size_t _maxBytes);
+  // keep every frame from now until the next Take (); may be called from any thread
+  void   Hold      (bool _hold) { mHolding = _hold; }
+
+  bool   Active    () const { return mDurationNs > 0 || mHolding; }
+  bool   Empty     () const { return mFrames.empty (); }
+  size_t Frames    () const { return mFrames.size (); }
+  size_t Bytes     () const { return mBytes; }
+
+  // copies _frame, dropping frames that are older than the duration
+  void   Keep      (const WebcamFrame& _frame);
+  // moves the kept frames, oldest first, to the end of _frames and stops holding
+  void   Take      (std::deque<WebcamFrame>& _frames);
+  void   Clear     ();
+
+private:
+  PreTriggerBuffer (const PreTriggerBuffer&);
+  PreTriggerBuffer& operator= (const PreTriggerBuffer&);
+
+  // a buffer for _image, spare or new
+  cv::Mat Buffer   (const cv::Mat& _image);
+  void    Free     (const cv::Mat& _buffer);
+
+  int64_t                 mDurationNs;
+  size_t                  mMaxBytes;
+  size_t                  mBytes;     // of all buffers held, kept and spare
+  std::atomic<bool>       mHolding;
+  std::deque<WebcamFrame> mFrames;
+  std::vector<cv::Mat>    mSpare;     // whole buffers of dropped frames
+};
+
+#endif // PRETRIGGERBUFFER_H
@@ -0,0 +1,76 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: SegmentManifest.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A text sidecar listing the segments of a recorded video as
+// they are completed.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "SegmentManifest.h"
+#include "FileUtil.h"
+
+#include <cinttypes>
+
+//==========================================================================================
+// SegmentManifest member function implementaion
+//==========================================================================================
+SegmentManifest::SegmentManifest () :
+  mFile    (nullptr),
+  mEntries (0)
+{
+}
+
+SegmentManifest::~SegmentManifest ()
+{
+  Close ();
+}
+
+bool SegmentManifest::Open (const std::string& _file)
+{
+  Close ();
+  mFile = ::fopen (_file.c_str (), "w");
+  if (!mFile)
+    return false;
+  ::fprintf (mFile, "# segment\tfile\toffset\tfirst_sample\tsamples\tfirst_ns\tlast_ns\n");
+  FlushToDisk (mFile);
+  return true;
+}
+
+void SegmentManifest::Append (const SegmentRecord& _record)
+{
+  if (!mFile)
+    return;
+  ::fprintf (mFile, "%u\t%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%" PRId64 "\t%" PRId64 "\n",
+             _record.segment, _record.file.c_str (), _record.offset, _record.firstSample,
+             _record.samples, _record.firstTimeNs, _record.lastTimeNs);
+  FlushToDisk (mFile);
+  mEntries++;
+}
+
+void SegmentManifest::Close ()
+{
+  if (mFile)
+    ::fclose (mFile);
+  mFile    = nullptr;
+  mEntries = 0;
+}
@@ -0,0 +1,83 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: SegmentManifest.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A text sidecar listing the segments of a recorded video as
+// they are completed. Each line is appended and flushed to disk as soon as
+// its segment is, so after a crash the manifest tells which part of the
+// recording is intact.
+//
+// File layout: a comment line starting with '#', then one tab separated
+// line per segment:
+//   segment      - running number, from 0
+//   file         - name of the video file, without directory
+//   offset       - byte offset of the segment in the file; 0 for segments
+//                  that are files of their own, that of the movie fragment
+//                  box for fragmented MP4
+//   first_sample - number of the segment's first sample in the recording,
+//                  from 1
+//   samples      - number of samples in the segment
+//   first_ns     - capture time of the first sample, on the clock of the
+//                  frame index
+//   last_ns      - capture time of the last sample
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef SEGMENTMANIFEST_H
+#define SEGMENTMANIFEST_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+struct SegmentRecord
+{
+  unsigned int segment;
+  std::string  file;
+  uint64_t     offset;
+  uint64_t     firstSample;
+  uint64_t     samples;
+  int64_t      firstTimeNs;
+  int64_t      lastTimeNs;
+};
+
+class SegmentManifest
+{
+public:
+  SegmentManifest  ();
+  ~SegmentManifest ();
+
+  bool         Open    (const std::string& _file);
+  void         Append  (const SegmentRecord& _record);
+  void         Close   ();
+  bool         IsOpen  () const { return mFile != nullptr; }
+  // segments appended since Open ()
+  unsigned int Entries () const { return mEntries; }
+
+private:
+  SegmentManifest (const SegmentManifest&);
+  SegmentManifest& operator= (const SegmentManifest&);
+
+  std::FILE*   mFile;
+  unsigned int mEntries;
+};
+
+#endif // SEGMENTMANIFEST_H
@@ -0,0 +1,299 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: SharedFrameRing.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A ring of recent frames of a camera in shared memory, and
+// its readers.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "SharedFrameRing.h"
+
+#include <cstring>
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+// slots start on cache line boundaries
+#define SHAREDFRAMES_ALIGNMENT 64
+
+std::string SharedFramesName (int _camIndex)
+{
+#ifdef _WIN32
+  return "Local\\BCI2000WebcamFrames" + std::to_string (_camIndex);
+#else
+  return "/BCI2000WebcamFrames" + std::to_string (_camIndex);
+#endif
+}
+
+//==========================================================================================
+// SharedFrameRing member function implementaion
+//==========================================================================================
+SharedFrameRing::SharedFrameRing () :
+  mHandle (nullptr),
+  mSize   (0),
+  mHeader (nullptr)
+{
+}
+
+SharedFrameRing::~SharedFrameRing ()
+{
+  Close ();
+}
+
+bool SharedFrameRing::Open (int _camIndex, int _slots, size_t _frameBytes, uint32_t _fourcc)
+{
+  Close ();
+  if (_slots < 1)
+    return false;
+  size_t slotBytes = (SHAREDFRAMES_SLOT_HEADER + _frameBytes + SHAREDFRAMES_ALIGNMENT - 1)
+                     / SHAREDFRAMES_ALIGNMENT * SHAREDFRAMES_ALIGNMENT;
+  mName = SharedFramesName (_camIndex);
+  mSize = SHAREDFRAMES_ALIGNMENT + slotBytes * _slots;
+
+  void* memory = nullptr;
+#ifdef _WIN32
+  mHandle = ::CreateFileMappingA (INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                  static_cast<DWORD> (uint64_t (mSize) >> 32), static_cast<DWORD> (mSize),
+                                  mName.c_str ());
+  if (mHandle)
+    memory = ::MapViewOfFile (mHandle, FILE_MAP_ALL_ACCESS, 0, 0, mSize);
+#else
+  // a ring left behind by a process that did not exit cleanly is replaced
+  ::shm_unlink (mName.c_str ());
+  int fd = ::shm_open (mName.c_str (), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd >= 0 && ::ftruncate (fd, static_cast<off_t> (mSize)) == 0)
+  {
+    memory = ::mmap (nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+      memory = nullptr;
+  }
+  if (fd >= 0)
+    ::close (fd);
+#endif
+  if (!memory)
+  {
+    Close ();
+    return false;
+  }
+
+  // readers check the magic last, so it is written after everything else
+  ::memset (memory, 0, mSize);
+  mHeader = static_cast<SharedFrameHeader*> (memory);
+  mHeader->version     = SHAREDFRAMES_VERSION;
+  mHeader->slots       = static_cast<uint32_t> (_slots);
+  mHeader->slotBytes   = slotBytes;
+  mHeader->firstSlot   = SHAREDFRAMES_ALIGNMENT;
+  mHeader->cameraIndex = _camIndex;
+  mHeader->fourcc      = _fourcc;
+  mHeader->published.store (0, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_release);
+  ::memcpy (mHeader->magic, SHAREDFRAMES_MAGIC, sizeof (mHeader->magic));
+  return true;
+}
+
+void SharedFrameRing::Close ()
+{
+#ifdef _WIN32
+  if (mHeader)
+    ::UnmapViewOfFile (mHeader);
+  if (mHandle)
+    ::CloseHandle (mHandle);
+#else
+  // readers that still have it mapped keep their view
+  if (mHeader)
+  {
+    ::munmap (mHeader, mSize);
+    ::shm_unlink (mName.c_str ());
+  }
+#endif
+  mHandle = nullptr;
+  mHeader = nullptr;
+  mSize   = 0;
+}
+
+bool SharedFrameRing::Publish (const WebcamFrame& _frame)
+{
+  const cv::Mat& image = _frame.image;
+  size_t rowBytes = image.cols * image.elemSize ();
+  size_t bytes    = rowBytes * image.rows;
+  if (!mHeader || image.empty () || SHAREDFRAMES_SLOT_HEADER + bytes > mHeader->slotBytes)
+    return false;
+
+  uint64_t         index = mHeader->published.load (std::memory_order_relaxed);
+  uint8_t*         base  = reinterpret_cast<uint8_t*> (mHeader) + mHeader->firstSlot
+                           + (index % mHeader->slots) * mHeader->slotBytes;
+  SharedFrameSlot* slot  = reinterpret_cast<SharedFrameSlot*> (base);
+
+  // odd while writing; the fence keeps the writes below from moving ahead of it
+  uint64_t sequence = slot->sequence.load (std::memory_order_relaxed);
+  slot->sequence.store (sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_release);
+
+  slot->index         = index;
+  slot->cameraFrame   = _frame.cameraFrame;
+  slot->flags         = _frame.flags;
+  slot->captureTimeNs = _frame.captureTimeNs;
+  slot->width         = image.cols;
+  slot->height        = image.rows;
+  slot->type          = image.type ();
+  slot->step          = static_cast<uint32_t> (rowBytes);
+  slot->bytes         = bytes;
+  uint8_t* data = base + SHAREDFRAMES_SLOT_HEADER;
+  if (image.isContinuous ())
+    ::memcpy (data, image.data, bytes);
+  else
+    for (int r = 0; r < image.rows; r++)
+      ::memcpy (data + r * rowBytes, image.ptr (r), rowBytes);
+
+  slot->sequence.store (sequence + 2, std::memory_order_release);
+  mHeader->published.store (index + 1, std::memory_order_release);
+  return true;
+}
+
+//==========================================================================================
+// SharedFrameReader member function implementaion
+//==========================================================================================
+SharedFrameReader::SharedFrameReader () :
+  mHandle (nullptr),
+  mSize   (0),
+  mHeader (nullptr)
+{
+}
+
+SharedFrameReader::~SharedFrameReader ()
+{
+  Close ();
+}
+
+bool SharedFrameReader::Open (int _camIndex)
+{
+  Close ();
+  std::string name   = SharedFramesName (_camIndex);
+  void*       memory = nullptr;
+#ifdef _WIN32
+  mHandle = ::OpenFileMappingA (FILE_MAP_READ, FALSE, name.c_str ());
+  if (mHandle)
+    memory = ::MapViewOfFile (mHandle, FILE_MAP_READ, 0, 0, 0);
+  MEMORY_BASIC_INFORMATION info;
+  if (memory && ::VirtualQuery (memory, &info, sizeof (info)))
+    mSize = info.RegionSize;
+#else
+  int fd = ::shm_open (name.c_str (), O_RDONLY, 0);
+  struct stat st;
+  if (fd >= 0 && ::fstat (fd, &st) == 0 && st.st_size >= SHAREDFRAMES_ALIGNMENT)
+  {
+    mSize  = static_cast<size_t> (st.st_size);
+    memory = ::mmap (nullptr, mSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+      memory = nullptr;
+  }
+  if (fd >= 0)
+    ::close (fd);
+#endif
+  mHeader = static_cast<const SharedFrameHeader*> (memory);
+  bool valid = mHeader && !::memcmp (mHeader->magic, SHAREDFRAMES_MAGIC, sizeof (mHeader->magic));
+  std::atomic_thread_fence (std::memory_order_acquire);
+  valid = valid && mHeader->version == SHAREDFRAMES_VERSION && mHeader->slots > 0
+       && mHeader->firstSlot + mHeader->slots * mHeader->slotBytes <= mSize;
+  if (!valid)
+    Close ();
+  return valid;
+}
+
+void SharedFrameReader::Close ()
+{
+#ifdef _WIN32
+  if (mHeader)
+    ::UnmapViewOfFile (mHeader);
+  if (mHandle)
+    ::CloseHandle (mHandle);
+#else
+  if (mHeader)
+    ::munmap (const_cast<SharedFrameHeader*> (mHeader), mSize);
+#endif
+  mHandle = nullptr;
+  mHeader = nullptr;
+  mSize   = 0;
+}
+
+uint64_t SharedFrameReader::Published () const
+{
+  return mHeader ? mHeader->published.load (std::memory_order_acquire) : 0;
+}
+
+const SharedFrameSlot* SharedFrameReader::Slot (uint64_t _index) const
+{
+  return reinterpret_cast<const SharedFrameSlot*> (reinterpret_cast<const uint8_t*> (mHeader)
+           + mHeader->firstSlot + (_index % mHeader->slots) * mHeader->slotBytes);
+}
+
+bool SharedFrameReader::Peek (uint64_t _index, SharedFrameView& _view) const
+{
+  if (!mHeader || _index >= Published ())
+    return false;
+  const SharedFrameSlot* slot = Slot (_index);
+  uint64_t sequence = slot->sequence.load (std::memory_order_acquire);
+  if (sequence & 1)
+    return false;
+
+  _view.index         = slot->index;
+  _view.sequence      = sequence;
+  _view.cameraFrame   = slot->cameraFrame;
+  _view.flags         = slot->flags;
+  _view.captureTimeNs = slot->captureTimeNs;
+  int32_t  width  = slot->width;
+  int32_t  height = slot->height;
+  int32_t  type   = slot->type;
+  uint32_t step   = slot->step;
+  uint64_t bytes  = slot->bytes;
+  // fields read while the slot was overwritten may be anything, so they are checked
+  if (!StillValid (_view) || _view.index != _index || width < 1 || height < 1
+      || SHAREDFRAMES_SLOT_HEADER + bytes > mHeader->slotBytes || uint64_t (step) * height != bytes)
+    return false;
+  uint8_t* data = const_cast<uint8_t*> (reinterpret_cast<const uint8_t*> (slot)) + SHAREDFRAMES_SLOT_HEADER;
+  _view.image = cv::Mat (height, width, type, data, step);
+  return true;
+}
+
+bool SharedFrameReader::StillValid (const SharedFrameView& _view) const
+{
+  std::atomic_thread_fence (std::memory_order_acquire);
+  return mHeader && Slot (_view.index)->sequence.load (std::memory_order_relaxed) == _view.sequence;
+}
+
+bool SharedFrameReader::Copy (uint64_t _index, SharedFrameView& _view, cv::Mat& _image) const
+{
+  if (!Peek (_index, _view))
+    return false;
+  _view.image.copyTo (_image);
+  if (!StillValid (_view))
+    return false;
+  _view.image = _image;
+  return true;
+}
@@ -0,0 +1,157 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: SharedFrameRing.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Publishes a camera's most recent frames in shared memory,
+// so that other processes on the machine, such as online tracking tools,
+// can use the camera while the logger holds it. The memory is named
+// BCI2000WebcamFrames<n> after the camera index n (a POSIX shared memory
+// object, or a Local\\ file mapping on Windows) and holds a ring of
+// slots, each with one frame, its camera frame number and capture time.
+//
+// The capture thread never waits for readers. Each slot carries a sequence
+// number that is odd while the slot is written (a seqlock): a reader notes
+// the even number, uses the frame where it lies, and then checks that the
+// number did not change; if it did, the frame was overwritten meanwhile and
+// must be discarded. SharedFrameReader implements this for C++ readers;
+// the layout below is what readers in other languages rely on.
+//
+// Compressed streams (Passthrough) publish their samples as they are, with
+// the codec's FOURCC in the header; other streams publish pixels.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef SHAREDFRAMERING_H
+#define SHAREDFRAMERING_H
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "WebcamFrame.h"
+
+#define SHAREDFRAMES_MAGIC   "BCIWCAM"
+#define SHAREDFRAMES_VERSION 1
+
+// at the start of the shared memory
+struct SharedFrameHeader
+{
+  char                  magic[8];      // SHAREDFRAMES_MAGIC
+  uint32_t              version;       // SHAREDFRAMES_VERSION
+  uint32_t              slots;
+  uint64_t              slotBytes;     // distance between slots, including their headers
+  uint64_t              firstSlot;     // offset of the first slot from the start
+  int32_t               cameraIndex;
+  uint32_t              fourcc;        // 0 for pixels, else the codec of compressed samples
+  std::atomic<uint64_t> published;     // frames so far; frame k is in slot k % slots
+};
+
+// at the start of each slot, followed by the frame data at SHAREDFRAMES_SLOT_HEADER
+struct SharedFrameSlot
+{
+  std::atomic<uint64_t> sequence;      // odd while the slot is written
+  uint64_t              index;         // which published frame the slot holds
+  uint32_t              cameraFrame;   // as in the frame index
+  uint32_t              flags;         // FRAMEINDEX_FLAG_*
+  int64_t               captureTimeNs; // same clock as the frame index
+  int32_t               width;
+  int32_t               height;
+  int32_t               type;          // OpenCV type of the pixels
+  uint32_t              step;          // bytes per row
+  uint64_t              bytes;
+};
+#define SHAREDFRAMES_SLOT_HEADER 64
+
+static_assert (ATOMIC_LLONG_LOCK_FREE == 2, "shared frames need lock-free 64 bit atomics");
+static_assert (sizeof (SharedFrameHeader) <= 64 && sizeof (SharedFrameSlot) <= SHAREDFRAMES_SLOT_HEADER,
+               "shared frame headers must fit their reserved space");
+
+// the name of a camera's shared memory
+std::string SharedFramesName (int _camIndex);
+
+// written by the capture thread
+class SharedFrameRing
+{
+public:
+  SharedFrameRing  ();
+  ~SharedFrameRing ();
+
+  // room for _slots frames of up to _frameBytes each
+  bool Open      (int _camIndex, int _slots, size_t _frameBytes, uint32_t _fourcc);
+  void Close     ();
+  bool IsOpen    () const { return mHeader != nullptr; }
+  // false if the frame is larger than a slot
+  bool Publish   (const WebcamFrame& _frame);
+
+private:
+  SharedFrameRing (const SharedFrameRing&);
+  SharedFrameRing& operator= (const SharedFrameRing&);
+
+  std::string        mName;
+  void*              mHandle;    // of the file mapping, on Windows
+  size_t             mSize;
+  SharedFrameHeader* mHeader;
+};
+
+// a frame in shared memory, valid as long as SharedFrameReader::StillValid () says so
+struct SharedFrameView
+{
+  uint64_t        index;
+  uint64_t        sequence;
+  uint32_t        cameraFrame;
+  uint32_t        flags;
+  int64_t         captureTimeNs;
+  cv::Mat         image;         // onto the shared memory; 1xN bytes for compressed samples
+};
+
+class SharedFrameReader
+{
+public:
+  SharedFrameReader  ();
+  ~SharedFrameReader ();
+
+  bool     Open       (int _camIndex);
+  void     Close      ();
+  bool     IsOpen     () const { return mHeader != nullptr; }
+  uint32_t Fourcc     () const { return mHeader ? mHeader->fourcc : 0; }
+  // frames published so far; the latest one is Published () - 1
+  uint64_t Published  () const;
+
+  // points _view at frame _index, without copying; false if it is not, or no longer, there
+  bool     Peek       (uint64_t _index, SharedFrameView& _view) const;
+  // true if the frame was not overwritten since Peek (); check after using it
+  bool     StillValid (const SharedFrameView& _view) const;
+  // a copy of frame _index
+  bool     Copy       (uint64_t _index, SharedFrameView& _view, cv::Mat& _image) const;
+
+private:
+  SharedFrameReader (const SharedFrameReader&);
+  SharedFrameReader& operator= (const SharedFrameReader&);
+
+  const SharedFrameSlot* Slot (uint64_t _index) const;
+
+  void*                    mHandle;
+  size_t                   mSize;
+  const SharedFrameHeader* mHeader;
+};
+
+#endif // SHAREDFRAMERING_H
@@ -0,0 +1,313 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: ThreadPlacement.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Applies and reports the processor cores and scheduling
+// priority of a pipeline thread.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "ThreadPlacement.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#if defined (_WIN32)
+# include <windows.h>
+#elif defined (__linux__)
+# include <pthread.h>
+# include <sched.h>
+# include <sys/resource.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+// SCHED_FIFO priority of real-time threads; low, so that kernel threads still preempt them
+#define PLACEMENT_FIFO_PRIORITY 10
+// nice values of raised and lowered threads
+#define PLACEMENT_NICE_RAISED  -5
+#define PLACEMENT_NICE_LOWERED  5
+
+namespace
+{
+  bool SetAffinity (const std::vector<int>& _cores, std::string& _error)
+  {
+#if defined (_WIN32)
+    DWORD_PTR mask = 0;
+    for (size_t i = 0; i < _cores.size (); i++)
+      if (_cores[i] < 8 * static_cast<int> (sizeof (mask)))
+        mask |= DWORD_PTR (1) << _cores[i];
+    if (mask != 0 && ::SetThreadAffinityMask (::GetCurrentThread (), mask) != 0)
+      return true;
+    _error = "the cores are not available";
+    return false;
+#elif defined (__linux__)
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    for (size_t i = 0; i < _cores.size (); i++)
+      if (_cores[i] < CPU_SETSIZE)
+        CPU_SET (_cores[i], &set);
+    int result = ::pthread_setaffinity_np (::pthread_self (), sizeof (set), &set);
+    if (result != 0)
+      _error = ::strerror (result);
+    return result == 0;
+#else
+    _error = "not supported on this system";
+    return false;
+#endif
+  }
+
+  // the cores the calling thread may run on; empty if unknown
+  std::vector<int> GetAffinity ()
+  {
+    std::vector<int> cores;
+#if defined (_WIN32)
+    // the mask can only be read by setting it, so it is set to what it is
+    DWORD_PTR process = 0, system = 0;
+    if (::GetProcessAffinityMask (::GetCurrentProcess (), &process, &system))
+    {
+      DWORD_PTR mask = ::SetThreadAffinityMask (::GetCurrentThread (), process);
+      if (mask != 0)
+        ::SetThreadAffinityMask (::GetCurrentThread (), mask);
+      for (int i = 0; i < 8 * static_cast<int> (sizeof (mask)); i++)
+        if (mask & (DWORD_PTR (1) << i))
+          cores.push_back (i);
+    }
+#elif defined (__linux__)
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    if (::pthread_getaffinity_np (::pthread_self (), sizeof (set), &set) == 0)
+      for (int i = 0; i < CPU_SETSIZE; i++)
+        if (CPU_ISSET (i, &set))
+          cores.push_back (i);
+#endif
+    return cores;
+  }
+
+  bool SetPriority (ThreadPlacement::Priority _priority, std::string& _error)
+  {
+#if defined (_WIN32)
+    int priority = THREAD_PRIORITY_NORMAL;
+    switch (_priority)
+    {
+      case ThreadPlacement::Lowered:  priority = THREAD_PRIORITY_BELOW_NORMAL;  break;
+      case ThreadPlacement::Raised:   priority = THREAD_PRIORITY_HIGHEST;       break;
+      case ThreadPlacement::RealTime: priority = THREAD_PRIORITY_TIME_CRITICAL; break;
+      default: break;
+    }
+    if (::SetThreadPriority (::GetCurrentThread (), priority))
+      return true;
+    _error = "refused by the system";
+    return false;
+#elif defined (__linux__)
+    int result = 0;
+    if (_priority == ThreadPlacement::RealTime)
+    {
+      sched_param param;
+      param.sched_priority = PLACEMENT_FIFO_PRIORITY;
+      result = ::pthread_setschedparam (::pthread_self (), SCHED_FIFO, &param);
+    }
+    else
+    {
+      // on Linux, nice values are per thread
+      int nice = _priority == ThreadPlacement::Raised  ? PLACEMENT_NICE_RAISED
+               : _priority == ThreadPlacement::Lowered ? PLACEMENT_NICE_LOWERED : 0;
+      if (::setpriority (PRIO_PROCESS, static_cast<id_t> (::syscall (SYS_gettid)), nice) != 0)
+        result = errno;
+    }
+    if (result != 0)
+      _error = ::strerror (result);
+    return result == 0;
+#else
+    _error = "not supported on this system";
+    return _priority == ThreadPlacement::Normal;
+#endif
+  }
+
+  // the calling thread's scheduling, as the system reports it
+  std::string DescribePriority ()
+  {
+    std::ostringstream oss;
+#if defined (_WIN32)
+    oss << "priority " << ::GetThreadPriority (::GetCurrentThread ());
+#elif defined (__linux__)
+    int         policy = 0;
+    sched_param param;
+    if (::pthread_getschedparam (::pthread_self (), &policy, &param) == 0 && policy == SCHED_FIFO)
+      oss << "SCHED_FIFO " << param.sched_priority;
+    else
+      oss << "nice " << ::getpriority (PRIO_PROCESS, static_cast<id_t> (::syscall (SYS_gettid)));
+#else
+    oss << "default priority";
+#endif
+    return oss.str ();
+  }
+}
+
+//==========================================================================================
+// ThreadPlacement member function implementaion
+//==========================================================================================
+bool ThreadPlacement::ParseCores (const std::string& _text, std::vector<int>& _cores, std::string& _error)
+{
+  _cores.clear ();
+  if (_text.empty () || _text == "*")
+    return true;
+
+  std::istringstream iss (_text);
+  std::string        range;
+  while (std::getline (iss, range, ','))
+  {
+    char* end   = nullptr;
+    long  first = ::strtol (range.c_str (), &end, 10);
+    long  last  = first;
+    if (*end == '-')
+      last = ::strtol (end + 1, &end, 10);
+    if (range.empty () || *end != '\0' || first < 0 || last < first || last > 1023)
+    {
+      _error = "\"" + _text + "\" is not a list of cores like 0-3,6";
+      return false;
+    }
+    for (long core = first; core <= last; core++)
+      _cores.push_back (static_cast<int> (core));
+  }
+  std::sort (_cores.begin (), _cores.end ());
+  _cores.erase (std::unique (_cores.begin (), _cores.end ()), _cores.end ());
+  return true;
+}
+
+bool ThreadPlacement::ParseCoreSets (const std::string& _text, size_t _count,
+                                     std::vector<std::vector<int> >& _sets, std::string& _error)
+{
+  _sets.clear ();
+  std::istringstream iss (_text);
+  std::string        part;
+  while (std::getline (iss, part, '/'))
+  {
+    std::vector<int> cores;
+    if (!ParseCores (part, cores, _error))
+      return false;
+    _sets.push_back (cores);
+  }
+  if (_sets.size () > _count)
+  {
+    _error = "\"" + _text + "\" has more than " + std::to_string (_count) + " core lists";
+    return false;
+  }
+  if (_sets.empty ())
+    _sets.push_back (std::vector<int> ());
+  while (_sets.size () < _count)
+    _sets.push_back (_sets.back ());
+  return true;
+}
+
+std::string ThreadPlacement::FormatCores (const std::vector<int>& _cores)
+{
+  if (_cores.empty ())
+    return "any core";
+  std::ostringstream oss;
+  oss << (_cores.size () > 1 ? "cores " : "core ");
+  for (size_t i = 0; i < _cores.size (); )
+  {
+    size_t j = i;
+    while (j + 1 < _cores.size () && _cores[j + 1] == _cores[j] + 1)
+      j++;
+    oss << (i > 0 ? "," : "") << _cores[i];
+    if (j > i)
+      oss << "-" << _cores[j];
+    i = j + 1;
+  }
+  return oss.str ();
+}
+
+bool ThreadPlacement::PinCurrentThread (const std::vector<int>& _cores, std::vector<int>& _previous)
+{
+  std::string error;
+  _previous = GetAffinity ();
+  return !_cores.empty () && SetAffinity (_cores, error);
+}
+
+int ThreadPlacement::CurrentNode ()
+{
+#if defined (_WIN32)
+  PROCESSOR_NUMBER processor;
+  USHORT           node = 0;
+  ::GetCurrentProcessorNumberEx (&processor);
+  return ::GetNumaProcessorNodeEx (&processor, &node) ? node : -1;
+#elif defined (__linux__)
+  unsigned int cpu = 0, node = 0;
+  return ::syscall (SYS_getcpu, &cpu, &node, nullptr) == 0 ? static_cast<int> (node) : -1;
+#else
+  return -1;
+#endif
+}
+
+ThreadPlacement::ThreadPlacement () :
+  mPriority  (Normal),
+  mSucceeded (true),
+  mApplied   (false)
+{
+}
+
+void ThreadPlacement::Configure (const std::vector<int>& _cores, Priority _priority)
+{
+  mCores     = _cores;
+  mPriority  = _priority;
+  mSucceeded = true;
+  mApplied   = false;
+}
+
+void ThreadPlacement::Apply ()
+{
+  std::string affinityError, priorityError;
+  bool pinned = mCores.empty () || SetAffinity (mCores, affinityError);
+  bool raised = mPriority == Normal || SetPriority (mPriority, priorityError);
+
+  // what the thread got, which is not necessarily what it asked for
+  std::vector<int> cores = GetAffinity ();
+  std::ostringstream oss;
+  oss << (mCores.empty () ? FormatCores (mCores) : FormatCores (cores)) << ", " << DescribePriority ();
+  if (!pinned)
+    oss << " (could not be pinned to " << FormatCores (mCores) << ": " << affinityError << ")";
+  if (!raised)
+    oss << " (could not change priority: " << priorityError << ")";
+  mReport    = oss.str ();
+  mSucceeded = pinned && raised;
+  mApplied.store (true, std::memory_order_release);
+}
+
+bool ThreadPlacement::WaitApplied (int _timeoutMs) const
+{
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now () + std::chrono::milliseconds (_timeoutMs);
+  while (!mApplied.load (std::memory_order_acquire) && std::chrono::steady_clock::now () < deadline)
+    std::this_thread::sleep_for (std::chrono::milliseconds (1));
+  return mApplied.load (std::memory_order_acquire);
+}
+
+std::string ThreadPlacement::Report () const
+{
+  return mApplied.load (std::memory_order_acquire) ? mReport : "not started";
+}
@@ -0,0 +1,88 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: ThreadPlacement.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Where and how urgently a thread of the pipeline runs: the
+// processor cores it may run on, and its scheduling priority. A thread
+// applies its placement itself, when it starts, and keeps a report of the
+// cores and priority it actually got, so that settings the system refused
+// are noticed.
+//
+// Cores are given as lists like "0-3,6"; "*" stands for any core. The
+// priorities map to nice values and SCHED_FIFO on Linux, and to thread
+// priorities on Windows. Other systems leave threads as they are.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef THREADPLACEMENT_H
+#define THREADPLACEMENT_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+class ThreadPlacement
+{
+public:
+  enum Priority
+  {
+    Lowered  = -1,
+    Normal   = 0,
+    Raised   = 1,
+    RealTime = 2,
+  };
+
+  // a core list, empty for any core
+  static bool        ParseCores  (const std::string& _text, std::vector<int>& _cores, std::string& _error);
+  // _count core lists separated by '/'; missing ones repeat the last one given
+  static bool        ParseCoreSets (const std::string& _text, size_t _count,
+                                    std::vector<std::vector<int> >& _sets, std::string& _error);
+  static std::string FormatCores (const std::vector<int>& _cores);
+
+  // restricts the calling thread to _cores, returning the cores it was allowed before
+  static bool        PinCurrentThread (const std::vector<int>& _cores, std::vector<int>& _previous);
+  // the memory node of the core the calling thread runs on, -1 if unknown
+  static int         CurrentNode ();
+
+  ThreadPlacement ();
+
+  void        Configure  (const std::vector<int>& _cores, Priority _priority);
+  bool        Configured () const { return !mCores.empty () || mPriority != Normal; }
+  const std::vector<int>& Cores () const { return mCores; }
+  Priority    Level      () const { return mPriority; }
+
+  // called by the thread itself
+  void        Apply      ();
+  // waits at most _timeoutMs for the thread to apply its placement
+  bool        WaitApplied (int _timeoutMs) const;
+  // the cores and priority the thread got, and what was refused; valid once applied
+  std::string Report     () const;
+  bool        Succeeded  () const { return mSucceeded; }
+
+private:
+  std::vector<int>  mCores;
+  Priority          mPriority;
+  std::string       mReport;
+  std::atomic<bool> mSucceeded;
+  std::atomic<bool> mApplied;
+};
+
+#endif // THREADPLACEMENT_H
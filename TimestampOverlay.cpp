@@ -0,0 +1,200 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: TimestampOverlay.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Burns the date and time into recorded frames from a cached
+// glyph atlas.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "TimestampOverlay.h"
+
+#include <cstdio>
+
+#define OVERLAY_FONT      cv::FONT_HERSHEY_SIMPLEX
+#define OVERLAY_SCALE     0.5
+#define OVERLAY_THICKNESS 1
+#define OVERLAY_INSET     10
+
+// characters that can appear in the overlay, including the "<n/a>" of an unknown time
+static const char sGlyphSet[] = "0123456789/:.# <>an";
+
+// widest text of each kind, used to place the overlay
+static const char sDateTemplate[]        = "00/00/00 00:00:00";
+static const char sMillisecondTemplate[] = ".000";
+static const char sFrameNumberTemplate[] = " #0000000";
+
+static bool LocalTime (time_t _time, struct ::tm& _out)
+{
+#ifdef _WIN32
+  return ::localtime_s (&_out, &_time) == 0;
+#else
+  return ::localtime_r (&_time, &_out) != nullptr;
+#endif
+}
+
+TimestampOverlay::TimestampOverlay () :
+  mEnabled     (false),
+  mDetail      (Seconds),
+  mFrameType   (CV_8UC3),
+  mAscent      (0),
+  mDescent     (0),
+  mMargin      (2),
+  mStripSecond (-1)
+{
+}
+
+void TimestampOverlay::Initialize (int _location, int _detail, cv::Size _frameSize, int _frameType)
+{
+  mDetail      = _detail;
+  mFrameSize   = _frameSize;
+  mStripSecond = -1;
+  mEnabled     = _location >= 1 && _location <= 4;
+  if (!mEnabled)
+    return;
+
+  if (mGlyphs[(int)'0'].mask.empty () || _frameType != mFrameType)
+    RenderAtlas (_frameType);
+  mFrameType = _frameType;
+
+  std::string widest = sDateTemplate;
+  if      (mDetail == Milliseconds) widest += sMillisecondTemplate;
+  else if (mDetail == FrameNumber)  widest += sFrameNumberTemplate;
+  int width = TextWidth (widest.c_str ());
+
+  // find appropriate point to put the text
+  switch (_location)
+  {
+  case 1: // Upper Right
+    mOrigin = cv::Point (mFrameSize.width - OVERLAY_INSET - width, OVERLAY_INSET + mAscent);
+    break;
+  case 2: // Upper Left
+    mOrigin = cv::Point (OVERLAY_INSET, OVERLAY_INSET + mAscent);
+    break;
+  case 3: // Lower Right
+    mOrigin = cv::Point (mFrameSize.width - OVERLAY_INSET - width, mFrameSize.height - OVERLAY_INSET - mDescent);
+    break;
+  case 4: // Lower Left
+    mOrigin = cv::Point (OVERLAY_INSET, mFrameSize.height - OVERLAY_INSET - mDescent);
+    break;
+  }
+}
+
+void TimestampOverlay::RenderAtlas (int _frameType)
+{
+  int baseline = 0;
+  cv::Size digit = cv::getTextSize ("0", OVERLAY_FONT, OVERLAY_SCALE, OVERLAY_THICKNESS, &baseline);
+  mAscent  = digit.height;
+  mDescent = baseline;
+
+  // every glyph cell has the same height, with a margin for strokes that
+  //   reach past the nominal text box
+  int cellHeight = mAscent + mDescent + 2 * mMargin;
+  for (const char* c = sGlyphSet; *c; c++)
+  {
+    char text[2] = { *c, 0 };
+    int  unused  = 0;
+    Glyph& glyph = mGlyphs[(int)*c];
+    glyph.advance = cv::getTextSize (text, OVERLAY_FONT, OVERLAY_SCALE, OVERLAY_THICKNESS, &unused).width;
+    glyph.mask    = cv::Mat (cellHeight, glyph.advance + 2 * mMargin, _frameType, cv::Scalar::all (0));
+    cv::putText (glyph.mask, text, cv::Point (mMargin, mMargin + mAscent),
+                 OVERLAY_FONT, OVERLAY_SCALE, cv::Scalar::all (255), OVERLAY_THICKNESS);
+  }
+}
+
+int TimestampOverlay::TextWidth (const char* _text) const
+{
+  int width = 0;
+  for (const char* c = _text; *c; c++)
+    if (*c > 0)
+      width += mGlyphs[(int)*c].advance;
+  return width;
+}
+
+void TimestampOverlay::DrawText (cv::Mat& _target, cv::Point _origin, const char* _text) const
+{
+  cv::Point cell (_origin.x - mMargin, _origin.y - mAscent - mMargin);
+  for (const char* c = _text; *c; c++)
+  {
+    if (*c <= 0 || mGlyphs[(int)*c].mask.empty ())
+      continue;
+    const Glyph& glyph = mGlyphs[(int)*c];
+    Blend (_target, glyph.mask, cell);
+    cell.x += glyph.advance;
+  }
+}
+
+void TimestampOverlay::Blend (cv::Mat& _target, const cv::Mat& _mask, cv::Point _topLeft)
+{
+  // clip to the target, then brighten text pixels; cv::max is vectorized
+  cv::Rect dst  = cv::Rect (_topLeft.x, _topLeft.y, _mask.cols, _mask.rows)
+                & cv::Rect (0, 0, _target.cols, _target.rows);
+  if (dst.empty () || _mask.type () != _target.type ())
+    return;
+  cv::Rect src (dst.x - _topLeft.x, dst.y - _topLeft.y, dst.width, dst.height);
+  cv::Mat  roi = _target (dst);
+  cv::max (roi, _mask (src), roi);
+}
+
+void TimestampOverlay::RenderStrip (time_t _seconds)
+{
+  // format is "MM/dd/yy hh:mm:ss"
+  char text[32] = "<n/a>";
+  struct ::tm t;
+  if (LocalTime (_seconds, t))
+    ::snprintf (text, sizeof (text), "%02d/%02d/%02d %02d:%02d:%02d",
+                t.tm_mon + 1, t.tm_mday, t.tm_year % 100, t.tm_hour, t.tm_min, t.tm_sec);
+
+  int height = mAscent + mDescent + 2 * mMargin;
+  mStrip.create (height, TextWidth (sDateTemplate) + 2 * mMargin, mFrameType);
+  mStrip.setTo (cv::Scalar::all (0));
+  DrawText (mStrip, cv::Point (mMargin, mMargin + mAscent), text);
+  mStripSecond = _seconds;
+}
+
+void TimestampOverlay::Apply (cv::Mat& _frame,
+                              std::chrono::system_clock::time_point _time,
+                              unsigned long _frameNumber)
+{
+  if (!mEnabled || _frame.type () != mFrameType)
+    return;
+
+  time_t seconds = std::chrono::system_clock::to_time_t (_time);
+  if (seconds != mStripSecond)
+    RenderStrip (seconds);
+  Blend (_frame, mStrip, cv::Point (mOrigin.x - mMargin, mOrigin.y - mAscent - mMargin));
+
+  if (mDetail == Seconds)
+    return;
+
+  char suffix[32];
+  if (mDetail == Milliseconds)
+  {
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds> (_time.time_since_epoch ()).count () % 1000;
+    ::snprintf (suffix, sizeof (suffix), ".%03d", (int)ms);
+  }
+  else
+  {
+    ::snprintf (suffix, sizeof (suffix), " #%lu", _frameNumber);
+  }
+  DrawText (_frame, cv::Point (mOrigin.x + TextWidth (sDateTemplate), mOrigin.y), suffix);
+}
@@ -0,0 +1,87 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: TimestampOverlay.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Burns the date and time into recorded frames. Glyphs are
+// rendered once into an atlas; the "MM/dd/yy hh:mm:ss" strip is composed
+// from the atlas only when the second changes and is blended into each frame
+// with a saturating max, which matches white cv::putText output. Optional
+// millisecond or frame number text is composed from the atlas per frame.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef TIMESTAMPOVERLAY_H
+#define TIMESTAMPOVERLAY_H
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <ctime>
+#include <string>
+
+class TimestampOverlay
+{
+public:
+  enum Detail
+  {
+    Seconds      = 0,
+    Milliseconds = 1,
+    FrameNumber  = 2,
+  };
+
+  TimestampOverlay ();
+
+  // _location uses the DateTimeLocation enumeration; 0 disables the overlay
+  void Initialize (int _location, int _detail, cv::Size _frameSize, int _frameType);
+  bool Enabled    () const { return mEnabled; }
+
+  void Apply      (cv::Mat& _frame,
+                   std::chrono::system_clock::time_point _time,
+                   unsigned long _frameNumber);
+
+private:
+  struct Glyph
+  {
+    cv::Mat mask;      // glyph in white on black, in the frame's pixel type
+    int     advance;   // horizontal distance to the next glyph
+  };
+
+  void RenderAtlas  (int _frameType);
+  void RenderStrip  (time_t _seconds);
+  int  TextWidth    (const char* _text) const;
+  void DrawText     (cv::Mat& _target, cv::Point _origin, const char* _text) const;
+  static void Blend (cv::Mat& _target, const cv::Mat& _mask, cv::Point _topLeft);
+
+  bool      mEnabled;
+  int       mDetail;
+  cv::Size  mFrameSize;
+  int       mFrameType;
+
+  Glyph     mGlyphs[128];
+  int       mAscent;
+  int       mDescent;
+  int       mMargin;
+
+  cv::Mat   mStrip;          // cached date/time text
+  time_t    mStripSecond;
+  cv::Point mOrigin;         // text baseline origin in the frame, as for cv::putText
+};
+
+#endif // TIMESTAMPOVERLAY_H
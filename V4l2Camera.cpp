@@ -0,0 +1,522 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: V4l2Camera.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A native Linux capture backend using V4L2 streaming I/O with
+// memory-mapped driver buffers.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "V4l2Camera.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#ifdef __linux__
+# include <poll.h>
+# include <linux/videodev2.h>
+#endif
+
+// driver buffers that are never lent out, so the camera always has one to fill
+#define MIN_DRIVER_BUFFERS 2
+
+// how long grab () waits for a frame before giving up
+#define GRAB_TIMEOUT_MS    1000
+
+// how long stopping a stream waits for frames to release the buffers they hold
+#define LEASE_WAIT_MS      500
+
+// a slot is the buffer index with the stream generation above it
+#define SLOT_GENERATION_SHIFT 8
+#define SLOT_INDEX_MASK       ((1 << SLOT_GENERATION_SHIFT) - 1)
+
+// capacity of the queue of returned buffers, enough for two streams' worth
+#define RETURN_QUEUE_LENGTH   64
+
+bool V4l2Camera::IsV4l2 (const std::string& _source)
+{
+  return _source.compare (0, 4, "v4l2") == 0;
+}
+
+bool V4l2Camera::Parse (const std::string& _source, std::string& _error)
+{
+#ifdef __linux__
+  if (_source == "v4l2" || _source == "v4l2:emulated")
+    return true;
+  _error = "expected v4l2 or v4l2:emulated";
+#else
+  _error = "the v4l2 backend is only available on Linux";
+#endif
+  return false;
+}
+
+V4l2Camera::V4l2Camera (const std::string& _source, int _bufferCount) :
+  V4l2Camera (_source == "v4l2:emulated" ? V4l2Device::CreateEmulated () : V4l2Device::CreateSystem (), _bufferCount)
+{
+}
+
+V4l2Camera::V4l2Camera (std::unique_ptr<V4l2Device> _device, int _bufferCount) :
+  mDevice          (std::move (_device)),
+  mBufferCount     (std::max (MIN_DRIVER_BUFFERS, _bufferCount)),
+  mOpened          (false),
+  mStreaming       (false),
+  mConvert         (true),
+  mRequestedFormat (0),
+  mRequestedFourcc (0),
+  mRequestedFps    (0),
+  mWidth           (0),
+  mHeight          (0),
+  mPixelFormat     (0),
+  mBytesPerLine    (0),
+  mFps             (0),
+  mHeld            (-1),
+  mHeldBytes       (0),
+  mTimestampNs     (0),
+  mMonotonic       (false),
+  mReturned        (new FrameQueue<int> (RETURN_QUEUE_LENGTH, FrameQueue<int>::Block)),
+  mLeased          (0),
+  mGeneration      (0)
+{
+  mReturned->Open ();
+}
+
+V4l2Camera::~V4l2Camera ()
+{
+  release ();
+  // frames that outlive the camera must not be used any more
+  for (std::map<int, Buffer>::iterator i = mOrphans.begin (); i != mOrphans.end (); ++i)
+    mDevice->Unmap (i->second.start, i->second.length);
+  mOrphans.clear ();
+}
+
+#ifdef __linux__
+
+namespace
+{
+  // formats the pipeline can take, in order of preference when none was requested
+  const uint32_t sFormats[] = { V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_GREY };
+
+  bool Handled (uint32_t _format)
+  {
+    // H264 can only be passed through, so it is never chosen unless requested
+    if (_format == V4L2_PIX_FMT_H264)
+      return true;
+    for (size_t i = 0; i < sizeof (sFormats) / sizeof (*sFormats); i++)
+      if (sFormats[i] == _format)
+        return true;
+    return false;
+  }
+
+  bool Compressed (uint32_t _format)
+  {
+    return _format == V4L2_PIX_FMT_MJPEG || _format == V4L2_PIX_FMT_H264;
+  }
+
+  // formats whose buffers the pipeline can use as they are
+  bool Wrappable (uint32_t _format, bool _convert)
+  {
+    return _format == V4L2_PIX_FMT_BGR24 || _format == V4L2_PIX_FMT_GREY || (!_convert && Compressed (_format));
+  }
+}
+
+bool V4l2Camera::open (int _index, int)
+{
+  release ();
+  if (!mDevice || !mDevice->Open ("/dev/video" + std::to_string (_index)))
+    return false;
+
+  v4l2_capability cap;
+  ::memset (&cap, 0, sizeof (cap));
+  uint32_t caps = 0;
+  if (mDevice->Ioctl (VIDIOC_QUERYCAP, &cap) == 0)
+    caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+  if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING))
+  {
+    mDevice->Close ();
+    return false;
+  }
+
+  v4l2_format format;
+  ::memset (&format, 0, sizeof (format));
+  format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (mDevice->Ioctl (VIDIOC_G_FMT, &format) == 0)
+  {
+    mWidth  = format.fmt.pix.width;
+    mHeight = format.fmt.pix.height;
+  }
+  mOpened = true;
+  if (!Configure ())
+  {
+    release ();
+    return false;
+  }
+  return true;
+}
+
+void V4l2Camera::release ()
+{
+  if (!mOpened)
+    return;
+  StopStreaming ();
+  mDevice->Close ();
+  mOpened = false;
+}
+
+bool V4l2Camera::Configure ()
+{
+  // the format can only change while no buffers are allocated
+  if (mLeased > 0)
+    return false;
+  StopStreaming ();
+
+  std::vector<uint32_t> candidates;
+  if (mRequestedFormat)
+    candidates.push_back (mRequestedFormat);
+  candidates.insert (candidates.end (), sFormats, sFormats + sizeof (sFormats) / sizeof (*sFormats));
+
+  // the driver adjusts what it cannot do; take the first candidate it accepts as is
+  v4l2_format format;
+  bool        accepted = false;
+  for (size_t i = 0; i < candidates.size () && !accepted; i++)
+  {
+    ::memset (&format, 0, sizeof (format));
+    format.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width       = mWidth;
+    format.fmt.pix.height      = mHeight;
+    format.fmt.pix.pixelformat = candidates[i];
+    format.fmt.pix.field       = V4L2_FIELD_ANY;
+    if (mDevice->Ioctl (VIDIOC_S_FMT, &format) == 0)
+      accepted = format.fmt.pix.pixelformat == candidates[i];
+  }
+  if (!accepted || !Handled (format.fmt.pix.pixelformat))
+    return false;
+
+  mWidth        = format.fmt.pix.width;
+  mHeight       = format.fmt.pix.height;
+  mPixelFormat  = format.fmt.pix.pixelformat;
+  mBytesPerLine = format.fmt.pix.bytesperline;
+
+  v4l2_streamparm parm;
+  ::memset (&parm, 0, sizeof (parm));
+  parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (mRequestedFps > 0)
+  {
+    parm.parm.capture.timeperframe.numerator   = 1000;
+    parm.parm.capture.timeperframe.denominator = static_cast<uint32_t> (mRequestedFps * 1000 + 0.5);
+    mDevice->Ioctl (VIDIOC_S_PARM, &parm);
+  }
+  mFps = 0;
+  if (mDevice->Ioctl (VIDIOC_G_PARM, &parm) == 0 && parm.parm.capture.timeperframe.numerator > 0)
+    mFps = double (parm.parm.capture.timeperframe.denominator) / parm.parm.capture.timeperframe.numerator;
+  return true;
+}
+
+bool V4l2Camera::StartStreaming ()
+{
+  v4l2_requestbuffers request;
+  ::memset (&request, 0, sizeof (request));
+  request.count  = mBufferCount;
+  request.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  request.memory = V4L2_MEMORY_MMAP;
+  if (mDevice->Ioctl (VIDIOC_REQBUFS, &request) != 0 || request.count == 0)
+    return false;
+  mLent.assign (request.count, false);
+
+  for (uint32_t i = 0; i < request.count; i++)
+  {
+    v4l2_buffer buffer;
+    ::memset (&buffer, 0, sizeof (buffer));
+    buffer.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index  = i;
+    Buffer mapped = { nullptr, 0 };
+    if (mDevice->Ioctl (VIDIOC_QUERYBUF, &buffer) == 0)
+    {
+      mapped.length = buffer.length;
+      mapped.start  = mDevice->Map (buffer.length, buffer.m.offset);
+    }
+    mBuffers.push_back (mapped);
+    if (!mapped.start || !Requeue (static_cast<int> (i)))
+    {
+      StopStreaming ();
+      return false;
+    }
+  }
+
+  int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (mDevice->Ioctl (VIDIOC_STREAMON, &type) != 0)
+  {
+    StopStreaming ();
+    return false;
+  }
+  mStreaming = true;
+  return true;
+}
+
+void V4l2Camera::StopStreaming ()
+{
+  if (mStreaming)
+  {
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    mDevice->Ioctl (VIDIOC_STREAMOFF, &type);
+  }
+  mStreaming = false;
+
+  // frames in the writer may still point into the buffers; give them time to let go
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now ()
+                                                 + std::chrono::milliseconds (LEASE_WAIT_MS);
+  int slot;
+  while (mReturned->TryPop (slot))
+    Reclaim (slot);
+  while (mLeased > 0)
+  {
+    int remaining = static_cast<int> (std::chrono::duration_cast<std::chrono::milliseconds> (
+                      deadline - std::chrono::steady_clock::now ()).count ());
+    if (remaining <= 0 || !mReturned->Pop (slot, remaining))
+      break;
+    Reclaim (slot);
+  }
+
+  // buffers that are still lent stay mapped until their frames return them
+  for (size_t i = 0; i < mBuffers.size (); i++)
+  {
+    if (!mBuffers[i].start)
+      continue;
+    if (mLent[i])
+      mOrphans[(mGeneration << SLOT_GENERATION_SHIFT) | static_cast<int> (i)] = mBuffers[i];
+    else
+      mDevice->Unmap (mBuffers[i].start, mBuffers[i].length);
+  }
+  if (!mBuffers.empty ())
+  {
+    v4l2_requestbuffers request;
+    ::memset (&request, 0, sizeof (request));
+    request.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    request.memory = V4L2_MEMORY_MMAP;
+    mDevice->Ioctl (VIDIOC_REQBUFS, &request);
+  }
+  mBuffers.clear ();
+  mLent.clear ();
+  mHeld      = -1;
+  mLeased    = 0;
+  mGeneration++;
+}
+
+void V4l2Camera::Reclaim (int _slot)
+{
+  int index = _slot & SLOT_INDEX_MASK;
+  if ((_slot >> SLOT_GENERATION_SHIFT) == mGeneration && index < static_cast<int> (mLent.size ()))
+  {
+    if (mStreaming)
+      Requeue (index);
+    mLent[index] = false;
+    mLeased--;
+    return;
+  }
+  // returned from a stream that has since been stopped
+  std::map<int, Buffer>::iterator orphan = mOrphans.find (_slot);
+  if (orphan != mOrphans.end ())
+  {
+    mDevice->Unmap (orphan->second.start, orphan->second.length);
+    mOrphans.erase (orphan);
+  }
+}
+
+bool V4l2Camera::Requeue (int _index)
+{
+  v4l2_buffer buffer;
+  ::memset (&buffer, 0, sizeof (buffer));
+  buffer.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buffer.memory = V4L2_MEMORY_MMAP;
+  buffer.index  = _index;
+  return mDevice->Ioctl (VIDIOC_QBUF, &buffer) == 0;
+}
+
+bool V4l2Camera::grab ()
+{
+  if (!mOpened || (!mStreaming && !StartStreaming ()))
+    return false;
+
+  // give the driver back what frames released, and the buffer of the previous grab
+  int slot;
+  while (mReturned->TryPop (slot))
+    Reclaim (slot);
+  if (mHeld >= 0)
+    Requeue (mHeld);
+  mHeld = -1;
+
+  v4l2_buffer buffer;
+  for (;;)
+  {
+    ::memset (&buffer, 0, sizeof (buffer));
+    buffer.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    if (mDevice->Ioctl (VIDIOC_DQBUF, &buffer) == 0)
+      break;
+    if (errno != EAGAIN)
+      return false;
+
+    pollfd fd = { mDevice->Fd (), POLLIN, 0 };
+    if (fd.fd < 0 || ::poll (&fd, 1, GRAB_TIMEOUT_MS) <= 0)
+      return false;
+  }
+
+  mHeld        = buffer.index;
+  mHeldBytes   = buffer.bytesused;
+  mTimestampNs = int64_t (buffer.timestamp.tv_sec) * 1000000000 + int64_t (buffer.timestamp.tv_usec) * 1000;
+  mMonotonic   = (buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+  return true;
+}
+
+cv::Mat V4l2Camera::View () const
+{
+  void* data = mBuffers[mHeld].start;
+  switch (mPixelFormat)
+  {
+  case V4L2_PIX_FMT_YUYV:  return cv::Mat (mHeight, mWidth, CV_8UC2, data, mBytesPerLine);
+  case V4L2_PIX_FMT_BGR24: return cv::Mat (mHeight, mWidth, CV_8UC3, data, mBytesPerLine);
+  case V4L2_PIX_FMT_GREY:  return cv::Mat (mHeight, mWidth, CV_8UC1, data, mBytesPerLine);
+  default:                 return cv::Mat (1, static_cast<int> (mHeldBytes), CV_8UC1, data);
+  }
+}
+
+bool V4l2Camera::retrieve (cv::OutputArray _image, int)
+{
+  if (mHeld < 0)
+    return false;
+
+  // one pass from driver memory into the caller's image
+  cv::Mat view = View ();
+  if (!mConvert && Compressed (mPixelFormat))
+  {
+    view.copyTo (_image);
+    return true;
+  }
+  switch (mPixelFormat)
+  {
+  case V4L2_PIX_FMT_YUYV:
+    cv::cvtColor (view, _image, cv::COLOR_YUV2BGR_YUYV);
+    break;
+  case V4L2_PIX_FMT_MJPEG:
+  {
+    _image.create (mHeight, mWidth, CV_8UC3);
+    cv::Mat target  = _image.getMat ();
+    cv::Mat decoded = target;
+    cv::imdecode (view, cv::IMREAD_COLOR, &decoded);
+    if (decoded.empty ())
+      return false;
+    if (decoded.data != target.data)
+      decoded.copyTo (_image);   // the camera sent a different size than negotiated
+    break;
+  }
+  case V4L2_PIX_FMT_H264:
+    return false;   // only passed through, see CAP_PROP_CONVERT_RGB
+  default:
+    view.copyTo (_image);
+    break;
+  }
+  return true;
+}
+
+bool V4l2Camera::Lease (WebcamFrame& _frame)
+{
+  if (mHeld < 0 || !Wrappable (mPixelFormat, mConvert))
+    return false;
+  if (static_cast<int> (mBuffers.size ()) - (mLeased + 1) < MIN_DRIVER_BUFFERS)
+    return false;
+
+  _frame.Release ();
+  _frame.image = View ();
+  _frame.Attach (this, (mGeneration << SLOT_GENERATION_SHIFT) | mHeld);
+  mLent[mHeld] = true;
+  mLeased++;
+  mHeld = -1;
+  return true;
+}
+
+void V4l2Camera::Return (int _slot)
+{
+  // called from the writer thread; the capture thread queues the buffer in its next grab ()
+  mReturned->Push (_slot);
+}
+
+bool V4l2Camera::set (int _propId, double _value)
+{
+  switch (_propId)
+  {
+  case cv::CAP_PROP_FRAME_WIDTH:
+    if (_value >= 1) mWidth = static_cast<int> (_value);
+    break;
+  case cv::CAP_PROP_FRAME_HEIGHT:
+    if (_value >= 1) mHeight = static_cast<int> (_value);
+    break;
+  case cv::CAP_PROP_FPS:
+    mRequestedFps = _value;
+    break;
+  case cv::CAP_PROP_FOURCC:
+  {
+    // the FOURCC parameter names the codec; only pixel formats we can read are requested
+    mRequestedFourcc = _value;
+    uint32_t format  = static_cast<uint32_t> (_value);
+    mRequestedFormat = Handled (format) ? format : 0;
+    break;
+  }
+  case cv::CAP_PROP_BUFFERSIZE:
+    if (_value >= MIN_DRIVER_BUFFERS) mBufferCount = static_cast<int> (_value);
+    break;
+  case cv::CAP_PROP_CONVERT_RGB:
+    mConvert = _value != 0;
+    return true;   // takes effect with the next retrieve ()
+  default:
+    return false;
+  }
+  return !mOpened || Configure ();
+}
+
+#else // __linux__
+
+bool V4l2Camera::open (int, int)                   { return false; }
+void V4l2Camera::release ()                        { mOpened = false; }
+bool V4l2Camera::grab ()                           { return false; }
+bool V4l2Camera::retrieve (cv::OutputArray, int)   { return false; }
+bool V4l2Camera::set (int, double)                 { return false; }
+bool V4l2Camera::Lease (WebcamFrame&)              { return false; }
+void V4l2Camera::Return (int)                      {}
+
+#endif // __linux__
+
+double V4l2Camera::get (int _propId) const
+{
+  switch (_propId)
+  {
+  case cv::CAP_PROP_FRAME_WIDTH:  return mWidth;
+  case cv::CAP_PROP_FRAME_HEIGHT: return mHeight;
+  case cv::CAP_PROP_FPS:          return mFps;
+  // the format the driver set, so that a mismatch with the request shows
+  case cv::CAP_PROP_FOURCC:       return mOpened ? double (mPixelFormat) : mRequestedFourcc;
+  case cv::CAP_PROP_POS_MSEC:     return mTimestampNs / 1e6;
+  case cv::CAP_PROP_BUFFERSIZE:   return mBufferCount;
+  case cv::CAP_PROP_CONVERT_RGB:  return mConvert ? 1 : 0;
+  default:                        return 0;
+  }
+}
@@ -0,0 +1,136 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: V4l2Camera.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A native Linux capture backend using V4L2 streaming I/O with
+// memory-mapped driver buffers. It is a cv::VideoCapture, so the rest of
+// the pipeline does not change, but it avoids the copies OpenCV makes:
+//   - retrieve () converts or decodes straight from the mapped driver
+//     buffer into the caller's (pooled) image, one pass instead of a copy
+//     followed by a conversion;
+//   - for pixel formats the pipeline consumes as they are (BGR3, GREY, and
+//     MJPG or H264 once CAP_PROP_CONVERT_RGB is off), Lease () wraps the
+//     driver buffer itself in the frame. The buffer is queued back to the
+//     driver when the writer releases the frame.
+// Kernel buffer timestamps are reported as CAP_PROP_POS_MSEC and, when
+// they are on the monotonic clock, by KernelTimestampNs ().
+//
+// All device access goes through a V4l2Device, so the backend runs against
+// the emulated device as well as a /dev/video node. A camera uses this
+// backend when its Source row in the Connections parameter is
+//   v4l2            the device /dev/video<CameraIndex>
+//   v4l2:emulated   an emulated device producing a test pattern
+// and V4l2Buffers sets the number of driver buffers.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef V4L2CAMERA_H
+#define V4L2CAMERA_H
+
+#include <opencv2/opencv.hpp>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "V4l2Device.h"
+#include "WebcamFrame.h"
+#include "FrameQueue.h"
+
+class V4l2Camera : public cv::VideoCapture, public FrameOwner
+{
+public:
+  // true if _source selects this backend
+  static bool IsV4l2    (const std::string& _source);
+  // checks the syntax of a source string and whether the backend exists on this platform
+  static bool Parse     (const std::string& _source, std::string& _error);
+
+  V4l2Camera (const std::string& _source, int _bufferCount);
+  // runs against the given device, e.g. a test double
+  V4l2Camera (std::unique_ptr<V4l2Device> _device, int _bufferCount);
+  ~V4l2Camera ();
+
+  bool   open      (int _index, int _apiPreference = cv::CAP_ANY) override;
+  bool   isOpened  () const override { return mOpened; }
+  void   release   () override;
+  bool   grab      () override;
+  bool   retrieve  (cv::OutputArray _image, int _flag = 0) override;
+  bool   set       (int _propId, double _value) override;
+  double get       (int _propId) const override;
+
+  // Wraps the most recently grabbed driver buffer in _frame without copying. Fails if
+  //   the pixel format needs conversion or too few buffers would be left to the driver.
+  bool     Lease             (WebcamFrame& _frame);
+  int      Fd                () const { return mDevice ? mDevice->Fd () : -1; }
+  // capture time of the grabbed frame on the steady clock, 0 if the driver uses another clock
+  int64_t  KernelTimestampNs () const { return mMonotonic ? mTimestampNs : 0; }
+  uint32_t PixelFormat       () const { return mPixelFormat; }
+
+private:
+  struct Buffer
+  {
+    void*  start;
+    size_t length;
+  };
+
+  void   Return          (int _slot) override;
+  // takes back a buffer that a frame released; called on the capturing thread
+  void   Reclaim         (int _slot);
+  bool   Configure       ();
+  bool   StartStreaming  ();
+  void   StopStreaming   ();
+  bool   Requeue         (int _index);
+  cv::Mat View           () const;
+
+  std::unique_ptr<V4l2Device> mDevice;
+  int                         mBufferCount;
+  std::vector<Buffer>         mBuffers;
+  bool                        mOpened;
+  bool                        mStreaming;
+  bool                        mConvert;    // CAP_PROP_CONVERT_RGB; if off, compressed frames are not decoded
+
+  // requested and negotiated format
+  uint32_t                    mRequestedFormat;
+  double                      mRequestedFourcc;
+  double                      mRequestedFps;
+  int                         mWidth;
+  int                         mHeight;
+  uint32_t                    mPixelFormat;
+  int                         mBytesPerLine;
+  double                      mFps;
+
+  // the buffer last dequeued by grab ()
+  int                         mHeld;
+  uint32_t                    mHeldBytes;
+  int64_t                     mTimestampNs;
+  bool                        mMonotonic;
+
+  // buffers released by frames on other threads, queued back by grab (). Slots carry
+  // the stream generation, so buffers of a stream that was stopped while frames still
+  // held them are unmapped when they come back instead of being queued to the driver.
+  std::unique_ptr<FrameQueue<int> > mReturned;
+  int                         mLeased;
+  int                         mGeneration;
+  std::vector<bool>           mLent;
+  std::map<int, Buffer>       mOrphans;    // by slot
+};
+
+#endif // V4L2CAMERA_H
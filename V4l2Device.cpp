@@ -0,0 +1,468 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: V4l2Device.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: The system calls V4l2Camera makes on a video device node:
+// the kernel implementation, and an in-process emulated capture driver.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "V4l2Device.h"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/videodev2.h>
+
+//==========================================================================================
+// Kernel device
+//==========================================================================================
+namespace
+{
+  class SystemV4l2Device : public V4l2Device
+  {
+  public:
+    SystemV4l2Device () : mFd (-1) {}
+    ~SystemV4l2Device () { Close (); }
+
+    bool Open (const std::string& _path) override
+    {
+      Close ();
+      // non-blocking, so that VIDIOC_DQBUF returns EAGAIN instead of waiting
+      mFd = ::open (_path.c_str (), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+      return mFd >= 0;
+    }
+
+    void Close () override
+    {
+      if (mFd >= 0)
+        ::close (mFd);
+      mFd = -1;
+    }
+
+    int Ioctl (unsigned long _request, void* _arg) override
+    {
+      int r;
+      do r = ::ioctl (mFd, _request, _arg);
+      while (r == -1 && errno == EINTR);
+      return r;
+    }
+
+    void* Map (size_t _length, int64_t _offset) override
+    {
+      void* address = ::mmap (nullptr, _length, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, _offset);
+      return address == MAP_FAILED ? nullptr : address;
+    }
+
+    void Unmap (void* _address, size_t _length) override
+    {
+      ::munmap (_address, _length);
+    }
+
+    int Fd () const override { return mFd; }
+
+  private:
+    int mFd;
+  };
+}
+
+//==========================================================================================
+// Emulated device
+//==========================================================================================
+// bounds of the emulated sensor
+#define EMULATED_MIN_SIZE      16
+#define EMULATED_MAX_WIDTH     4096
+#define EMULATED_MAX_HEIGHT    2160
+#define EMULATED_DEFAULT_FPS   30
+#define EMULATED_MAX_BUFFERS   32
+// spacing of the buffer offsets reported by VIDIOC_QUERYBUF
+#define EMULATED_OFFSET_STEP   (1 << 24)
+
+namespace
+{
+  class EmulatedV4l2Device : public V4l2Device
+  {
+  public:
+    EmulatedV4l2Device () :
+      mTimer     (-1),
+      mStreaming (false),
+      mSequence  (0)
+    {
+      ::memset (&mFormat, 0, sizeof (mFormat));
+      mFormat.type                 = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      mFormat.fmt.pix.width        = 640;
+      mFormat.fmt.pix.height       = 480;
+      mFormat.fmt.pix.pixelformat  = V4L2_PIX_FMT_YUYV;
+      mFormat.fmt.pix.field        = V4L2_FIELD_NONE;
+      mFormat.fmt.pix.colorspace   = V4L2_COLORSPACE_SRGB;
+      UpdateSizes ();
+      mInterval.numerator   = 1;
+      mInterval.denominator = EMULATED_DEFAULT_FPS;
+    }
+
+    ~EmulatedV4l2Device () { Close (); }
+
+    bool Open (const std::string&) override
+    {
+      Close ();
+      mTimer = ::timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      return mTimer >= 0;
+    }
+
+    void Close () override
+    {
+      StreamOff ();
+      mBuffers.clear ();
+      if (mTimer >= 0)
+        ::close (mTimer);
+      mTimer = -1;
+    }
+
+    int Ioctl (unsigned long _request, void* _arg) override
+    {
+      switch (_request)
+      {
+      case VIDIOC_QUERYCAP:  return QueryCap (*static_cast<v4l2_capability*> (_arg));
+      case VIDIOC_ENUM_FMT:  return EnumFormat (*static_cast<v4l2_fmtdesc*> (_arg));
+      case VIDIOC_G_FMT:     *static_cast<v4l2_format*> (_arg) = mFormat; return 0;
+      case VIDIOC_S_FMT:     return SetFormat (*static_cast<v4l2_format*> (_arg));
+      case VIDIOC_G_PARM:    return GetParm (*static_cast<v4l2_streamparm*> (_arg));
+      case VIDIOC_S_PARM:    return SetParm (*static_cast<v4l2_streamparm*> (_arg));
+      case VIDIOC_REQBUFS:   return RequestBuffers (*static_cast<v4l2_requestbuffers*> (_arg));
+      case VIDIOC_QUERYBUF:  return QueryBuffer (*static_cast<v4l2_buffer*> (_arg));
+      case VIDIOC_QBUF:      return Queue (*static_cast<v4l2_buffer*> (_arg));
+      case VIDIOC_DQBUF:     return Dequeue (*static_cast<v4l2_buffer*> (_arg));
+      case VIDIOC_STREAMON:  return StreamOn ();
+      case VIDIOC_STREAMOFF: return StreamOff ();
+      default:               return Fail (ENOTTY);
+      }
+    }
+
+    void* Map (size_t _length, int64_t _offset) override
+    {
+      size_t index = static_cast<size_t> (_offset / EMULATED_OFFSET_STEP);
+      if (_offset % EMULATED_OFFSET_STEP != 0 || index >= mBuffers.size () || _length > mBuffers[index].data->size ())
+        return nullptr;
+      // like the kernel, keep the memory of a mapped buffer until it is unmapped, even once
+      //   the buffers are freed or the device is closed
+      void* address = mBuffers[index].data->data ();
+      mMappings.insert (std::make_pair (address, mBuffers[index].data));
+      return address;
+    }
+
+    void Unmap (void* _address, size_t) override
+    {
+      std::multimap<void*, Memory>::iterator mapping = mMappings.find (_address);
+      if (mapping != mMappings.end ())
+        mMappings.erase (mapping);
+    }
+
+    int Fd () const override { return mTimer; }
+
+  private:
+    typedef std::shared_ptr<std::vector<uint8_t> > Memory;
+
+    struct Buffer
+    {
+      Memory               data;
+      bool                 queued;
+      uint32_t             bytesUsed;
+      timeval              timestamp;
+      uint32_t             sequence;
+    };
+
+    static int Fail (int _error)
+    {
+      errno = _error;
+      return -1;
+    }
+
+    static bool Handled (uint32_t _format)
+    {
+      return _format == V4L2_PIX_FMT_YUYV || _format == V4L2_PIX_FMT_BGR24 || _format == V4L2_PIX_FMT_GREY;
+    }
+
+    void UpdateSizes ()
+    {
+      v4l2_pix_format& pix = mFormat.fmt.pix;
+      int bytesPerPixel = pix.pixelformat == V4L2_PIX_FMT_BGR24 ? 3 : pix.pixelformat == V4L2_PIX_FMT_GREY ? 1 : 2;
+      pix.bytesperline = pix.width * bytesPerPixel;
+      pix.sizeimage    = pix.bytesperline * pix.height;
+    }
+
+    int QueryCap (v4l2_capability& _cap)
+    {
+      ::memset (&_cap, 0, sizeof (_cap));
+      ::strncpy (reinterpret_cast<char*> (_cap.driver),   "emulated",        sizeof (_cap.driver) - 1);
+      ::strncpy (reinterpret_cast<char*> (_cap.card),     "Emulated Camera", sizeof (_cap.card) - 1);
+      ::strncpy (reinterpret_cast<char*> (_cap.bus_info), "platform:emulated", sizeof (_cap.bus_info) - 1);
+      _cap.device_caps  = V4L2_CAP_VIDEO_CAPTURE | V4L2_CAP_STREAMING;
+      _cap.capabilities = _cap.device_caps | V4L2_CAP_DEVICE_CAPS;
+      return 0;
+    }
+
+    int EnumFormat (v4l2_fmtdesc& _desc)
+    {
+      static const uint32_t formats[] = { V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_BGR24, V4L2_PIX_FMT_GREY };
+      if (_desc.type != V4L2_BUF_TYPE_VIDEO_CAPTURE || _desc.index >= sizeof (formats) / sizeof (*formats))
+        return Fail (EINVAL);
+      _desc.pixelformat = formats[_desc.index];
+      _desc.flags       = 0;
+      return 0;
+    }
+
+    int SetFormat (v4l2_format& _format)
+    {
+      if (_format.type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        return Fail (EINVAL);
+      if (!mBuffers.empty ())
+        return Fail (EBUSY);
+      // like a driver, adjust the request to the nearest supported format
+      v4l2_pix_format& pix = mFormat.fmt.pix;
+      pix.width       = std::min<uint32_t> (std::max<uint32_t> (_format.fmt.pix.width,  EMULATED_MIN_SIZE), EMULATED_MAX_WIDTH)  & ~1u;
+      pix.height      = std::min<uint32_t> (std::max<uint32_t> (_format.fmt.pix.height, EMULATED_MIN_SIZE), EMULATED_MAX_HEIGHT);
+      pix.pixelformat = Handled (_format.fmt.pix.pixelformat) ? _format.fmt.pix.pixelformat : V4L2_PIX_FMT_YUYV;
+      UpdateSizes ();
+      _format = mFormat;
+      return 0;
+    }
+
+    int GetParm (v4l2_streamparm& _parm)
+    {
+      if (_parm.type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        return Fail (EINVAL);
+      ::memset (&_parm.parm, 0, sizeof (_parm.parm));
+      _parm.parm.capture.capability   = V4L2_CAP_TIMEPERFRAME;
+      _parm.parm.capture.timeperframe = mInterval;
+      return 0;
+    }
+
+    int SetParm (v4l2_streamparm& _parm)
+    {
+      if (_parm.type != V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        return Fail (EINVAL);
+      const v4l2_fract& interval = _parm.parm.capture.timeperframe;
+      if (interval.numerator > 0 && interval.denominator > 0)
+        mInterval = interval;
+      if (mStreaming)
+        ArmTimer ();
+      return GetParm (_parm);
+    }
+
+    int RequestBuffers (v4l2_requestbuffers& _request)
+    {
+      if (_request.type != V4L2_BUF_TYPE_VIDEO_CAPTURE || _request.memory != V4L2_MEMORY_MMAP)
+        return Fail (EINVAL);
+      if (mStreaming)
+        return Fail (EBUSY);
+      _request.count = std::min<uint32_t> (_request.count, EMULATED_MAX_BUFFERS);
+      mBuffers.clear ();
+      mBuffers.resize (_request.count);
+      for (size_t i = 0; i < mBuffers.size (); i++)
+      {
+        mBuffers[i].data   = std::make_shared<std::vector<uint8_t> > (mFormat.fmt.pix.sizeimage);
+        mBuffers[i].queued = false;
+      }
+      mQueue.clear ();
+      mDone.clear ();
+      return 0;
+    }
+
+    int QueryBuffer (v4l2_buffer& _buffer)
+    {
+      if (_buffer.index >= mBuffers.size ())
+        return Fail (EINVAL);
+      _buffer.length   = static_cast<uint32_t> (mBuffers[_buffer.index].data->size ());
+      _buffer.m.offset = _buffer.index * EMULATED_OFFSET_STEP;
+      _buffer.flags    = mBuffers[_buffer.index].queued ? V4L2_BUF_FLAG_QUEUED : 0;
+      return 0;
+    }
+
+    int Queue (v4l2_buffer& _buffer)
+    {
+      if (_buffer.index >= mBuffers.size () || mBuffers[_buffer.index].queued)
+        return Fail (EINVAL);
+      mBuffers[_buffer.index].queued = true;
+      mQueue.push_back (_buffer.index);
+      return 0;
+    }
+
+    void Expose ()
+    {
+      // each timer expiration is one frame of the sensor, which the driver writes into the
+      //   next queued buffer; without a queued buffer the frame is lost
+      uint64_t expirations = 0;
+      if (::read (mTimer, &expirations, sizeof (expirations)) != sizeof (expirations))
+        return;
+      timespec now;
+      ::clock_gettime (CLOCK_MONOTONIC, &now);
+      for (uint64_t i = 0; i < expirations; i++, mSequence++)
+      {
+        if (mQueue.empty ())
+          continue;
+        uint32_t index = mQueue.front ();
+        mQueue.pop_front ();
+        Buffer& buffer = mBuffers[index];
+        buffer.bytesUsed         = mFormat.fmt.pix.sizeimage;
+        buffer.sequence          = mSequence;
+        buffer.timestamp.tv_sec  = now.tv_sec;
+        buffer.timestamp.tv_usec = now.tv_nsec / 1000;
+        Fill (buffer);
+        mDone.push_back (index);
+      }
+    }
+
+    int Dequeue (v4l2_buffer& _buffer)
+    {
+      if (!mStreaming)
+        return Fail (EINVAL);
+      Expose ();
+      if (mDone.empty ())
+        return Fail (EAGAIN);
+
+      uint32_t index = mDone.front ();
+      mDone.pop_front ();
+      Buffer& buffer = mBuffers[index];
+      buffer.queued  = false;
+
+      _buffer.index     = index;
+      _buffer.bytesused = buffer.bytesUsed;
+      _buffer.length    = static_cast<uint32_t> (buffer.data->size ());
+      _buffer.timestamp = buffer.timestamp;
+      _buffer.sequence  = buffer.sequence;
+      _buffer.field     = V4L2_FIELD_NONE;
+      _buffer.flags     = V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC | V4L2_BUF_FLAG_TSTAMP_SRC_SOE;
+      return 0;
+    }
+
+    int StreamOn ()
+    {
+      if (mBuffers.empty ())
+        return Fail (EINVAL);
+      mStreaming = true;
+      ArmTimer ();
+      return 0;
+    }
+
+    int StreamOff ()
+    {
+      mStreaming = false;
+      if (mTimer >= 0)
+      {
+        itimerspec off;
+        ::memset (&off, 0, sizeof (off));
+        ::timerfd_settime (mTimer, 0, &off, nullptr);
+      }
+      for (size_t i = 0; i < mBuffers.size (); i++)
+        mBuffers[i].queued = false;
+      mQueue.clear ();
+      mDone.clear ();
+      return 0;
+    }
+
+    void ArmTimer ()
+    {
+      int64_t     periodNs = int64_t (1000000000) * mInterval.numerator / mInterval.denominator;
+      itimerspec  timer;
+      timer.it_interval.tv_sec  = periodNs / 1000000000;
+      timer.it_interval.tv_nsec = periodNs % 1000000000;
+      timer.it_value            = timer.it_interval;
+      ::timerfd_settime (mTimer, 0, &timer, nullptr);
+    }
+
+    void Fill (Buffer& _buffer)
+    {
+      // a gradient moving right by four pixels per frame
+      const v4l2_pix_format& pix = mFormat.fmt.pix;
+      uint32_t offset = _buffer.sequence * 4;
+      for (uint32_t y = 0; y < pix.height; y++)
+      {
+        uint8_t* row = &(*_buffer.data)[y * pix.bytesperline];
+        for (uint32_t x = 0; x < pix.width; x++)
+        {
+          uint8_t luma = static_cast<uint8_t> ((x + offset) * 256 / pix.width);
+          switch (pix.pixelformat)
+          {
+          case V4L2_PIX_FMT_YUYV:
+            row[2 * x]     = luma;
+            row[2 * x + 1] = (x & 1) ? static_cast<uint8_t> (y * 256 / pix.height) : 128;
+            break;
+          case V4L2_PIX_FMT_BGR24:
+            row[3 * x]     = luma;
+            row[3 * x + 1] = static_cast<uint8_t> (y * 256 / pix.height);
+            row[3 * x + 2] = static_cast<uint8_t> (luma ^ row[3 * x + 1]);
+            break;
+          default:
+            row[x] = luma;
+            break;
+          }
+        }
+      }
+    }
+
+    int                   mTimer;
+    bool                  mStreaming;
+    uint32_t              mSequence;
+    v4l2_format           mFormat;
+    v4l2_fract            mInterval;
+    std::vector<Buffer>   mBuffers;
+    std::deque<uint32_t>  mQueue;   // queued by the application, waiting for a frame
+    std::deque<uint32_t>  mDone;    // filled, waiting to be dequeued
+    std::multimap<void*, Memory> mMappings;   // by address, one entry per Map ()
+  };
+}
+
+std::unique_ptr<V4l2Device> V4l2Device::CreateSystem ()
+{
+  return std::unique_ptr<V4l2Device> (new SystemV4l2Device);
+}
+
+std::unique_ptr<V4l2Device> V4l2Device::CreateEmulated ()
+{
+  return std::unique_ptr<V4l2Device> (new EmulatedV4l2Device);
+}
+
+#else // __linux__
+
+std::unique_ptr<V4l2Device> V4l2Device::CreateSystem ()
+{
+  return std::unique_ptr<V4l2Device> ();
+}
+
+std::unique_ptr<V4l2Device> V4l2Device::CreateEmulated ()
+{
+  return std::unique_ptr<V4l2Device> ();
+}
+
+#endif // __linux__
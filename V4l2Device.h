@@ -0,0 +1,69 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: V4l2Device.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: The system calls V4l2Camera makes on a video device node,
+// behind an interface so that the capture backend can run against
+// something other than a kernel driver.
+//
+// Two implementations are provided:
+//   V4l2Device::CreateSystem ()   - a /dev/video* node, through open(),
+//                                  ioctl(), mmap() and poll()
+//   V4l2Device::CreateEmulated () - an in-process stand-in for a capture
+//                                  driver, in the spirit of v4l2loopback.
+//                                  It implements the streaming I/O ioctls
+//                                  V4l2Camera uses, fills its buffers with
+//                                  a moving test pattern at the configured
+//                                  frame interval, and signals readiness
+//                                  through a pollable file descriptor.
+// A test double only needs to implement the six virtual functions.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef V4L2DEVICE_H
+#define V4L2DEVICE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class V4l2Device
+{
+public:
+  virtual ~V4l2Device () {}
+
+  virtual bool  Open   (const std::string& _path) = 0;
+  virtual void  Close  () = 0;
+  // as ioctl (2); returns -1 and sets errno on failure
+  virtual int   Ioctl  (unsigned long _request, void* _arg) = 0;
+  // as mmap (2) of a buffer offset reported by VIDIOC_QUERYBUF; nullptr on failure
+  virtual void* Map    (size_t _length, int64_t _offset) = 0;
+  virtual void  Unmap  (void* _address, size_t _length) = 0;
+  // a descriptor that polls readable when a buffer can be dequeued, or -1
+  virtual int   Fd     () const = 0;
+
+  // nullptr where V4L2 is not available
+  static std::unique_ptr<V4l2Device> CreateSystem   ();
+  static std::unique_ptr<V4l2Device> CreateEmulated ();
+};
+
+#endif // V4L2DEVICE_H
@@ -0,0 +1,245 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: VideoFeatures.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Luminance, motion and flow in regions of a camera's frames.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "VideoFeatures.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+#include "BCIEvent.h"
+#include "FrameScaler.h"
+
+// width of the gray image features are measured on
+#define FEATURE_WIDTH 80
+// states hold hundredths of gray levels and pixels
+#define FEATURE_SCALE 100
+// Gradient matrices with a smaller determinant, in squared gray levels per pixel of the
+//   region, are too poorly textured for the flow, which is reported as zero.
+#define FEATURE_MIN_TEXTURE 4
+
+const char* VideoFeatures::StateName (Feature _feature)
+{
+  switch (_feature)
+  {
+  case Luminance: return "WebcamLuminance";
+  case Motion:    return "WebcamMotion";
+  case Flow:      return "WebcamFlow";
+  default:        return "";
+  }
+}
+
+int VideoFeatures::StateBits (Feature)
+{
+  return 16;
+}
+
+std::string VideoFeatures::StateName (Feature _feature, int _camIndex, int _region)
+{
+  return StateName (_feature) + std::to_string (_camIndex) + "R" + std::to_string (_region);
+}
+
+bool VideoFeatures::ParseRegions (const std::string& _text, std::vector<cv::Rect>& _regions, std::string& _error)
+{
+  _regions.clear ();
+  if (_text.empty () || _text == "0")
+    return true;
+  if (_text == "*")
+  {
+    // an empty rectangle stands for the whole image
+    _regions.push_back (cv::Rect ());
+    return true;
+  }
+  std::istringstream iss (_text);
+  std::string        item;
+  while (std::getline (iss, item, ';'))
+  {
+    cv::Rect region;
+    if (!FrameScaler::ParseRect (item, region, _error) || region.empty ())
+    {
+      _error = "expected <x>,<y>,<width>,<height> regions separated by ;, e.g. 0,0,320,240;320,0,320,240";
+      return false;
+    }
+    _regions.push_back (region);
+  }
+  return true;
+}
+
+VideoFeatures::VideoFeatures () :
+  mFeatures   (0),
+  mPixelScale (1)
+{
+}
+
+void VideoFeatures::Configure (int _features, const std::vector<cv::Rect>& _regions, cv::Size _imageSize, int _camIndex)
+{
+  mFeatures = _features & AllFeatures;
+  mRegions.clear ();
+  mNames.clear ();
+  if (_imageSize.width < 1 || _imageSize.height < 1)
+    mFeatures = 0;
+  if (mFeatures == 0)
+    return;
+
+  int width   = std::min (FEATURE_WIDTH, _imageSize.width);
+  int height  = std::max (1, _imageSize.height * width / _imageSize.width);
+  mSmallSize  = cv::Size (width, height);
+  mPixelScale = static_cast<double> (_imageSize.width) / width;
+
+  // regions are mapped to the small image once; each keeps at least one pixel
+  cv::Rect whole (0, 0, _imageSize.width, _imageSize.height);
+  for (size_t r = 0; r < _regions.size (); r++)
+  {
+    cv::Rect region = _regions[r].empty () ? whole : _regions[r] & whole;
+    int x0 = std::min (width - 1,  region.x * width / _imageSize.width);
+    int y0 = std::min (height - 1, region.y * height / _imageSize.height);
+    int x1 = std::max (x0 + 1, (region.x + region.width) * width / _imageSize.width);
+    int y1 = std::max (y0 + 1, (region.y + region.height) * height / _imageSize.height);
+    mRegions.push_back (cv::Rect (x0, y0, x1 - x0, y1 - y0));
+  }
+  mValues.assign (mRegions.size () * 3, 0);
+  for (size_t r = 0; r < mRegions.size (); r++)
+    for (Feature feature : { Luminance, Motion, Flow })
+      mNames.push_back (StateName (feature, _camIndex, static_cast<int> (r)) + " ");
+  Reset ();
+}
+
+void VideoFeatures::Reset ()
+{
+  mPrevious.release ();
+  std::fill (mValues.begin (), mValues.end (), 0);
+}
+
+void VideoFeatures::Accumulate (const cv::Rect& _region, Sums& _sums) const
+{
+  _sums = Sums ();
+  bool motion = !mPrevious.empty () && (mFeatures & (Motion | Flow));
+  bool flow   = motion && (mFeatures & Flow);
+  for (int y = _region.y; y < _region.y + _region.height; y++)
+  {
+    // row sums stay in 32 bits, which keeps the inner loops vectorized
+    const uint8_t* cur  = mGray.ptr<uint8_t> (y) + _region.x;
+    int32_t        gray = 0;
+    for (int x = 0; x < _region.width; x++)
+      gray += cur[x];
+    _sums.gray   += gray;
+    _sums.pixels += _region.width;
+    if (!motion)
+      continue;
+
+    const uint8_t* prev       = mPrevious.ptr<uint8_t> (y) + _region.x;
+    int32_t        difference = 0;
+    for (int x = 0; x < _region.width; x++)
+      difference += std::abs (cur[x] - prev[x]);
+    _sums.difference += difference;
+    if (!flow || y == 0 || y == mGray.rows - 1)
+      continue;
+
+    // central differences, and twice the temporal one so that all three share a scale
+    const uint8_t* above = mGray.ptr<uint8_t> (y - 1) + _region.x;
+    const uint8_t* below = mGray.ptr<uint8_t> (y + 1) + _region.x;
+    int     first = _region.x == 0 ? 1 : 0;
+    int     last  = _region.x + _region.width == mGray.cols ? _region.width - 1 : _region.width;
+    int32_t xx = 0, xy = 0, yy = 0, xt = 0, yt = 0;
+    for (int x = first; x < last; x++)
+    {
+      int32_t ix = cur[x + 1] - cur[x - 1];
+      int32_t iy = below[x] - above[x];
+      int32_t it = 2 * (cur[x] - prev[x]);
+      xx += ix * ix;
+      xy += ix * iy;
+      yy += iy * iy;
+      xt += ix * it;
+      yt += iy * it;
+    }
+    _sums.xx += xx;
+    _sums.xy += xy;
+    _sums.yy += yy;
+    _sums.xt += xt;
+    _sums.yt += yt;
+  }
+}
+
+void VideoFeatures::Compute (const cv::Mat& _image)
+{
+  if (!Enabled () || _image.empty ())
+    return;
+
+  // shrink first, so that only the small image is converted to gray
+  cv::resize (_image, mSmall, mSmallSize, 0, 0, cv::INTER_AREA);
+  if (mSmall.channels () == 3)
+    cv::cvtColor (mSmall, mGray, cv::COLOR_BGR2GRAY);
+  else
+    mSmall.copyTo (mGray);
+  if (!mPrevious.empty () && mPrevious.size () != mGray.size ())
+    mPrevious.release ();
+
+  for (size_t r = 0; r < mRegions.size (); r++)
+  {
+    Sums sums;
+    Accumulate (mRegions[r], sums);
+    uint32_t* values = &mValues[3 * r];
+    values[0] = static_cast<uint32_t> (sums.gray * FEATURE_SCALE / sums.pixels);
+    values[1] = static_cast<uint32_t> (sums.difference * FEATURE_SCALE / sums.pixels);
+
+    // Ix u + Iy v = -It in the least squares sense over the region
+    double det  = static_cast<double> (sums.xx) * sums.yy - static_cast<double> (sums.xy) * sums.xy;
+    double norm = static_cast<double> (sums.pixels) * sums.pixels * 16 * FEATURE_MIN_TEXTURE * FEATURE_MIN_TEXTURE;
+    values[2] = 0;
+    if (!mPrevious.empty () && det > norm)
+    {
+      double u = (-static_cast<double> (sums.yy) * sums.xt + static_cast<double> (sums.xy) * sums.yt) / det;
+      double v = ( static_cast<double> (sums.xy) * sums.xt - static_cast<double> (sums.xx) * sums.yt) / det;
+      values[2] = static_cast<uint32_t> (std::sqrt (u * u + v * v) * mPixelScale * FEATURE_SCALE + 0.5);
+    }
+  }
+  std::swap (mGray, mPrevious);
+}
+
+uint32_t VideoFeatures::Value (Feature _feature, int _region) const
+{
+  int column = _feature == Luminance ? 0 : _feature == Motion ? 1 : 2;
+  return mValues[3 * _region + column];
+}
+
+void VideoFeatures::Publish () const
+{
+  // names and values share their layout, one column per feature bit
+  for (size_t r = 0; r < mRegions.size (); r++)
+  {
+    for (int column = 0; column < 3; column++)
+    {
+      if (!(mFeatures & (1 << column)))
+        continue;
+      Feature  feature = static_cast<Feature> (1 << column);
+      uint32_t value   = std::min<uint32_t> (mValues[3 * r + column], (1u << StateBits (feature)) - 1);
+      bcievent << mNames[3 * r + column] << value;
+    }
+  }
+}
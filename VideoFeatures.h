@@ -0,0 +1,109 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: VideoFeatures.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Simple features of a camera's frames, published as event
+// states so that experiments can use the video as a control signal. Each
+// frame is shrunk to a small gray image, and in each of the camera's
+// regions of interest the following are measured:
+//   luminance - mean gray level
+//   motion    - mean absolute difference in gray levels to the previous frame
+//   flow      - magnitude of the region's motion, found by solving the
+//               Lucas-Kanade equations over the whole region; coarse, and
+//               only meaningful for motions of a few pixels of the small image
+// The small image has a fixed size, so the cost per frame hardly depends on
+// the camera's resolution; one pass over its pixels accumulates all sums of
+// a region, in integer loops the compiler vectorizes.
+//
+// Event Variables (when enabled with VideoFeatures):
+//   WebcamLuminance<n>R<r> - luminance in region r of camera n, in hundredths
+//                            of a gray level
+//   WebcamMotion<n>R<r>    - motion, in hundredths of a gray level
+//   WebcamFlow<n>R<r>      - flow, in hundredths of a recorded pixel per frame
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef VIDEOFEATURES_H
+#define VIDEOFEATURES_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class VideoFeatures
+{
+public:
+  // bits of the VideoFeatures parameter
+  enum Feature
+  {
+    Luminance   = 1 << 0,
+    Motion      = 1 << 1,
+    Flow        = 1 << 2,
+    AllFeatures = (1 << 3) - 1,
+  };
+
+  // state name prefix and width of a feature; "<n>R<r>" is appended to the name
+  static const char* StateName (Feature _feature);
+  static int         StateBits (Feature _feature);
+  static std::string StateName (Feature _feature, int _camIndex, int _region);
+
+  // "<x>,<y>,<width>,<height>" in recorded pixels, several separated by ";"; "*" for the
+  //   whole image; empty or "0" for none
+  static bool ParseRegions (const std::string& _text, std::vector<cv::Rect>& _regions, std::string& _error);
+
+  VideoFeatures ();
+
+  // regions in pixels of images of _imageSize; _features 0 to compute nothing; _camIndex
+  //   names the states the features are published to
+  void Configure (int _features, const std::vector<cv::Rect>& _regions, cv::Size _imageSize, int _camIndex);
+  bool Enabled   () const { return mFeatures != 0 && !mRegions.empty (); }
+  // forget the previous frame
+  void Reset     ();
+
+  void Compute   (const cv::Mat& _image);
+  // emits the features of the last frame as events
+  void Publish   () const;
+
+  // in state units, for region _region
+  uint32_t Value (Feature _feature, int _region) const;
+
+private:
+  struct Sums
+  {
+    int64_t pixels, gray, difference;
+    int64_t xx, xy, yy, xt, yt;   // gradient products for the flow
+  };
+  void Accumulate (const cv::Rect& _region, Sums& _sums) const;
+
+  int                    mFeatures;
+  std::vector<cv::Rect>  mRegions;        // in pixels of the small image
+  double                 mPixelScale;     // recorded pixels per small image pixel
+  cv::Size               mSmallSize;
+
+  cv::Mat                mSmall;
+  cv::Mat                mGray;
+  cv::Mat                mPrevious;
+  std::vector<uint32_t>  mValues;         // per region: luminance, motion, flow
+  std::vector<std::string> mNames;        // per region and feature as in mValues: "<state name> "
+};
+
+#endif // VIDEOFEATURES_H
@@ -0,0 +1,450 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: VideoSink.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: The file an Mp4Muxer writes to, optionally through large
+// aligned buffers written by a thread of their own.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "VideoSink.h"
+#include "FileUtil.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+# include <io.h>
+# include <fcntl.h>
+# include <malloc.h>
+# include <sys/stat.h>
+#else
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+// block size that buffers, and their offsets in the file, are multiples of
+#define VIDEOSINK_ALIGNMENT 4096
+// buffers the writer can fill while the sink's thread writes
+#define VIDEOSINK_BUFFERS 4
+// longest the thread, or a writer waiting for a buffer, waits before checking again
+#define VIDEOSINK_WAIT_MS 100
+
+namespace
+{
+  int64_t SteadyNs ()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds> (
+             std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+  }
+
+  uint8_t* AllocateAligned (size_t _bytes)
+  {
+#ifdef _WIN32
+    return static_cast<uint8_t*> (::_aligned_malloc (_bytes, VIDEOSINK_ALIGNMENT));
+#else
+    void* p = nullptr;
+    return ::posix_memalign (&p, VIDEOSINK_ALIGNMENT, _bytes) == 0 ? static_cast<uint8_t*> (p) : nullptr;
+#endif
+  }
+
+  void FreeAligned (uint8_t* _p)
+  {
+#ifdef _WIN32
+    ::_aligned_free (_p);
+#else
+    ::free (_p);
+#endif
+  }
+
+  bool WriteAt (int _fd, const uint8_t* _data, size_t _bytes, uint64_t _offset)
+  {
+#ifdef _WIN32
+    if (::_lseeki64 (_fd, static_cast<__int64> (_offset), SEEK_SET) < 0)
+      return false;
+    while (_bytes > 0)
+    {
+      int n = ::_write (_fd, _data, static_cast<unsigned int> (std::min<size_t> (_bytes, 1 << 30)));
+      if (n <= 0)
+        return false;
+      _data  += n;
+      _bytes -= n;
+    }
+#else
+    while (_bytes > 0)
+    {
+      ssize_t n = ::pwrite (_fd, _data, _bytes, static_cast<off_t> (_offset));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      _data   += n;
+      _bytes  -= n;
+      _offset += n;
+    }
+#endif
+    return true;
+  }
+
+  bool SyncFile (int _fd)
+  {
+#if defined (_WIN32)
+    return ::_commit (_fd) == 0;
+#elif defined (__linux__)
+    return ::fdatasync (_fd) == 0;
+#else
+    return ::fsync (_fd) == 0;
+#endif
+  }
+
+  bool TruncateFile (int _fd, uint64_t _size)
+  {
+#ifdef _WIN32
+    return ::_chsize_s (_fd, static_cast<__int64> (_size)) == 0;
+#else
+    return ::ftruncate (_fd, static_cast<off_t> (_size)) == 0;
+#endif
+  }
+
+  void CloseFile (int _fd)
+  {
+#ifdef _WIN32
+    ::_close (_fd);
+#else
+    ::close (_fd);
+#endif
+  }
+}
+
+//==========================================================================================
+// VideoSink member function implementaion
+//==========================================================================================
+VideoSink::VideoSink () :
+  mStream   (nullptr),
+  mFd       (-1),
+  mDirect   (false),
+  mPosition (0),
+  mReserved (0),
+  mLastSyncNs (0),
+  mCurrent  (nullptr),
+  mWriting  (false),
+  mFailed   (false)
+{
+}
+
+VideoSink::~VideoSink ()
+{
+  Close ();
+  this->Terminate ();
+  mQueued.Set ();
+  this->TerminateAndWait ();
+}
+
+bool VideoSink::Open (const std::string& _file)
+{
+  Close ();
+  mPosition = 0;
+  mReserved = 0;
+  mFailed   = false;
+  mDirect   = false;
+  mLastSyncNs = SteadyNs ();
+  if (mOptions.bufferBytes == 0)
+  {
+    mStream = ::fopen (_file.c_str (), "wb");
+    return mStream != nullptr;
+  }
+
+#ifdef _WIN32
+  mFd = ::_open (_file.c_str (), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+  mFd = ::open (_file.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+  if (mFd < 0)
+    return false;
+  // where the file system does not take direct writes, they go through the cache
+  if (mOptions.direct)
+    SetDirect (true);
+
+  // whole blocks, so that every full buffer can be written directly
+  mOptions.bufferBytes = (mOptions.bufferBytes + VIDEOSINK_ALIGNMENT - 1) / VIDEOSINK_ALIGNMENT * VIDEOSINK_ALIGNMENT;
+  mBuffers.resize (VIDEOSINK_BUFFERS);
+  for (size_t i = 0; i < mBuffers.size (); i++)
+  {
+    mBuffers[i].data   = AllocateAligned (mOptions.bufferBytes);
+    mBuffers[i].used   = 0;
+    mBuffers[i].offset = 0;
+    if (!mBuffers[i].data)
+    {
+      Close ();
+      return false;
+    }
+    if (i > 0)
+      mFree.push_back (&mBuffers[i]);
+  }
+  mCurrent = &mBuffers[0];
+  this->StartIfNotRunning ();
+  return true;
+}
+
+bool VideoSink::Write (const void* _data, size_t _bytes)
+{
+  if (mStream)
+  {
+    if (_bytes > 0 && ::fwrite (_data, _bytes, 1, mStream) != 1)
+      return false;
+    mPosition += _bytes;
+    return true;
+  }
+  if (mFd < 0 || mFailed)
+    return false;
+
+  const uint8_t* p = static_cast<const uint8_t*> (_data);
+  while (_bytes > 0)
+  {
+    size_t n = std::min (_bytes, mOptions.bufferBytes - mCurrent->used);
+    ::memcpy (mCurrent->data + mCurrent->used, p, n);
+    mCurrent->used += n;
+    mPosition      += n;
+    p              += n;
+    _bytes         -= n;
+    if (mCurrent->used < mOptions.bufferBytes)
+      continue;
+
+    // hand the full buffer to the thread, and wait for an empty one if all are in flight
+    Buffer* next = nullptr;
+    mMutex.Acquire ();
+    mFull.push_back (mCurrent);
+    mMutex.Release ();
+    mQueued.Notify ();
+    while (!next && !mFailed)
+    {
+      mMutex.Acquire ();
+      if (!mFree.empty ())
+      {
+        next = mFree.back ();
+        mFree.pop_back ();
+      }
+      mMutex.Release ();
+      if (!next && !this->Running ())
+        WriteNext ();
+      else if (!next)
+        mWritten.WaitFor (VIDEOSINK_WAIT_MS, [this] () { return HasFree () || mFailed; });
+    }
+    if (!next)
+      return false;
+    next->used   = 0;
+    next->offset = mPosition;
+    mCurrent     = next;
+  }
+  return !mFailed;
+}
+
+bool VideoSink::Sync ()
+{
+  if (mStream)
+    return FlushToDisk (mStream);
+  if (mFd < 0)
+    return false;
+
+  // The partly filled buffer is written now, and again once it is full. Direct writes
+  //   must be whole blocks, so this one goes through the cache.
+  Drain ();
+  bool direct = mDirect;
+  if (direct)
+    SetDirect (false);
+  bool ok = !mFailed && (mCurrent->used == 0 || WriteAt (mFd, mCurrent->data, mCurrent->used, mCurrent->offset))
+         && SyncFile (mFd);
+  if (direct)
+    SetDirect (true);
+  mLastSyncNs = SteadyNs ();
+  return ok;
+}
+
+void VideoSink::Patch (uint64_t _offset, const void* _data, size_t _bytes)
+{
+  PatchData patch;
+  patch.offset = _offset;
+  patch.bytes.assign (static_cast<const uint8_t*> (_data), static_cast<const uint8_t*> (_data) + _bytes);
+  mPatches.push_back (patch);
+}
+
+bool VideoSink::Close ()
+{
+  bool ok = true;
+  if (mStream)
+  {
+    for (size_t i = 0; i < mPatches.size (); i++)
+      ok = ::fseek (mStream, static_cast<long> (mPatches[i].offset), SEEK_SET) == 0
+        && ::fwrite (mPatches[i].bytes.data (), mPatches[i].bytes.size (), 1, mStream) == 1 && ok;
+    ok = ::fclose (mStream) == 0 && ok;
+    mStream = nullptr;
+  }
+  else if (mFd >= 0)
+  {
+    Drain ();
+    if (mDirect)
+      SetDirect (false);
+    ok = !mFailed;
+    if (mCurrent && mCurrent->used > 0)
+      ok = WriteAt (mFd, mCurrent->data, mCurrent->used, mCurrent->offset) && ok;
+    for (size_t i = 0; i < mPatches.size (); i++)
+      ok = WriteAt (mFd, mPatches[i].bytes.data (), mPatches[i].bytes.size (), mPatches[i].offset) && ok;
+    // gives back the disk space reserved beyond the data
+    if (mReserved > mPosition)
+      TruncateFile (mFd, mPosition);
+    CloseFile (mFd);
+    mFd = -1;
+    FreeBuffers ();
+  }
+  mPatches.clear ();
+  return ok;
+}
+
+bool VideoSink::SetDirect (bool _direct)
+{
+#if defined (__linux__)
+  int flags = ::fcntl (mFd, F_GETFL);
+  if (flags < 0 || ::fcntl (mFd, F_SETFL, _direct ? flags | O_DIRECT : flags & ~O_DIRECT) < 0)
+    return false;
+#elif defined (__APPLE__)
+  if (::fcntl (mFd, F_NOCACHE, _direct ? 1 : 0) < 0)
+    return false;
+#else
+  if (_direct)
+    return false;
+#endif
+  mDirect = _direct;
+  return true;
+}
+
+bool VideoSink::WriteBuffer (const Buffer& _buffer, size_t _bytes)
+{
+#ifdef __linux__
+  // reserve the next stretch of disk ahead of the data, without changing the file's size
+  uint64_t end = _buffer.offset + _bytes;
+  if (mOptions.reserveBytes > 0 && end > mReserved)
+  {
+    uint64_t reserve = end - mReserved + mOptions.reserveBytes;
+    ::fallocate (mFd, FALLOC_FL_KEEP_SIZE, static_cast<off_t> (mReserved), static_cast<off_t> (reserve));
+    mReserved += reserve;
+  }
+#endif
+  bool ok = WriteAt (mFd, _buffer.data, _bytes, _buffer.offset);
+  if (!ok && mDirect && errno == EINVAL)
+  {
+    // the file system took the flag, but not the write
+    SetDirect (false);
+    ok = WriteAt (mFd, _buffer.data, _bytes, _buffer.offset);
+  }
+
+  int64_t now = SteadyNs ();
+  if (ok && mOptions.syncNs > 0 && now - mLastSyncNs >= mOptions.syncNs)
+  {
+    ok = SyncFile (mFd);
+    mLastSyncNs = now;
+  }
+  return ok;
+}
+
+bool VideoSink::WriteNext ()
+{
+  mMutex.Acquire ();
+  Buffer* buffer = nullptr;
+  if (!mFull.empty () && !mWriting)
+  {
+    buffer = mFull.front ();
+    mFull.pop_front ();
+    mWriting = true;
+  }
+  mMutex.Release ();
+  if (!buffer)
+    return false;
+
+  // after a failure, buffers only go back so that the writer does not wait for them
+  if (!mFailed && !WriteBuffer (*buffer, buffer->used))
+    mFailed = true;
+  mMutex.Acquire ();
+  mFree.push_back (buffer);
+  mWriting = false;
+  mMutex.Release ();
+  mWritten.Notify ();
+  return true;
+}
+
+bool VideoSink::HasFull ()
+{
+  mMutex.Acquire ();
+  bool full = !mFull.empty ();
+  mMutex.Release ();
+  return full;
+}
+
+bool VideoSink::HasFree ()
+{
+  mMutex.Acquire ();
+  bool free = !mFree.empty ();
+  mMutex.Release ();
+  return free;
+}
+
+bool VideoSink::Idle ()
+{
+  mMutex.Acquire ();
+  bool idle = mFull.empty () && !mWriting;
+  mMutex.Release ();
+  return idle;
+}
+
+void VideoSink::Drain ()
+{
+  while (!Idle ())
+  {
+    if (this->Running ())
+      mWritten.WaitFor (VIDEOSINK_WAIT_MS, [this] () { return Idle (); });
+    else
+      WriteNext ();
+  }
+}
+
+void VideoSink::FreeBuffers ()
+{
+  mMutex.Acquire ();
+  for (size_t i = 0; i < mBuffers.size (); i++)
+    FreeAligned (mBuffers[i].data);
+  mBuffers.clear ();
+  mFull.clear ();
+  mFree.clear ();
+  mCurrent = nullptr;
+  mMutex.Release ();
+}
+
+int VideoSink::OnExecute ()
+{
+  while (!this->Terminating ())
+  {
+    if (!WriteNext ())
+      mQueued.WaitFor (VIDEOSINK_WAIT_MS, [this] () { return HasFull (); });
+  }
+  return 0;
+}
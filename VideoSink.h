@@ -0,0 +1,138 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: VideoSink.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: The file an Mp4Muxer writes to. By default this is an
+// ordinary buffered C library stream. With a buffer size set, data are
+// collected in large buffers aligned to the disk's block size, which a
+// thread of the sink writes out while the next one fills, so that the
+// writer never waits for the disk unless all buffers are in flight. The
+// buffers can bypass the operating system's page cache (O_DIRECT on Linux,
+// F_NOCACHE on macOS), so that video does not crowd out other writes such
+// as the BCI2000 data file; where the file system refuses, the sink falls
+// back to cached writes. It can further flush the file to disk at a fixed
+// interval, and reserve disk space ahead of the data (Linux only) so that
+// the file does not fragment while it grows.
+//
+// Data are only appended; the few bytes written back into the file's
+// beginning are applied by Patch () when the file is closed.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef VIDEOSINK_H
+#define VIDEOSINK_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "Thread.h"
+#include "Mutex.h"
+#include "WakeSignal.h"
+
+struct VideoIoOptions
+{
+  VideoIoOptions () : bufferBytes (0), direct (false), syncNs (0), reserveBytes (0) {}
+
+  size_t   bufferBytes;    // 0 for an ordinary buffered stream
+  bool     direct;         // bypass the page cache where possible
+  int64_t  syncNs;         // interval of flushes to disk, 0 for only those that are asked for
+  uint64_t reserveBytes;   // disk space allocated ahead of the data, 0 for none
+};
+
+class VideoSink : public Thread
+{
+public:
+  VideoSink  ();
+  ~VideoSink ();
+
+  // takes effect at Open ()
+  void     SetOptions (const VideoIoOptions& _options) { mOptions = _options; }
+
+  bool     Open     (const std::string& _file);
+  // appends; false once a write has failed
+  bool     Write    (const void* _data, size_t _bytes);
+  // data written so far are on disk when it returns
+  bool     Sync     ();
+  // replaces bytes at _offset when the file is closed
+  void     Patch    (uint64_t _offset, const void* _data, size_t _bytes);
+  // writes what is left and closes the file; false if any of it failed
+  bool     Close    ();
+  bool     IsOpen   () const { return mStream != nullptr || mFd >= 0; }
+  uint64_t Position () const { return mPosition; }
+  // buffers actually bypass the page cache
+  bool     Direct   () const { return mDirect; }
+
+  int      OnExecute () override;
+
+private:
+  VideoSink (const VideoSink&);
+  VideoSink& operator= (const VideoSink&);
+
+  struct Buffer
+  {
+    uint8_t* data;
+    size_t   used;
+    uint64_t offset;   // in the file
+  };
+  struct PatchData
+  {
+    uint64_t             offset;
+    std::vector<uint8_t> bytes;
+  };
+
+  // called from the sink's thread, or from the writer while the thread is idle
+  bool     WriteBuffer (const Buffer& _buffer, size_t _bytes);
+  // writes the oldest full buffer; false if there is none
+  bool     WriteNext   ();
+  bool     SetDirect   (bool _direct);
+  // waits for the thread to write all full buffers
+  void     Drain       ();
+  void     FreeBuffers ();
+  bool     HasFull     ();
+  bool     HasFree     ();
+  bool     Idle        ();
+
+  VideoIoOptions           mOptions;
+  std::FILE*               mStream;      // without buffers
+  int                      mFd;          // with buffers
+  std::atomic<bool>        mDirect;
+  uint64_t                 mPosition;
+  uint64_t                 mReserved;    // end of the allocated disk space
+  std::atomic<int64_t>     mLastSyncNs;  // on the steady clock; set by the writer and the thread
+  std::vector<PatchData>   mPatches;
+
+  Tiny::Mutex              mMutex;
+  std::vector<Buffer>      mBuffers;
+  std::deque<Buffer*>      mFull;        // waiting for the thread, in file order
+  std::vector<Buffer*>     mFree;
+  Buffer*                  mCurrent;     // being filled by the writer
+  bool                     mWriting;     // the thread is writing a buffer
+  std::atomic<bool>        mFailed;
+  WakeSignal               mQueued;      // a full buffer is waiting for the thread
+  WakeSignal               mWritten;     // the thread gave a buffer back
+};
+
+#endif // VIDEOSINK_H
@@ -0,0 +1,356 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: VirtualCamera.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A cv::VideoCapture that stands in for a physical webcam by
+// replaying a video file or generating a test pattern.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "VirtualCamera.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+#define VIRTUAL_DEFAULT_FPS    30
+#define VIRTUAL_DEFAULT_WIDTH  640
+#define VIRTUAL_DEFAULT_HEIGHT 480
+
+// pixels the gradient moves per frame
+#define GRADIENT_STEP          4
+// distinct noise frames that are cycled through
+#define NOISE_FRAMES           4
+
+namespace
+{
+  struct SourceSpec
+  {
+    VirtualCamera::Kind kind;
+    std::string         path;
+    double              fps;
+    int                 type;
+  };
+
+  bool ParseSpec (const std::string& _source, SourceSpec& _spec, std::string& _error)
+  {
+    _spec.kind = VirtualCamera::Gradient;
+    _spec.fps  = 0;
+    _spec.type = CV_8UC3;
+
+    size_t colon = _source.find (':');
+    if (colon == std::string::npos)
+    {
+      _error = "expected pattern:<kind> or file:<path>";
+      return false;
+    }
+    std::string scheme = _source.substr (0, colon);
+
+    // split off trailing key=value options; a file path may itself contain commas
+    std::vector<std::string> tokens;
+    size_t start = colon + 1;
+    for (;;)
+    {
+      size_t comma = _source.find (',', start);
+      tokens.push_back (_source.substr (start, comma - start));
+      if (comma == std::string::npos)
+        break;
+      start = comma + 1;
+    }
+    while (tokens.size () > 1)
+    {
+      const std::string& option = tokens.back ();
+      if (option.compare (0, 4, "fps=") == 0)
+      {
+        _spec.fps = ::atof (option.c_str () + 4);
+        if (_spec.fps <= 0)
+        {
+          _error = "fps must be greater than zero";
+          return false;
+        }
+      }
+      else if (option == "format=BGR")
+        _spec.type = CV_8UC3;
+      else if (option == "format=GRAY")
+        _spec.type = CV_8UC1;
+      else if (option.compare (0, 7, "format=") == 0)
+      {
+        _error = "format must be BGR or GRAY";
+        return false;
+      }
+      else
+        break;
+      tokens.pop_back ();
+    }
+    std::string body = tokens[0];
+    for (size_t i = 1; i < tokens.size (); i++)
+      body += "," + tokens[i];
+
+    if (scheme == "file")
+    {
+      _spec.kind = VirtualCamera::File;
+      _spec.path = body;
+      if (body.empty ())
+      {
+        _error = "no file given";
+        return false;
+      }
+    }
+    else if (scheme == "pattern")
+    {
+      if      (body == "gradient") _spec.kind = VirtualCamera::Gradient;
+      else if (body == "noise")    _spec.kind = VirtualCamera::Noise;
+      else if (body == "counter")  _spec.kind = VirtualCamera::Counter;
+      else
+      {
+        _error = "unknown pattern \"" + body + "\", expected gradient, noise or counter";
+        return false;
+      }
+    }
+    else
+    {
+      _error = "unknown source type \"" + scheme + "\"";
+      return false;
+    }
+    return true;
+  }
+}
+
+bool VirtualCamera::IsVirtual (const std::string& _source)
+{
+  return _source.compare (0, 8, "pattern:") == 0 || _source.compare (0, 5, "file:") == 0;
+}
+
+bool VirtualCamera::Parse (const std::string& _source, std::string& _error)
+{
+  SourceSpec spec;
+  return ParseSpec (_source, spec, _error);
+}
+
+VirtualCamera::VirtualCamera (const std::string& _source) :
+  mSource   (_source),
+  mKind     (Gradient),
+  mFps      (0),
+  mType     (CV_8UC3),
+  mSize     (VIRTUAL_DEFAULT_WIDTH, VIRTUAL_DEFAULT_HEIGHT),
+  mFourcc   (0),
+  mOpened   (false),
+  mFrameNum (0)
+{
+}
+
+VirtualCamera::~VirtualCamera ()
+{
+  release ();
+}
+
+bool VirtualCamera::open (int, int)
+{
+  release ();
+
+  SourceSpec  spec;
+  std::string error;
+  if (!ParseSpec (mSource, spec, error))
+    return false;
+  mKind = spec.kind;
+  mPath = spec.path;
+  mType = spec.type;
+  mFps  = spec.fps;
+
+  if (mKind == File)
+  {
+    if (!mFile.open (mPath))
+      return false;
+    if (mFps <= 0)
+      mFps = mFile.get (cv::CAP_PROP_FPS);
+    mSize = cv::Size ((int)mFile.get (cv::CAP_PROP_FRAME_WIDTH), (int)mFile.get (cv::CAP_PROP_FRAME_HEIGHT));
+  }
+  if (!(mFps > 0))
+    mFps = VIRTUAL_DEFAULT_FPS;
+
+  mOpened    = true;
+  mFrameNum  = 0;
+  mStart     = Clock::now ();
+  mNextFrame = mStart;
+  Prepare ();
+  return true;
+}
+
+void VirtualCamera::release ()
+{
+  mOpened = false;
+  mFile.release ();
+  mPatterns.clear ();
+}
+
+void VirtualCamera::Prepare ()
+{
+  // everything expensive about a pattern is done here, once per size change
+  mPatterns.clear ();
+  if (!mOpened || mSize.width < 1 || mSize.height < 1)
+    return;
+
+  switch (mKind)
+  {
+  case Gradient:
+  {
+    // twice as wide as the frame, so each frame is a moving window into it
+    cv::Mat gradient (mSize.height, 2 * mSize.width, CV_8UC3);
+    for (int y = 0; y < gradient.rows; y++)
+    {
+      uchar* row = gradient.ptr<uchar> (y);
+      for (int x = 0; x < gradient.cols; x++)
+      {
+        row[3 * x + 0] = cv::saturate_cast<uchar> ((x * 256.0) / mSize.width);
+        row[3 * x + 1] = cv::saturate_cast<uchar> ((y * 256.0) / mSize.height);
+        row[3 * x + 2] = (uchar)(row[3 * x + 0] ^ row[3 * x + 1]);
+      }
+    }
+    if (mType == CV_8UC1)
+      cv::cvtColor (gradient, gradient, cv::COLOR_BGR2GRAY);
+    mPatterns.push_back (gradient);
+    break;
+  }
+  case Noise:
+    for (int i = 0; i < NOISE_FRAMES; i++)
+    {
+      cv::Mat noise (mSize, mType);
+      cv::randu (noise, cv::Scalar::all (0), cv::Scalar::all (256));
+      mPatterns.push_back (noise);
+    }
+    break;
+  case Counter:
+    mPatterns.push_back (cv::Mat (mSize, mType, cv::Scalar::all (0)));
+    break;
+  case File:
+    break;
+  }
+}
+
+bool VirtualCamera::grab ()
+{
+  if (!mOpened)
+    return false;
+
+  // block until the next frame is due, like a device would
+  Clock::duration period = std::chrono::duration_cast<Clock::duration> (std::chrono::duration<double> (1.0 / mFps));
+  Clock::time_point now  = Clock::now ();
+  if (mNextFrame > now)
+    std::this_thread::sleep_until (mNextFrame);
+  mNextFrame += period;
+  if (mNextFrame + period < now)
+    mNextFrame = now + period;   // the reader fell behind; a camera would have dropped frames
+
+  if (mKind == File)
+  {
+    if (!mFile.read (mFileFrame))
+    {
+      // loop back to the start of the file
+      mFile.set (cv::CAP_PROP_POS_FRAMES, 0);
+      if (!mFile.read (mFileFrame))
+        return false;
+    }
+  }
+  mFrameNum++;
+  return true;
+}
+
+bool VirtualCamera::retrieve (cv::OutputArray _image, int)
+{
+  if (!mOpened || mFrameNum == 0)
+    return false;
+
+  switch (mKind)
+  {
+  case Gradient:
+  {
+    int offset = (int)((mFrameNum * GRADIENT_STEP) % mSize.width);
+    mPatterns[0] (cv::Rect (offset, 0, mSize.width, mSize.height)).copyTo (_image);
+    break;
+  }
+  case Noise:
+    mPatterns[mFrameNum % mPatterns.size ()].copyTo (_image);
+    break;
+  case Counter:
+    mPatterns[0].copyTo (_image);
+    break;
+  case File:
+  {
+    const cv::Mat* frame = &mFileFrame;
+    if (mFileFrame.size () != mSize)
+    {
+      cv::resize (mFileFrame, mScaledFrame, mSize, 0, 0, cv::INTER_AREA);
+      frame = &mScaledFrame;
+    }
+    if (mType == CV_8UC1 && frame->channels () != 1)
+      cv::cvtColor (*frame, _image, cv::COLOR_BGR2GRAY);
+    else
+      frame->copyTo (_image);
+    return true;
+  }
+  }
+
+  // burn in the frame number so dropped or repeated frames are visible in the recording
+  cv::Mat image = _image.getMat ();
+  cv::putText (image, std::to_string (mFrameNum), cv::Point (10, mSize.height - 20),
+               cv::FONT_HERSHEY_SIMPLEX, 2.0, cv::Scalar::all (255), 3);
+  return true;
+}
+
+bool VirtualCamera::set (int _propId, double _value)
+{
+  switch (_propId)
+  {
+  case cv::CAP_PROP_FRAME_WIDTH:
+    if (_value >= 1) mSize.width = (int)_value;
+    break;
+  case cv::CAP_PROP_FRAME_HEIGHT:
+    if (_value >= 1) mSize.height = (int)_value;
+    break;
+  case cv::CAP_PROP_FPS:
+    if (_value > 0) mFps = _value;
+    return true;
+  case cv::CAP_PROP_FOURCC:
+    // there is no wire format to negotiate; report back what was asked for
+    mFourcc = _value;
+    return true;
+  default:
+    return false;
+  }
+  Prepare ();
+  return true;
+}
+
+double VirtualCamera::get (int _propId) const
+{
+  switch (_propId)
+  {
+  case cv::CAP_PROP_FRAME_WIDTH:  return mSize.width;
+  case cv::CAP_PROP_FRAME_HEIGHT: return mSize.height;
+  case cv::CAP_PROP_FPS:          return mFps;
+  case cv::CAP_PROP_FOURCC:       return mFourcc;
+  case cv::CAP_PROP_POS_FRAMES:   return (double)mFrameNum;
+  case cv::CAP_PROP_POS_MSEC:     return mFrameNum > 0 ? (mFrameNum - 1) * 1000.0 / mFps : 0;
+  case cv::CAP_PROP_FORMAT:       return mType;
+  default:                        return 0;
+  }
+}
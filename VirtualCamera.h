@@ -0,0 +1,102 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: VirtualCamera.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A cv::VideoCapture that stands in for a physical webcam, so
+// the capture/overlay/encode pipeline can be exercised on machines without
+// cameras. It either replays a video file or generates a test pattern, and
+// delivers frames at a fixed rate, blocking in grab () like a real device.
+//
+// A virtual camera is selected with the Source row of the Connections
+// parameter:
+//   pattern:<kind>[,fps=<rate>][,format=<BGR|GRAY>]
+//       kind is gradient (moving gradient), noise or counter (frame number
+//       only). The frame number is burned into every pattern.
+//   file:<path>[,fps=<rate>]
+//       replays the file in a loop, at its own frame rate unless given.
+// Width and Height come from the Connections parameter as for a camera.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef VIRTUALCAMERA_H
+#define VIRTUALCAMERA_H
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <string>
+#include <vector>
+
+class VirtualCamera : public cv::VideoCapture
+{
+public:
+  enum Kind
+  {
+    Gradient,
+    Noise,
+    Counter,
+    File,
+  };
+
+  // true if _source names a virtual camera rather than a device
+  static bool IsVirtual (const std::string& _source);
+  // checks the syntax of a source string; _error describes the problem
+  static bool Parse     (const std::string& _source, std::string& _error);
+
+  explicit VirtualCamera (const std::string& _source);
+  ~VirtualCamera ();
+
+  // opens the source given to the constructor; the index is ignored
+  bool   open      (int _index, int _apiPreference = cv::CAP_ANY) override;
+  bool   isOpened  () const override { return mOpened; }
+  void   release   () override;
+  bool   grab      () override;
+  bool   retrieve  (cv::OutputArray _image, int _flag = 0) override;
+  bool   set       (int _propId, double _value) override;
+  double get       (int _propId) const override;
+
+  // when the next grab () will return without waiting
+  std::chrono::steady_clock::time_point NextFrameTime () const { return mNextFrame; }
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  void   Prepare   ();
+
+  std::string       mSource;
+  Kind              mKind;
+  std::string       mPath;
+  double            mFps;
+  int               mType;
+  cv::Size          mSize;
+  double            mFourcc;
+  bool              mOpened;
+
+  cv::VideoCapture  mFile;
+  cv::Mat           mFileFrame;
+  cv::Mat           mScaledFrame;
+
+  std::vector<cv::Mat> mPatterns;   // precomputed frames the pattern is cut from
+  unsigned long     mFrameNum;
+  Clock::time_point mStart;
+  Clock::time_point mNextFrame;
+};
+
+#endif // VIRTUALCAMERA_H
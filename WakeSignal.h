@@ -0,0 +1,99 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: WakeSignal.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Lets a pipeline thread sleep until another thread has work
+// for it, instead of polling. The waiting thread passes a condition to
+// Wait (); the other thread changes what the condition looks at, then calls
+// Notify (). While no thread waits, Notify () costs a fence and a load, so
+// producers can call it for every frame.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef WAKESIGNAL_H
+#define WAKESIGNAL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+class WakeSignal
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  WakeSignal () : mWaiters (0), mSignaled (false) {}
+
+  // the condition of a waiting thread may have changed
+  void Notify ()
+  {
+    // pairs with the fence in WaitUntil (): either the waiter sees the change, or we see the waiter
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (mWaiters.load (std::memory_order_relaxed) == 0)
+      return;
+    std::lock_guard<std::mutex> lock (mMutex);
+    mCondition.notify_all ();
+  }
+
+  // wakes a waiting thread whatever its condition, or makes its next wait return at once
+  void Set ()
+  {
+    std::lock_guard<std::mutex> lock (mMutex);
+    mSignaled = true;
+    mCondition.notify_all ();
+  }
+
+  // returns true once _ready () is, or Set () was called; false at _deadline
+  template<class Ready>
+  bool WaitUntil (Clock::time_point _deadline, Ready _ready)
+  {
+    std::unique_lock<std::mutex> lock (mMutex);
+    mWaiters.fetch_add (1, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    auto woken = [this, &_ready] () { return mSignaled || _ready (); };
+    bool result = true;
+    if (_deadline == Clock::time_point::max ())
+      mCondition.wait (lock, woken);
+    else
+      result = mCondition.wait_until (lock, _deadline, woken);
+    mWaiters.fetch_sub (1, std::memory_order_relaxed);
+    mSignaled = false;
+    return result;
+  }
+
+  template<class Ready>
+  bool WaitFor (int _timeoutMs, Ready _ready)
+  {
+    return WaitUntil (Clock::now () + std::chrono::milliseconds (_timeoutMs), _ready);
+  }
+
+private:
+  WakeSignal (const WakeSignal&);
+  WakeSignal& operator= (const WakeSignal&);
+
+  std::mutex              mMutex;
+  std::condition_variable mCondition;
+  std::atomic<int>        mWaiters;
+  bool                    mSignaled;
+};
+
+#endif // WAKESIGNAL_H
@@ -0,0 +1,382 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: WebcamBenchmark.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: Headless benchmark of the WebcamLogger capture/encode
+// pipeline. It records from virtual pattern cameras through WebcamThread,
+// without a running BCI2000 system, for every combination of the swept
+// settings and prints one JSON object per configuration:
+//
+//   WebcamBenchmark [--cameras=1,2,4] [--resolutions=640x480,1920x1080]
+//                   [--fourcc=MJPG,H264] [--decimation=1,2] [--overlay=0,1]
+//                   [--chunkframes=0,30] [--encoders=0] [--recordsize=0,640x480]
+//                   [--fps=30] [--pattern=gradient] [--duration=10]
+//                   [--dir=.] [--out=results.jsonl]
+//
+// Reported per configuration: achieved and expected frame rate, frames
+// written and dropped, capture-to-disk latency percentiles taken from the
+// FrameIndex sidecars, process CPU time per written frame and the peak growth
+// of the resident set over its size before the configuration's cameras were
+// created.
+// With --chunkframes, each camera is encoded in chunks of that many frames
+// on a shared pool of --encoders threads (0 for one per core). With
+// --recordsize, frames are resized to that size before they are encoded.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "WebcamThread.h"
+#include "FrameIndex.h"
+#include "EncoderPool.h"
+#include "FrameEvents.h"
+#include "FrameScaler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+# include <windows.h>
+# include <psapi.h>
+#else
+# include <sys/resource.h>
+# include <unistd.h>
+# ifdef __APPLE__
+#  include <mach/mach.h>
+# endif
+#endif
+
+// interval at which the resident set is sampled during a configuration
+#define RSS_SAMPLE_MS 100
+
+namespace
+{
+  struct Options
+  {
+    std::vector<int>         cameras;
+    std::vector<cv::Size>    resolutions;
+    std::vector<std::string> fourccs;
+    std::vector<int>         decimations;
+    std::vector<int>         overlays;
+    std::vector<int>         chunkFrames;
+    std::vector<cv::Size>    recordSizes;
+    int                      encoders;
+    double                   fps;
+    std::string              pattern;
+    double                   duration;
+    std::string              dir;
+    std::string              out;
+  };
+
+  struct Usage
+  {
+    double cpuSeconds;
+    double rssMb;       // current resident set, not the high-water mark of the process
+  };
+
+  std::vector<std::string> Split (const std::string& _list)
+  {
+    std::vector<std::string> items;
+    std::istringstream iss (_list);
+    std::string item;
+    while (std::getline (iss, item, ','))
+      if (!item.empty ())
+        items.push_back (item);
+    return items;
+  }
+
+  std::vector<int> SplitInts (const std::string& _list)
+  {
+    std::vector<int> values;
+    std::vector<std::string> items = Split (_list);
+    for (size_t i = 0; i < items.size (); i++)
+      values.push_back (::atoi (items[i].c_str ()));
+    return values;
+  }
+
+  bool ParseOptions (int _argc, char** _argv, Options& _options)
+  {
+    _options.cameras     = SplitInts ("1,2,4");
+    _options.resolutions = { cv::Size (640, 480), cv::Size (1920, 1080) };
+    _options.fourccs     = Split ("MJPG,H264");
+    _options.decimations = SplitInts ("1");
+    _options.overlays    = SplitInts ("0,1");
+    _options.chunkFrames = SplitInts ("0");
+    _options.encoders    = 0;
+    _options.recordSizes = { cv::Size () };
+    _options.fps         = 30;
+    _options.pattern     = "gradient";
+    _options.duration    = 10;
+    _options.dir         = ".";
+
+    for (int i = 1; i < _argc; i++)
+    {
+      std::string arg   = _argv[i];
+      size_t      eq    = arg.find ('=');
+      std::string key   = arg.substr (0, eq);
+      std::string value = eq == std::string::npos ? "" : arg.substr (eq + 1);
+
+      if      (key == "--cameras")    _options.cameras     = SplitInts (value);
+      else if (key == "--fourcc")     _options.fourccs     = Split (value);
+      else if (key == "--decimation") _options.decimations = SplitInts (value);
+      else if (key == "--overlay")    _options.overlays    = SplitInts (value);
+      else if (key == "--chunkframes") _options.chunkFrames = SplitInts (value);
+      else if (key == "--encoders")   _options.encoders    = ::atoi (value.c_str ());
+      else if (key == "--fps")        _options.fps         = ::atof (value.c_str ());
+      else if (key == "--pattern")    _options.pattern     = value;
+      else if (key == "--duration")   _options.duration    = ::atof (value.c_str ());
+      else if (key == "--dir")        _options.dir         = value;
+      else if (key == "--out")        _options.out         = value;
+      else if (key == "--recordsize")
+      {
+        _options.recordSizes.clear ();
+        std::vector<std::string> items = Split (value);
+        for (size_t r = 0; r < items.size (); r++)
+        {
+          cv::Size    size;
+          std::string error;
+          if (!FrameScaler::ParseSize (items[r], size, error))
+          {
+            std::cerr << "Invalid record size " << items[r] << ": " << error << std::endl;
+            return false;
+          }
+          _options.recordSizes.push_back (size);
+        }
+      }
+      else if (key == "--resolutions")
+      {
+        _options.resolutions.clear ();
+        std::vector<std::string> items = Split (value);
+        for (size_t r = 0; r < items.size (); r++)
+        {
+          int w = 0, h = 0;
+          if (::sscanf (items[r].c_str (), "%dx%d", &w, &h) != 2 || w < 1 || h < 1)
+          {
+            std::cerr << "Invalid resolution " << items[r] << std::endl;
+            return false;
+          }
+          _options.resolutions.push_back (cv::Size (w, h));
+        }
+      }
+      else
+      {
+        std::cerr << "Unknown option " << arg << std::endl;
+        return false;
+      }
+    }
+    return _options.fps > 0 && _options.duration > 0;
+  }
+
+  Usage ProcessUsage ()
+  {
+    Usage usage = { 0, 0 };
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (::GetProcessTimes (::GetCurrentProcess (), &created, &exited, &kernel, &user))
+    {
+      ULARGE_INTEGER k, u;
+      k.LowPart = kernel.dwLowDateTime; k.HighPart = kernel.dwHighDateTime;
+      u.LowPart = user.dwLowDateTime;   u.HighPart = user.dwHighDateTime;
+      usage.cpuSeconds = (k.QuadPart + u.QuadPart) * 1e-7;
+    }
+    PROCESS_MEMORY_COUNTERS memory;
+    if (::GetProcessMemoryInfo (::GetCurrentProcess (), &memory, sizeof (memory)))
+      usage.rssMb = memory.WorkingSetSize / (1024.0 * 1024.0);
+#else
+    struct rusage ru;
+    if (::getrusage (RUSAGE_SELF, &ru) == 0)
+      usage.cpuSeconds = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+                       + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+# ifdef __APPLE__
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t      count = MACH_TASK_BASIC_INFO_COUNT;
+    if (::task_info (::mach_task_self (), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+      usage.rssMb = info.resident_size / (1024.0 * 1024.0);
+# else
+    // second field of statm is the resident set in pages
+    std::ifstream statm ("/proc/self/statm");
+    unsigned long size = 0, resident = 0;
+    if (statm >> size >> resident)
+      usage.rssMb = resident * (double)::sysconf (_SC_PAGESIZE) / (1024.0 * 1024.0);
+# endif
+#endif
+    return usage;
+  }
+
+  double Percentile (std::vector<double>& _sorted, double _p)
+  {
+    if (_sorted.empty ())
+      return 0;
+    size_t i = static_cast<size_t> (_p * (_sorted.size () - 1) + 0.5);
+    return _sorted[std::min (i, _sorted.size () - 1)];
+  }
+
+  std::string RunConfiguration (const Options& _options, int _cameras, cv::Size _size,
+                                const std::string& _fourcc, int _decimation, int _overlay, int _chunkFrames,
+                                cv::Size _recordSize)
+  {
+    std::ostringstream prefix;
+    prefix << _options.dir << "/bench_" << _cameras << "x" << _size.width << "x" << _size.height
+           << "_" << _fourcc << "_d" << _decimation << "_o" << _overlay << "_g" << _chunkFrames
+           << "_r" << _recordSize.width << "x" << _recordSize.height;
+
+    std::ostringstream source;
+    source << "pattern:" << _options.pattern << ",fps=" << _options.fps;
+
+    // memory is measured against what the process holds before this configuration's cameras exist
+    double baselineRssMb = ProcessUsage ().rssMb;
+    double peakRssMb     = baselineRssMb;
+
+    std::vector<WebcamThread*> cameras;
+    for (int i = 0; i < _cameras; i++)
+    {
+      WebcamThread* camera = new WebcamThread (i, _size.width, _size.height, _decimation,
+                                               false, _overlay ? 2 : 0, false, _fourcc, 8, 0);
+      camera->SetSource (source.str ());
+      camera->SetFpsMeasureFrames (0);
+      camera->SetEncodeChunkFrames (_chunkFrames);
+      camera->SetRecordRegion (cv::Rect (), _recordSize);
+      if (camera->Initalize ())
+        cameras.push_back (camera);
+      else
+        delete camera;
+    }
+
+    Usage before = ProcessUsage ();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now ();
+    for (size_t i = 0; i < cameras.size (); i++)
+      cameras[i]->StartRecording (prefix.str ());
+
+    // the resident set is sampled while recording, as it shrinks again once buffers are released
+    std::chrono::steady_clock::time_point stop = start + std::chrono::duration_cast<std::chrono::steady_clock::duration> (
+                                                   std::chrono::duration<double> (_options.duration));
+    while (std::chrono::steady_clock::now () < stop)
+    {
+      std::this_thread::sleep_for (std::min<std::chrono::steady_clock::duration> (
+        std::chrono::milliseconds (RSS_SAMPLE_MS), stop - std::chrono::steady_clock::now ()));
+      peakRssMb = std::max (peakRssMb, ProcessUsage ().rssMb);
+    }
+
+    for (size_t i = 0; i < cameras.size (); i++)
+      cameras[i]->StopRecording ();
+    double elapsed = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+    Usage after = ProcessUsage ();
+    peakRssMb = std::max (peakRssMb, after.rssMb);
+
+    unsigned long written = 0, dropped = 0, poolMisses = 0;
+    for (size_t i = 0; i < cameras.size (); i++)
+    {
+      written    += cameras[i]->Writer ().FramesWritten ();
+      dropped    += (unsigned long)cameras[i]->Writer ().GetQueue ().Dropped ();
+      poolMisses += (unsigned long)cameras[i]->Pool ().Misses ();
+      cameras[i]->StopStream ();
+      delete cameras[i];
+    }
+
+    // capture-to-disk latency and achieved rate, from the sidecar indices
+    std::vector<double> latencyMs;
+    double achievedFps = 0;
+    for (int i = 0; i < _cameras; i++)
+    {
+      FrameIndexReader index;
+      if (!index.Open (prefix.str () + "_" + std::to_string (i) + "_vid.frameidx"))
+        continue;
+      for (size_t r = 0; r < index.Count (); r++)
+        latencyMs.push_back ((index[r].encodedTimeNs - index[r].captureTimeNs) * 1e-6);
+      if (index.Count () > 1)
+      {
+        double span = (index[index.Count () - 1].captureTimeNs - index[0].captureTimeNs) * 1e-9;
+        if (span > 0)
+          achievedFps += (index.Count () - 1) / span;
+      }
+    }
+    std::sort (latencyMs.begin (), latencyMs.end ());
+
+    double expectedFps = _options.fps / _decimation;
+    std::ostringstream json;
+    json << "{\"cameras\":" << _cameras
+         << ",\"opened\":" << cameras.size ()
+         << ",\"width\":" << _size.width << ",\"height\":" << _size.height
+         << ",\"fourcc\":\"" << _fourcc << "\""
+         << ",\"decimation\":" << _decimation
+         << ",\"overlay\":" << _overlay
+         << ",\"chunk_frames\":" << _chunkFrames
+         << ",\"record_width\":" << (_recordSize.width > 0 ? _recordSize.width : _size.width)
+         << ",\"record_height\":" << (_recordSize.height > 0 ? _recordSize.height : _size.height)
+         << ",\"encoder_threads\":" << EncoderPool::Instance ().Threads ()
+         << ",\"duration_s\":" << elapsed
+         << ",\"expected_fps_per_camera\":" << expectedFps
+         << ",\"achieved_fps_per_camera\":" << (_cameras > 0 ? achievedFps / _cameras : 0)
+         << ",\"frames_written\":" << written
+         << ",\"frames_dropped\":" << dropped
+         << ",\"pool_misses\":" << poolMisses
+         << ",\"latency_ms\":{\"p50\":" << Percentile (latencyMs, 0.50)
+         << ",\"p90\":" << Percentile (latencyMs, 0.90)
+         << ",\"p99\":" << Percentile (latencyMs, 0.99)
+         << ",\"max\":" << (latencyMs.empty () ? 0 : latencyMs.back ()) << "}"
+         << ",\"cpu_ms_per_frame\":" << (written ? (after.cpuSeconds - before.cpuSeconds) * 1e3 / written : 0)
+         << ",\"baseline_rss_mb\":" << baselineRssMb
+         << ",\"peak_rss_growth_mb\":" << peakRssMb - baselineRssMb
+         << "}";
+    return json.str ();
+  }
+}
+
+int main (int argc, char** argv)
+{
+  Options options;
+  if (!ParseOptions (argc, argv, options))
+  {
+    std::cerr << "Usage: WebcamBenchmark [--cameras=1,2,4] [--resolutions=640x480,1920x1080] "
+              << "[--fourcc=MJPG,H264] [--decimation=1,2] [--overlay=0,1] "
+              << "[--chunkframes=0,30] [--encoders=0] [--recordsize=0,640x480] [--fps=30] "
+              << "[--pattern=gradient] [--duration=10] [--dir=.] [--out=results.jsonl]" << std::endl;
+    return 1;
+  }
+
+  std::ofstream file;
+  if (!options.out.empty ())
+    file.open (options.out.c_str ());
+  std::ostream& out = options.out.empty () ? std::cout : file;
+  EncoderPool::Instance ().Configure (options.encoders);
+
+  for (size_t c = 0; c < options.cameras.size (); c++)
+    for (size_t r = 0; r < options.resolutions.size (); r++)
+      for (size_t f = 0; f < options.fourccs.size (); f++)
+        for (size_t d = 0; d < options.decimations.size (); d++)
+          for (size_t o = 0; o < options.overlays.size (); o++)
+            for (size_t g = 0; g < options.chunkFrames.size (); g++)
+              for (size_t s = 0; s < options.recordSizes.size (); s++)
+              {
+                out << RunConfiguration (options, options.cameras[c], options.resolutions[r],
+                                         options.fourccs[f], options.decimations[d], options.overlays[o],
+                                         options.chunkFrames[g], options.recordSizes[s])
+                    << std::endl;
+              }
+  EncoderPool::Instance ().Shutdown ();
+  FrameEvents::Instance ().Shutdown ();
+  return 0;
+}
@@ -0,0 +1,96 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: WebcamDisplay.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: The WebcamDisplay shows the live preview window of a camera
+// on its own thread.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "WebcamDisplay.h"
+
+#include <algorithm>
+#include <utility>
+
+WebcamDisplay::WebcamDisplay (const std::string& _windowName) :
+  mWinName    (_windowName),
+  mScale      (1.0),
+  mHasPending (false)
+{
+  Configure (15, 1.0);
+}
+
+WebcamDisplay::~WebcamDisplay ()
+{
+  this->TerminateAndWait ();
+}
+
+void WebcamDisplay::Configure (double _refreshRate, double _scale)
+{
+  mPeriod = std::chrono::duration_cast<Clock::duration> (
+    std::chrono::duration<double> (1.0 / std::max (_refreshRate, 1.0)));
+  mScale  = std::min (std::max (_scale, 0.01), 1.0);
+}
+
+void WebcamDisplay::Offer (const cv::Mat& _frame, Clock::time_point _now, double _reduction)
+{
+  if (_frame.empty ())
+    return;
+  mNextOffer = _now + mPeriod;
+
+  // scale outside the lock, into a buffer only this thread touches
+  double scale = mScale * _reduction;
+  if (scale < 1.0)
+    cv::resize (_frame, mStaging, cv::Size (), scale, scale, cv::INTER_AREA);
+  else
+    _frame.copyTo (mStaging);
+
+  // replace whatever the display thread has not picked up yet
+  mMutex.Acquire ();
+  std::swap (mStaging, mPending);
+  mHasPending = true;
+  mMutex.Release ();
+}
+
+int WebcamDisplay::OnExecute ()
+{
+  mPlacement.Apply ();
+  cv::namedWindow (mWinName, cv::WINDOW_AUTOSIZE);
+  int waitMs = std::max (1, (int)std::chrono::duration_cast<std::chrono::milliseconds> (mPeriod).count ());
+  while (!this->Terminating ())
+  {
+    mMutex.Acquire ();
+    bool show = mHasPending;
+    if (show)
+      std::swap (mPending, mShowing);
+    mHasPending = false;
+    mMutex.Release ();
+
+    if (show)
+      cv::imshow (mWinName, mShowing);
+
+    // waitKey services the window and paces the refresh rate
+    cv::waitKey (waitMs);
+  }
+  cv::destroyWindow (mWinName);
+  return 0;
+}
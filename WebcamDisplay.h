@@ -0,0 +1,78 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: WebcamDisplay.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: The WebcamDisplay shows the live preview window of a camera
+// on its own thread. The capture thread offers frames at most at the
+// preview refresh rate; an offered frame is downscaled into a single-slot
+// mailbox that always holds the latest frame, so preview never queues and
+// never holds back capture or recording.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef WEBCAMDISPLAY_H
+#define WEBCAMDISPLAY_H
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <string>
+
+#include "Thread.h"
+#include "Mutex.h"
+#include "ThreadPlacement.h"
+
+class WebcamDisplay : public Thread
+{
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  WebcamDisplay  (const std::string& _windowName);
+  ~WebcamDisplay ();
+
+  void Configure (double _refreshRate, double _scale);
+  int  OnExecute () override;
+
+  // called from the capture thread; cheap when no frame is due
+  bool FrameDue  (Clock::time_point _now) const { return _now >= mNextOffer; }
+  // _reduction is the factor by which _frame was already scaled down from the camera image
+  void Offer     (const cv::Mat& _frame, Clock::time_point _now, double _reduction = 1.0);
+  double Scale   () const { return mScale; }
+
+  // cores and priority of the display thread; takes effect when the thread starts
+  void SetPlacement (const std::vector<int>& _cores, ThreadPlacement::Priority _priority) { mPlacement.Configure (_cores, _priority); }
+  const ThreadPlacement& Placement () const { return mPlacement; }
+
+private:
+  std::string        mWinName;
+  Tiny::Mutex        mMutex;
+
+  Clock::duration    mPeriod;
+  double             mScale;
+  Clock::time_point  mNextOffer;
+
+  cv::Mat            mStaging;   // owned by the capture thread
+  cv::Mat            mPending;   // guarded by mMutex
+  cv::Mat            mShowing;   // owned by the display thread
+  bool               mHasPending;
+  ThreadPlacement    mPlacement;
+};
+
+#endif // WEBCAMDISPLAY_H
@@ -0,0 +1,77 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: WebcamFrame.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: A single captured frame as it travels from the capture stage
+// of a WebcamThread to its writer stage. When the image buffer was leased
+// from a FrameOwner (a FramePool, or a capture device lending its driver
+// buffers), the frame owns the lease and hands the buffer back when it is
+// destroyed or assigned over, so a frame can only be moved, not copied.
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef WEBCAMFRAME_H
+#define WEBCAMFRAME_H
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+
+#include "PrecisionTime.h"
+
+struct WebcamFrame;
+
+// Lends image buffers to frames and takes them back when the frames are released.
+class FrameOwner
+{
+public:
+  virtual ~FrameOwner () {}
+  // may be called from any thread
+  virtual void Return (int _slot) = 0;
+};
+
+struct WebcamFrame
+{
+  WebcamFrame ();
+  WebcamFrame (WebcamFrame&& _other);
+  ~WebcamFrame ();
+  WebcamFrame& operator= (WebcamFrame&& _other);
+
+  // returns the image buffer to its owner, if it was leased
+  void Release ();
+  // makes this frame the holder of _slot of _owner; call after setting image
+  void Attach  (FrameOwner* _owner, int _slot);
+
+  cv::Mat       image;
+  PrecisionTime captureTime;   // time the frame was read from the camera
+  int64_t       captureTimeNs; // the same instant on the monotonic clock, see FrameIndex.h
+  double        driverTimeMs;  // CAP_PROP_POS_MSEC reported with the frame
+  uint32_t      cameraFrame;   // number of the frame among all the camera delivered
+  uint32_t      flags;         // FRAMEINDEX_FLAG_* for its index record
+
+private:
+  WebcamFrame (const WebcamFrame&);
+  WebcamFrame& operator= (const WebcamFrame&);
+
+  FrameOwner*   mPool;
+  int           mPoolSlot;
+};
+
+#endif // WEBCAMFRAME_H
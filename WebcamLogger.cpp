@@ -11,6 +11,10 @@
 //
 // Event Variables:
 //   WebcamFrame<n> - The current frame number for camera index n 
+//   WebcamQueueDepth<n>, WebcamEncodeTime<n>, ... - pipeline telemetry
+//     selected with TelemetryStates, see PipelineTelemetry.h
+//   WebcamLuminance<n>R<r>, WebcamMotion<n>R<r>, WebcamFlow<n>R<r> - video
+//     features of region r selected with VideoFeatures, see VideoFeatures.h
 //
 // $BEGIN_BCI2000_LICENSE$
 // 
@@ -34,21 +38,35 @@
 /////////////////////////////////////////////////////////////////////////////
 #include "WebcamLogger.h"
 
-#define NUM_OF_WEBCAM_EVENTS   4
-
 #define PARM_CAMERAINDEX_IDX   0
 #define PARM_WIDTH_IDX         1
 #define PARM_HEIGHT_IDX        2
 #define PARM_DECIMATION_IDX    3
 #define PARM_DISPLAYSTREAM_IDX 4
 #define PARM_FOURCC_IDX        5
+#define PARM_SOURCE_IDX        6   // optional
+#define PARM_RECORDSIZE_IDX    7   // optional
+#define PARM_CROP_IDX          8   // optional
+#define PARM_CORES_IDX         9   // optional
+#define PARM_FEATURES_IDX      10  // optional
 
-Extension( WebcamLogger );
+// how long Initialize () waits for camera threads to report where they run
+#define PLACEMENT_WAIT_MS 1000
+
+// frame rate and sizes assumed when estimating the memory of the pre-trigger frames,
+//   as the cameras are not opened yet
+#define PRETRIGGER_ASSUMED_FPS      30
+#define PRETRIGGER_IMAGE_BYTES      3   // per pixel, decoded to BGR
+#define PRETRIGGER_SAMPLE_BYTES     1   // per pixel, compressed samples at most
 
-void PrintAvailableCameras (bool _useDirectShow);
+Extension( WebcamLogger );
 
 WebcamLogger::WebcamLogger() :
-	mWebcamEnable( false )
+	mWebcamEnable( false ),
+  mCameraStates( 0 ),
+  mTelemetryStates( 0 ),
+  mVideoFeatures( 0 ),
+  mFeatureRegions( 0 )
 {
 	
 }
@@ -88,8 +106,145 @@ void WebcamLogger::Publish()
 				" 4: LowerLeft"
 					" (enumeration)",
 
+    "Source:WebcamLogger int DateTimeDetail= 0 0 0 2"
+      " // extra text after the date/time: "
+        " 0: none,"
+        " 1: milliseconds,"
+        " 2: camera frame number"
+          " (enumeration)",
+
+    "Source:WebcamLogger float PreviewRate= 15 15 1 %"
+      " // maximum refresh rate of preview windows in Hz",
+
+    "Source:WebcamLogger float PreviewScale= 1 1 0.01 1"
+      " // size of preview windows relative to the camera image",
+
+    "Source:WebcamLogger int FpsMeasureFrames= 15 15 0 %"
+      " // frames timed at startup if a camera does not report its frame rate,"
+      " 0 to assume 30 fps",
+
+    "Source:WebcamLogger int FrameQueueLength= 8 8 1 %"
+      " // number of frames buffered between capture and encoding of each camera",
+
+    "Source:WebcamLogger int FrameDropPolicy= 0 0 0 1"
+      " // behavior when a camera's frame queue is full: "
+        " 0: drop oldest frame,"
+        " 1: block capture"
+          " (enumeration)",
+
+    "Source:WebcamLogger int CameraStates= 4 4 1 %"
+      " // number of camera indices, from 0, for which WebcamFrame<n> states are declared"
+      " (takes effect at startup)",
+
+    "Source:WebcamLogger int CaptureThreads= 0 0 0 %"
+      " // number of threads capturing from all cameras, 0 for one thread per camera",
+
+    "Source:WebcamLogger int V4l2Buffers= 4 4 2 32"
+      " // number of driver buffers of cameras with Source v4l2",
+
+    "Source:WebcamLogger int Passthrough= 0 0 0 1"
+      " // record cameras with FOURCC MJPG or H264 as they compress their video,"
+      " without decoding and encoding; the date/time overlay then only shows in the preview"
+      " (boolean)",
+
+    "Source:WebcamLogger int CapturePriority= 0 0 0 2"
+      " // scheduling of camera capture threads: "
+        " 0: normal,"
+        " 1: raised,"
+        " 2: real-time (SCHED_FIFO on Linux, time critical on Windows)"
+          " (enumeration)",
+
+    "Source:WebcamLogger int EncodePriority= 0 0 0 1"
+      " // scheduling of encode and preview threads: "
+        " 0: normal,"
+        " 1: lowered (nice on Linux, below normal on Windows)"
+          " (enumeration)",
+
+    "Source:WebcamLogger int EncodeChunkFrames= 0 0 0 %"
+      " // number of frames per independently encoded chunk, so that the chunks of one camera"
+      " are encoded in parallel; 0 to encode each camera's video on one thread",
+
+    "Source:WebcamLogger int EncoderThreads= 0 0 0 %"
+      " // number of threads encoding chunks of all cameras, 0 for one thread per processor core",
+
+    "Source:WebcamLogger float SegmentSeconds= 0 0 0 %"
+      " // length in seconds of video segments that are complete on disk while recording"
+      " continues, listed in a .segments file next to the video; 0 to write each video"
+      " as one file that is complete when the run stops",
+
+    "Source:WebcamLogger int VideoIoBufferKB= 0 0 0 %"
+      " // size in KB of each of the buffers that muxed video files are written through,"
+      " by a thread of their own; 0 for ordinary buffered writes",
+
+    "Source:WebcamLogger int DirectVideoIo= 0 0 0 1"
+      " // write video buffers past the operating system's file cache, where the file"
+      " system allows (boolean)",
+
+    "Source:WebcamLogger float VideoSyncSeconds= 0 0 0 %"
+      " // seconds between flushes of buffered video files to disk; 0 to flush only"
+      " at the end of each segment",
+
+    "Source:WebcamLogger int VideoReserveMB= 0 0 0 %"
+      " // disk space in MB reserved ahead of buffered video files as they grow (Linux)",
+
+    "Source:WebcamLogger float StopTimeoutSeconds= 5 5 0 %"
+      " // seconds cameras may take to write their queued frames when a run stops;"
+      " frames still queued then are discarded; 0 to wait for all frames",
+
+    "Source:WebcamLogger float PreTriggerSeconds= 0 0 0 %"
+      " // seconds of video before the start of a run that are recorded with it;"
+      " the frames are held in memory between runs",
+
+    "Source:WebcamLogger int PreTriggerMB= 1024 1024 1 %"
+      " // most memory in MB the frames held for PreTriggerSeconds may take per camera;"
+      " beyond it, the oldest frames are dropped",
+
+    "Source:WebcamLogger int SharedFrames= 0 0 0 %"
+      " // most recent frames of each camera published in shared memory named"
+      " BCI2000WebcamFrames<n>, for other processes to read; 0 to publish none",
+
+    "Source:WebcamLogger float ActivityThreshold= 0 0 0 %"
+      " // mean difference in gray levels (0-255) from the last recorded frame above which"
+      " a camera records every frame; below it, the scene counts as static; 0 to record"
+      " every frame",
+
+    "Source:WebcamLogger float IdleFrameRate= 1 1 0 %"
+      " // frames per second recorded while a camera's scene is static",
+
+    "Source:WebcamLogger float ActivityHoldSeconds= 2 2 0 %"
+      " // seconds a camera keeps recording every frame after the last motion",
+
+    "Source:WebcamLogger int TelemetryStates= 0 0 0 511"
+      " // pipeline telemetry published as states, sum of: "
+        " 1: queue depth,"
+        " 2: capture jitter,"
+        " 4: overlay time,"
+        " 8: encode time,"
+        " 16: event latency,"
+        " 32: dropped frames,"
+        " 64: duplicated frames,"
+        " 128: missed frames,"
+        " 256: feature latency"
+        " (takes effect at startup)",
+
+    "Source:WebcamLogger int VideoFeatures= 0 0 0 7"
+      " // video features of the Features regions published as states, sum of: "
+        " 1: luminance,"
+        " 2: motion,"
+        " 4: flow"
+        " (takes effect at startup)",
+
+    "Source:WebcamLogger int FeatureRegions= 1 1 1 %"
+      " // most Features regions of a camera that have states (takes effect at startup)",
+
+    "Source:WebcamLogger int DecimationMode= 1 1 0 1"
+      " // how frames are kept when Decimation is greater than one: "
+        " 0: every n-th frame,"
+        " 1: by timestamp at camera fps / Decimation"
+          " (enumeration)",
+
     "Source:WebcamLogger matrix Connections= "
-      "{ CameraIndex Width Height Decimation DisplayStream FOURCC} " // row labels
+      "{ CameraIndex Width Height Decimation DisplayStream FOURCC Source RecordSize Crop Cores Features } " // row labels
       "{ Camera0 } "                                                 // column labels
       "0 "                                      // Camera Index
       "1920 "                                   // Width
@@ -97,10 +252,17 @@ void WebcamLogger::Publish()
       "1 "                                      // Decimation
       "1 "                                      // Display Stream
       "H264 "                                   // FOURCC
+      "camera "                                 // Source: camera, v4l2, v4l2:emulated, pattern:<kind> or file:<path>
+      "0 "                                      // RecordSize: <width>x<height>, or 0 for the camera's size
+      "0 "                                      // Crop: <x>,<y>,<width>,<height> of the camera image, or 0 for all of it
+      "* "                                      // Cores: <capture>/<encode>/<display> core lists like 0-3,6, or * for any core
+      "0 "                                      // Features: <x>,<y>,<width>,<height>;... of the recorded image, * for all of it, or 0 for none
 	END_PARAMETER_DEFINITIONS
 
-	// declare NUM_OF_WEBCAM_EVENTS event states
-	for (int i = 0; i < NUM_OF_WEBCAM_EVENTS; i++) 
+	// declare event states for camera indices 0 .. CameraStates-1. Like LogWebcam, the count is
+  //   read when the module starts, so more cameras are enabled with --CameraStates=<n>.
+  mCameraStates = std::max (1, (int)OptionalParameter ("CameraStates", 4));
+	for (int i = 0; i < mCameraStates; i++) 
 	{
 		std::stringstream EventStrm;
 		EventStrm << "WebcamFrame" << i << " 24 0 0 0";
@@ -109,6 +271,59 @@ void WebcamLogger::Publish()
 			EventStr.c_str(),
 		END_EVENT_DEFINITIONS
 	}
+
+  // states are declared once, so later changes to TelemetryStates need a restart
+  mTelemetryStates = (int)OptionalParameter ("TelemetryStates", 0) & PipelineTelemetry::AllMetrics;
+  for (int i = 0; i < mCameraStates; i++)
+  {
+    for (int bit = 1; bit & PipelineTelemetry::AllMetrics; bit <<= 1)
+    {
+      if (!(mTelemetryStates & bit))
+        continue;
+      PipelineTelemetry::Metric metric = static_cast<PipelineTelemetry::Metric> (bit);
+      std::stringstream EventStrm;
+      EventStrm << PipelineTelemetry::StateName (metric) << i << " " << PipelineTelemetry::StateBits (metric) << " 0 0 0";
+      std::string EventStr = EventStrm.str();
+      BEGIN_EVENT_DEFINITIONS
+        EventStr.c_str(),
+      END_EVENT_DEFINITIONS
+    }
+  }
+
+  // likewise for the video features, for up to FeatureRegions regions of each camera
+  mVideoFeatures  = (int)OptionalParameter ("VideoFeatures", 0) & VideoFeatures::AllFeatures;
+  mFeatureRegions = std::max (1, (int)OptionalParameter ("FeatureRegions", 1));
+  for (int i = 0; i < mCameraStates && mVideoFeatures != 0; i++)
+  {
+    for (int r = 0; r < mFeatureRegions; r++)
+    {
+      for (int bit = 1; bit & VideoFeatures::AllFeatures; bit <<= 1)
+      {
+        if (!(mVideoFeatures & bit))
+          continue;
+        VideoFeatures::Feature feature = static_cast<VideoFeatures::Feature> (bit);
+        std::stringstream EventStrm;
+        EventStrm << VideoFeatures::StateName (feature, i, r) << " " << VideoFeatures::StateBits (feature) << " 0 0 0";
+        std::string EventStr = EventStrm.str();
+        BEGIN_EVENT_DEFINITIONS
+          EventStr.c_str(),
+        END_EVENT_DEFINITIONS
+      }
+    }
+  }
+}
+
+std::string WebcamLogger::ConnectionSource (int _column) const
+{
+  return ConnectionOption (PARM_SOURCE_IDX, _column, "camera");
+}
+
+std::string WebcamLogger::ConnectionOption (int _row, int _column, const std::string& _default) const
+{
+  // rows from Source on are optional, so that older parameter files keep working
+  if (Parameter ("Connections")->NumRows () <= _row)
+    return _default;
+  return Parameter ("Connections")(_row, _column);
 }
 
 void WebcamLogger::AutoConfig ()
@@ -136,18 +351,86 @@ void WebcamLogger::Preflight() const
   Parameter ("StartIndex");
   */
 	Parameter ("DateTimeLocation");
+  Parameter ("DateTimeDetail");
   Parameter ("Connections");
+  Parameter ("FrameDropPolicy");
+  Parameter ("DecimationMode");
+  Parameter ("CapturePriority");
+  Parameter ("EncodePriority");
+  if ((int)Parameter ("TelemetryStates") != mTelemetryStates)
+    bciwarn << "WebcamLogger: Changes to TelemetryStates take effect after restarting." << std::endl;
+  if ((int)Parameter ("CameraStates") != mCameraStates)
+    bciwarn << "WebcamLogger: Changes to CameraStates take effect after restarting." << std::endl;
+  if ((int)Parameter ("VideoFeatures") != mVideoFeatures || (int)Parameter ("FeatureRegions") != mFeatureRegions)
+    bciwarn << "WebcamLogger: Changes to VideoFeatures and FeatureRegions take effect after restarting." << std::endl;
+  if ((int)Parameter ("CaptureThreads") < 0)
+    bcierr << "WebcamLogger Error: CaptureThreads must not be negative." << std::endl;
+  if ((int)Parameter ("V4l2Buffers") < 2 || (int)Parameter ("V4l2Buffers") > 32)
+    bcierr << "WebcamLogger Error: V4l2Buffers must be between 2 and 32." << std::endl;
+  bool passthrough = (int)Parameter ("Passthrough") != 0;
+  if ((int)Parameter ("EncodeChunkFrames") < 0)
+    bcierr << "WebcamLogger Error: EncodeChunkFrames must not be negative." << std::endl;
+  if ((int)Parameter ("EncoderThreads") < 0)
+    bcierr << "WebcamLogger Error: EncoderThreads must not be negative." << std::endl;
+  if ((double)Parameter ("SegmentSeconds") < 0)
+    bcierr << "WebcamLogger Error: SegmentSeconds must not be negative." << std::endl;
+  if ((int)Parameter ("VideoIoBufferKB") < 0)
+    bcierr << "WebcamLogger Error: VideoIoBufferKB must not be negative." << std::endl;
+  if ((double)Parameter ("VideoSyncSeconds") < 0)
+    bcierr << "WebcamLogger Error: VideoSyncSeconds must not be negative." << std::endl;
+  if ((int)Parameter ("VideoReserveMB") < 0)
+    bcierr << "WebcamLogger Error: VideoReserveMB must not be negative." << std::endl;
+  if ((int)Parameter ("VideoIoBufferKB") == 0
+      && ((int)Parameter ("DirectVideoIo") != 0 || (double)Parameter ("VideoSyncSeconds") > 0
+          || (int)Parameter ("VideoReserveMB") > 0))
+    bciwarn << "WebcamLogger: DirectVideoIo, VideoSyncSeconds and VideoReserveMB only apply"
+            << " with VideoIoBufferKB greater than zero." << std::endl;
+  if ((double)Parameter ("StopTimeoutSeconds") < 0)
+    bcierr << "WebcamLogger Error: StopTimeoutSeconds must not be negative." << std::endl;
+  if ((double)Parameter ("PreTriggerSeconds") < 0)
+    bcierr << "WebcamLogger Error: PreTriggerSeconds must not be negative." << std::endl;
+  if ((int)Parameter ("PreTriggerMB") < 1)
+    bcierr << "WebcamLogger Error: PreTriggerMB must be at least one." << std::endl;
+  if ((int)Parameter ("SharedFrames") < 0)
+    bcierr << "WebcamLogger Error: SharedFrames must not be negative." << std::endl;
+  if ((double)Parameter ("ActivityThreshold") < 0)
+    bcierr << "WebcamLogger Error: ActivityThreshold must not be negative." << std::endl;
+  if ((double)Parameter ("IdleFrameRate") < 0)
+    bcierr << "WebcamLogger Error: IdleFrameRate must not be negative." << std::endl;
+  if ((double)Parameter ("ActivityHoldSeconds") < 0)
+    bcierr << "WebcamLogger Error: ActivityHoldSeconds must not be negative." << std::endl;
+
+  if ((int)Parameter ("FpsMeasureFrames") < 0)
+    bcierr << "WebcamLogger Error: FpsMeasureFrames must not be negative." << std::endl;
+
+  if ((double)Parameter ("PreviewRate") <= 0)
+    bcierr << "WebcamLogger Error: PreviewRate must be greater than zero." << std::endl;
+  double previewScale = Parameter ("PreviewScale");
+  if (previewScale <= 0 || previewScale > 1)
+    bcierr << "WebcamLogger Error: PreviewScale must be greater than zero and at most one." << std::endl;
+
+  if ((int)Parameter ("FrameQueueLength") < 1)
+    bcierr << "WebcamLogger Error: FrameQueueLength must be at least one." << std::endl;
 
 	Parameter ("DataDirectory");
 	Parameter ("SubjectName");
 	Parameter ("SubjectSession");
 	Parameter ("SubjectRun");
 
-  PrintAvailableCameras (Parameter("UseDirectShow"));
+  // Notify the user what cameras are connected to the system and what index they are at.
+  //   The list is cached and only rescanned (and reported) when devices come or go.
+  bool rescanned = false;
+  std::vector<CameraInfo> cameras = CameraEnumerator::Instance ().Cameras (Parameter ("UseDirectShow"), &rescanned);
+  if (rescanned)
+  {
+    bcidbg( 0 ) << cv::getBuildInformation () << std::endl;
+    bciout << CameraEnumerator::Describe (cameras) << std::endl;
+  }
   
-  if (Parameter ("Connections")->NumRows () != 6)
+  int rows = Parameter ("Connections")->NumRows ();
+  if (rows < PARM_SOURCE_IDX || rows > PARM_FEATURES_IDX + 1)
   {
-    bcierr << "WebcamLogger Error: There must be 5 rows in Connections parameter. "
+    bcierr << "WebcamLogger Error: There must be 6 to 11 rows in Connections parameter. "
            << "See https://www.bci2000.org/mediawiki/index.php/Contributions:WebcamLogger "
            << "for more info" << std::endl;
     return;
@@ -157,8 +440,12 @@ void WebcamLogger::Preflight() const
   for (int i = 0; i < Parameter("Connections")->NumColumns(); i ++)
   {
     // check for a valid index
-    if ((int)Parameter ("Connections")(PARM_CAMERAINDEX_IDX, i) < 0)
+    int index = Parameter ("Connections")(PARM_CAMERAINDEX_IDX, i);
+    if (index < 0)
       bcierr << "WebcamLogger Error: CameraIndex in Connections parameter must be greater than zero." << std::endl;
+    else if (index >= mCameraStates)
+      bcierr << "WebcamLogger Error: Camera index " << index << " has no WebcamFrame state; "
+             << "start the source module with --CameraStates=" << index + 1 << " or more." << std::endl;
 
     // check for valid width
     if ((int)Parameter ("Connections")(PARM_WIDTH_IDX, i) < 1)
@@ -169,14 +456,93 @@ void WebcamLogger::Preflight() const
       bcierr << "WebcamLogger Error: Height in Connections parameter must be greater than zero." << std::endl;
 
     // check for valid decimation
-    if ((int)Parameter ("Connections")(PARM_DECIMATION_IDX, i) < 0)
+    if ((int)Parameter ("Connections")(PARM_DECIMATION_IDX, i) < 1)
       bcierr << "WebcamLogger Error: Decimation in Connections parameter must be positive." << std::endl;
 
-    // check for valid decimation
+    // check for valid display stream flag
     int displystream = (int)Parameter ("Connections")(PARM_DISPLAYSTREAM_IDX, i);
     if (displystream != 0 && displystream != 1)
       bcierr << "WebcamLogger Error: DisplayStream in Connections parameter must be zero or one." << std::endl;
 
+    // check the connection against the enumerated devices, without opening them
+    int         width  = Parameter ("Connections")(PARM_WIDTH_IDX,  i);
+    int         height = Parameter ("Connections")(PARM_HEIGHT_IDX, i);
+    std::string source = ConnectionSource (i);
+    std::string error;
+    CameraInfo  info;
+    if (VirtualCamera::IsVirtual (source))
+    {
+      if (!VirtualCamera::Parse (source, error))
+        bcierr << "WebcamLogger Error: Invalid Source \"" << source << "\" in Connections parameter: "
+               << error << std::endl;
+    }
+    else if (V4l2Camera::IsV4l2 (source) && !V4l2Camera::Parse (source, error))
+      bcierr << "WebcamLogger Error: Invalid Source \"" << source << "\" in Connections parameter: "
+             << error << std::endl;
+    else if (source != "camera" && !source.empty () && !V4l2Camera::IsV4l2 (source))
+      bcierr << "WebcamLogger Error: Source in Connections parameter must be camera, v4l2, "
+             << "v4l2:emulated, pattern:<kind> or file:<path>." << std::endl;
+    else if (source == "v4l2:emulated")
+      ; // nothing to enumerate
+    else if (!CameraEnumerator::Find (cameras, index, info))
+      bciwarn << "WebcamLogger: No camera was detected at index " << index << std::endl;
+    else if (!info.Supports (width, height))
+      bciwarn << "WebcamLogger: Camera " << index << " does not list a " << width << "x" << height
+              << " mode; the closest supported resolution will be used." << std::endl;
+    if ((int)Parameter ("CaptureThreads") > 0 && !CaptureReactor::CanWait (source))
+      bciwarn << "WebcamLogger: Camera " << index << " cannot be waited on by a capture thread"
+              << ((int)Parameter ("UseDirectShow") ? " with UseDirectShow" : "") << "; its capture thread"
+              << " reads it in turn with its other cameras, so a slow camera holds up the rest." << std::endl;
+
+    // check the recorded region against the requested camera size
+    cv::Size recordSize;
+    cv::Rect crop;
+    if (!FrameScaler::ParseSize (ConnectionOption (PARM_RECORDSIZE_IDX, i, "0"), recordSize, error))
+      bcierr << "WebcamLogger Error: Invalid RecordSize in Connections parameter: " << error << std::endl;
+    if (!FrameScaler::ParseRect (ConnectionOption (PARM_CROP_IDX, i, "0"), crop, error))
+      bcierr << "WebcamLogger Error: Invalid Crop in Connections parameter: " << error << std::endl;
+    else if (crop.x + crop.width > width || crop.y + crop.height > height)
+      bcierr << "WebcamLogger Error: Crop in Connections parameter must lie within the camera's "
+             << width << "x" << height << " image." << std::endl;
+
+    // check the feature regions against the recorded image
+    std::vector<cv::Rect> regions;
+    cv::Size recorded = recordSize.width > 0 ? recordSize : crop.empty () ? cv::Size (width, height) : crop.size ();
+    if (!VideoFeatures::ParseRegions (ConnectionOption (PARM_FEATURES_IDX, i, "0"), regions, error))
+      bcierr << "WebcamLogger Error: Invalid Features in Connections parameter: " << error << std::endl;
+    else if (mVideoFeatures != 0 && static_cast<int> (regions.size ()) > mFeatureRegions)
+      bcierr << "WebcamLogger Error: Camera " << index << " has " << regions.size () << " Features regions, "
+             << "but states for " << mFeatureRegions << "; start the source module with --FeatureRegions="
+             << regions.size () << " or more." << std::endl;
+    for (size_t r = 0; r < regions.size (); r++)
+      if (regions[r].x + regions[r].width > recorded.width || regions[r].y + regions[r].height > recorded.height)
+        bcierr << "WebcamLogger Error: Features in Connections parameter must lie within the recorded "
+               << recorded.width << "x" << recorded.height << " image." << std::endl;
+    if (!regions.empty () && mVideoFeatures == 0)
+      bciwarn << "WebcamLogger: Features in Connections parameter are measured only with VideoFeatures"
+              << " greater than zero." << std::endl;
+
+    // check whether the pre-trigger frames fit into the memory they may take
+    int    decimation = std::max (1, (int)Parameter ("Connections")(PARM_DECIMATION_IDX, i));
+    double frameBytes = passthrough ? double (width) * height * PRETRIGGER_SAMPLE_BYTES
+                                    : double (recorded.area ()) * PRETRIGGER_IMAGE_BYTES;
+    double preTriggerMB = (double)Parameter ("PreTriggerSeconds") * PRETRIGGER_ASSUMED_FPS / decimation
+                        * frameBytes / (1 << 20);
+    if (preTriggerMB > (int)Parameter ("PreTriggerMB"))
+      bciwarn << "WebcamLogger: PreTriggerSeconds of camera " << index << " take about "
+              << static_cast<int> (preTriggerMB + 0.5) << " MB at " << PRETRIGGER_ASSUMED_FPS
+              << " frames per second, more than PreTriggerMB; only the most recent "
+              << (int)Parameter ("PreTriggerMB") << " MB of frames will be recorded before a run." << std::endl;
+
+    // check the cores the camera's threads run on
+    std::vector<std::vector<int> > cores;
+    if (!ThreadPlacement::ParseCoreSets (ConnectionOption (PARM_CORES_IDX, i, "*"), 3, cores, error))
+      bcierr << "WebcamLogger Error: Invalid Cores in Connections parameter: " << error << std::endl;
+    for (size_t c = 0; c < cores.size (); c++)
+      if (!cores[c].empty () && cores[c].back () >= static_cast<int> (std::thread::hardware_concurrency ()))
+        bciwarn << "WebcamLogger: Cores in Connections parameter names " << ThreadPlacement::FormatCores (cores[c])
+                << ", but this machine has " << std::thread::hardware_concurrency () << " cores." << std::endl;
+
     // check for a valid fourcc length (we doen't know if it is a valid fourcc yet)
     std::string FOURCC = (std::string)Parameter ("Connections")(PARM_FOURCC_IDX, i);
     if (FOURCC.length () > 4)
@@ -270,6 +636,18 @@ void WebcamLogger::Initialize()
   Halt ();
 
   // make new threads
+  int captureThreads = Parameter ("CaptureThreads");
+  EncoderPool::Instance ().Configure (Parameter ("EncoderThreads"));
+  ThreadPlacement::Priority capturePriority = static_cast<ThreadPlacement::Priority> ((int)Parameter ("CapturePriority"));
+  ThreadPlacement::Priority encodePriority  = (int)Parameter ("EncodePriority") != 0 ? ThreadPlacement::Lowered
+                                                                                     : ThreadPlacement::Normal;
+  EncoderPool::Instance ().SetPriority (encodePriority);
+  VideoIoOptions videoIo;
+  videoIo.bufferBytes  = static_cast<size_t> ((int)Parameter ("VideoIoBufferKB")) * 1024;
+  videoIo.direct       = (int)Parameter ("DirectVideoIo") != 0;
+  videoIo.syncNs       = static_cast<int64_t> ((double)Parameter ("VideoSyncSeconds") * 1e9);
+  videoIo.reserveBytes = static_cast<uint64_t> ((int)Parameter ("VideoReserveMB")) << 20;
+  std::vector<WebcamThread*> cameras;
   for (int i = 0; i < Parameter ("Connections")->NumColumns (); i++)
   {
     WebcamThread* temp_camera = new WebcamThread (
@@ -280,15 +658,88 @@ void WebcamLogger::Initialize()
       Parameter ("Connections")(PARM_DISPLAYSTREAM_IDX, i),
       Parameter ("DateTimeLocation"                      ),
       Parameter ("UseDirectShow"                         ),
-      Parameter ("Connections")(PARM_FOURCC_IDX,        i)
+      Parameter ("Connections")(PARM_FOURCC_IDX,        i),
+      Parameter ("FrameQueueLength"                      ),
+      Parameter ("FrameDropPolicy"                       )
     );
 
-    bool connected = temp_camera->Initalize ();
-    if (connected)
+    temp_camera->SetDecimationMode   (Parameter ("DecimationMode"));
+    temp_camera->SetDateTimeDetail   (Parameter ("DateTimeDetail"));
+    temp_camera->SetFpsMeasureFrames (Parameter ("FpsMeasureFrames"));
+    temp_camera->SetSource           (ConnectionSource (i));
+    temp_camera->SetPreview          (Parameter ("PreviewRate"), Parameter ("PreviewScale"));
+    int index = Parameter ("Connections")(PARM_CAMERAINDEX_IDX, i);
+    temp_camera->SetTelemetryStates  (index < mCameraStates ? mTelemetryStates : 0);
+    temp_camera->SetExternalCapture  (captureThreads > 0);
+    temp_camera->SetV4l2Buffers      (Parameter ("V4l2Buffers"));
+    temp_camera->SetPassthrough      ((int)Parameter ("Passthrough") != 0);
+    temp_camera->SetEncodeChunkFrames (Parameter ("EncodeChunkFrames"));
+    temp_camera->SetSegmentSeconds   (Parameter ("SegmentSeconds"));
+    temp_camera->SetVideoIo          (videoIo);
+    temp_camera->SetPreTriggerSeconds (Parameter ("PreTriggerSeconds"));
+    temp_camera->SetPreTriggerLimit   (Parameter ("PreTriggerMB"));
+    temp_camera->SetSharedFrames     (Parameter ("SharedFrames"));
+    cv::Size    recordSize;
+    cv::Rect    crop;
+    std::string error;
+    FrameScaler::ParseSize (ConnectionOption (PARM_RECORDSIZE_IDX, i, "0"), recordSize, error);
+    FrameScaler::ParseRect (ConnectionOption (PARM_CROP_IDX, i, "0"), crop, error);
+    temp_camera->SetRecordRegion     (crop, recordSize);
+    temp_camera->SetActivityGate     (Parameter ("ActivityThreshold"), Parameter ("IdleFrameRate"),
+                                      Parameter ("ActivityHoldSeconds"));
+    std::vector<std::vector<int> > cores;
+    ThreadPlacement::ParseCoreSets (ConnectionOption (PARM_CORES_IDX, i, "*"), 3, cores, error);
+    temp_camera->SetPlacement        (cores[0], cores[1], cores[2], capturePriority, encodePriority);
+    std::vector<cv::Rect> regions;
+    VideoFeatures::ParseRegions (ConnectionOption (PARM_FEATURES_IDX, i, "0"), regions, error);
+    temp_camera->SetVideoFeatures    (index < mCameraStates ? mVideoFeatures : 0, regions);
+
+    cameras.push_back (temp_camera);
+  }
+
+  // open and configure all cameras at once, since each one can take a while to negotiate
+  std::vector<char>        connected (cameras.size (), 0);
+  std::vector<std::thread> initializers;
+  for (size_t i = 0; i < cameras.size (); i++)
+    initializers.push_back (std::thread ([&cameras, &connected, i] () {
+      connected[i] = cameras[i]->Initalize ();
+    }));
+  for (size_t i = 0; i < initializers.size (); i++)
+    initializers[i].join ();
+
+  for (size_t i = 0; i < cameras.size (); i++)
+  {
+    if (connected[i])
+    {
+      mWebcamThreads.push_back (cameras[i]);
+    }
+    else
     {
-      mWebcamThreads.push_back (temp_camera);
+      bciwarn << "WebcamLogger: Could not open camera at index "
+              << (int)Parameter ("Connections")(PARM_CAMERAINDEX_IDX, i) << std::endl;
+      delete cameras[i];
     }
   }
+
+  // with a reactor, a few shared threads capture from all cameras
+  if (captureThreads > 0)
+  {
+    mReactor.Start (mWebcamThreads, captureThreads);
+    bciout << "WebcamLogger: Capturing from " << mWebcamThreads.size () << " camera(s) on "
+           << mReactor.Threads () << " thread(s)";
+  }
+
+  // where the camera threads ended up, which may not be what was asked for
+  for (size_t i = 0; i < mWebcamThreads.size (); i++)
+  {
+    if (!mWebcamThreads[i]->PlacementConfigured ())
+      continue;
+    std::string report;
+    if (mWebcamThreads[i]->PlacementReport (report, PLACEMENT_WAIT_MS))
+      bciout << report;
+    else
+      bciwarn << "WebcamLogger: " << report << std::endl;
+  }
 }
 
 
@@ -316,14 +767,19 @@ void WebcamLogger::StartRun()
 	*/
   std::string output_file_prefix = CurrentRun ();
   output_file_prefix = FileUtils::ExtractDirectory (output_file_prefix) + FileUtils::ExtractBase (output_file_prefix);
+  // open all video files at once, so that no camera waits for the others to start
+  std::vector<std::thread> starters;
   for (int i = 0; i < mWebcamThreads.size (); i++)
-  {
-    mWebcamThreads[i]->StartRecording (output_file_prefix);
-  }
+    starters.push_back (std::thread ([this, i, &output_file_prefix] () {
+      mWebcamThreads[i]->StartRecording (output_file_prefix);
+    }));
+  for (size_t i = 0; i < starters.size (); i++)
+    starters[i].join ();
 }
 
 void WebcamLogger::StopRun()
 {
+  if (!mWebcamEnable) return;
   /*
 	if (mWebcamEnable)
 	{
@@ -343,9 +799,25 @@ void WebcamLogger::StopRun()
 		}
 	}
   */
+  // cameras flush their video at the same time, within one time limit for all of them
+  WebcamThread::Clock::time_point stopStart = WebcamThread::Clock::now ();
+  WebcamThread::Clock::time_point deadline  = WebcamThread::Clock::time_point::max ();
+  double timeout = Parameter ("StopTimeoutSeconds");
+  if (timeout > 0)
+    deadline = stopStart + std::chrono::duration_cast<WebcamThread::Clock::duration> (
+                 std::chrono::duration<double> (timeout));
+  std::vector<std::thread> stoppers;
   for (int i = 0; i < mWebcamThreads.size (); i++)
+    stoppers.push_back (std::thread ([this, i, deadline] () {
+      mWebcamThreads[i]->StopRecording (deadline);
+    }));
+  for (size_t i = 0; i < stoppers.size (); i++)
+    stoppers[i].join ();
+  if (!mWebcamThreads.empty ())
   {
-    mWebcamThreads[i]->StopRecording ();
+    std::chrono::duration<double, std::milli> stopTime = WebcamThread::Clock::now () - stopStart;
+    bciout << "WebcamLogger: Stopped recording " << mWebcamThreads.size () << " camera(s) in "
+           << static_cast<int> (stopTime.count ()) << " ms" << std::endl;
   }
 }
 
@@ -373,15 +845,21 @@ void WebcamLogger::Halt()
 		}
 	}
   */
-  if (mWebcamThreads.size () != 0)
-  {
-    for (int i = 0; i < mWebcamThreads.size (); i++)
-    {
+  // capture threads go first, since they call into the cameras
+  mReactor.Stop ();
+  // each camera closes its files and its device on a thread of its own
+  std::vector<std::thread> stoppers;
+  for (int i = 0; i < mWebcamThreads.size (); i++)
+    stoppers.push_back (std::thread ([this, i] () {
       mWebcamThreads[i]->StopStream ();
       delete mWebcamThreads[i];
       mWebcamThreads[i] = NULL;
-    }
-    mWebcamThreads.clear ();
-  }
+    }));
+  for (size_t i = 0; i < stoppers.size (); i++)
+    stoppers[i].join ();
+  mWebcamThreads.clear ();
+  // the cameras have waited for their chunks, so the encoder threads are idle
+  EncoderPool::Instance ().Shutdown ();
+  FrameEvents::Instance ().Shutdown ();
 }
  
\ No newline at end of file
@@ -11,6 +11,8 @@
 //
 // Event Variables:
 //   WebcamFrame<n> - The current frame number for camera index n 
+//   WebcamQueueDepth<n>, WebcamEncodeTime<n>, ... - pipeline telemetry
+//     selected with TelemetryStates, see PipelineTelemetry.h
 //
 // $BEGIN_BCI2000_LICENSE$
 // 
@@ -40,8 +42,15 @@
 #include <cstring>
 #include <ctime>
 #include <iomanip>
+#include <thread>
+#include <vector>
 
 #include "WebcamThread.h"
+#include "CameraEnumerator.h"
+#include "CaptureReactor.h"
+#include "EncoderPool.h"
+#include "FrameEvents.h"
+#include "FrameScaler.h"
 #include "Environment.h"
 #include "GenericVisualization.h"
 #include "FileUtils.h"
@@ -64,8 +73,17 @@ public:
 	void Halt() override;
 
 private:
+  std::string ConnectionSource (int _column) const;
+  // an optional row of the Connections parameter, or _default if the row is missing
+  std::string ConnectionOption (int _row, int _column, const std::string& _default) const;
+
   bool							         mWebcamEnable;
+  int                        mCameraStates;      // as declared in Publish ()
+  int                        mTelemetryStates;   // as declared in Publish ()
+  int                        mVideoFeatures;     // as declared in Publish ()
+  int                        mFeatureRegions;    // as declared in Publish ()
 	std::vector<WebcamThread*> mWebcamThreads;
+  CaptureReactor             mReactor;
 };
 
 #endif // WEBCAM_LOGGER_H
@@ -30,61 +30,37 @@
 /////////////////////////////////////////////////////////////////////////////
 
 #include "WebcamThread.h"
+#include "CameraEnumerator.h"
 
-#define OPENCV_API cv::CAP_DSHOW
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <thread>
 
-static time_t Now()
-{ return ::time( 0 ); }
+// driver buffers of the v4l2 backend unless configured
+#define DEFAULT_V4L2_BUFFERS 4
 
-static std::string TimeToString( time_t inTime )
-{ // format is "MM/dd/yy hh:mm:ss"
-  struct ::tm t = { 0 },
-             *p = ::localtime( &inTime );
-  if( !p )
-    return "<n/a>";
+// memory the pre-trigger buffer may take unless configured
+#define DEFAULT_PRETRIGGER_MB 1024
 
-  t = *p;
-  std::ostringstream oss;
-  oss << std::setfill( '0' )
-      << std::setw( 2 ) << t.tm_mon + 1 << '/'
-      << std::setw( 2 ) << t.tm_mday << '/'
-      << std::setw( 2 ) << t.tm_year % 100 << ' '
-      << std::setw( 2 ) << t.tm_hour << ':'
-      << std::setw( 2 ) << t.tm_min << ':'
-      << std::setw( 2 ) << t.tm_sec;
-  return oss.str();
-}
+// frame buffers in the pool beyond the writer queue capacity
+#define FRAME_POOL_SPARE 3
 
-// Notify the user what cameras are connected to the system and what index they are at.
-// This is useful becuase they won't have to search for valid indexes through trial and
-// error, but they won't be able to discern one camera from another. They'll have to figure
-// that part out through trial and error. I see this as an OpenCV problem.
-void PrintAvailableCameras (bool _useDirectShow)
-{
-  bciout << cv::getBuildInformation () << std::endl;
+// frame rate used when the camera neither reports nor yields a usable one
+#define DEFAULT_CAMERA_FPS 30
 
+// weight of each new frame interval in the running frame rate estimate
+#define FPS_ESTIMATE_WEIGHT 0.02
 
-  int max_n_cameras = 10;
-  int total_cameras = 0;
-  std::stringstream camera_info_stream;
-  camera_info_stream << "WebcamLogger: Enumeration of cameras connected to system:\n";
-  for (int i = 0; i < max_n_cameras; i++)
-  {
-    cv::VideoCapture temp_camera;
-    if (_useDirectShow) temp_camera.open (i, OPENCV_API);
-    else                temp_camera.open (i);
+// minimum time between updates of the telemetry states
+#define TELEMETRY_STATE_PERIOD_MS 100
 
-    if (temp_camera.isOpened ())
-    {
-      camera_info_stream << "  Camera detected at index " << i << "\n";
-      temp_camera.release ();
-      total_cameras += 1;
-    }
-  }
-  if (total_cameras == 0)
-    camera_info_stream << "  No cameras were detected\n";
-  bciout << camera_info_stream.str () << std::endl;
-}
+// a capture interval this many frame intervals long means camera frames were missed
+#define MISSED_FRAME_INTERVALS 1.5
+
+// pooled buffer size for compressed samples, in bytes per pixel; larger samples are
+//   held in buffers of their own
+#define SAMPLE_BYTES_PER_PIXEL 1
 
 //==========================================================================================
 // WebcamThread member function implementaion
@@ -96,7 +72,9 @@ WebcamThread::WebcamThread ( int         _camIndex,
                              bool        _displayStream, 
                              int         _dateLocation,
                              bool        _useDirectShow,
-                             std::string _fourcc ):
+                             std::string _fourcc,
+                             int         _queueLength,
+                             int         _dropPolicy ):
   mCameraIndex    (_camIndex),
 	mSourceWidth    (_width),
 	mSourceHeight   (_height),
@@ -104,40 +82,83 @@ WebcamThread::WebcamThread ( int         _camIndex,
   mDisplayStream  (_displayStream),
   mDateLocation   (_dateLocation),
   mUseDirectShow  (_useDirectShow),
+  mWriter         (_camIndex, _queueLength, WebcamWriter::Queue::DropPolicy (_dropPolicy)),
   mRecording      (false),
-  mAddDate        (false),
-  mFrameNum       (0),
+  mDateDetail     (TimestampOverlay::Seconds),
   mCount          (0),
-  mTargetFps      (30),
-  mWinName        (""){
+  mCameraFrames   (0),
+  mRestart        (false),
+  mBufferNode     (-1),
+  mActivityThreshold (0),
+  mIdleFps        (0),
+  mActivityHoldNs (0),
+  mDecimationMode (DecimateByTime),
+  mFpsMeasureFrames (0),
+  mCameraFps      (DEFAULT_CAMERA_FPS),
+  mTargetFps      (DEFAULT_CAMERA_FPS),
+  mFrameInterval  (1.0 / DEFAULT_CAMERA_FPS),
+  mLastDriverTimeMs (-1),
+  mTelemetryStates (0),
+  mExternalCapture (false),
+  mV4l2           (nullptr),
+  mV4l2Buffers    (DEFAULT_V4L2_BUFFERS),
+  mPassthrough    (false),
+  mEncodeChunkFrames (0),
+  mPreTriggerNs   (0),
+  mPreTriggerBytes (static_cast<size_t> (DEFAULT_PRETRIGGER_MB) << 20),
+  mSharedFrames   (0),
+  mFeatureSet     (0),
+  mCompressed     (false),
+  mCodec          (Mp4Muxer::Jpeg),
+  mPreviewReduction (1),
+  mDisplay        ("Camera " + std::to_string(_camIndex)){
   _fourcc.resize  (4, ' ');
   std::transform  (_fourcc.begin (), _fourcc.end (), _fourcc.begin (), ::toupper);
   mFourcc         = cv::VideoWriter::fourcc (_fourcc[0], _fourcc[1], _fourcc[2], _fourcc[3]);
+  mWriter.SetTelemetry (&mTelemetry);
 }
 
 
 bool WebcamThread::Initalize()
 {
+  Clock::time_point configStart = Clock::now ();
+
 	// start mutex so existing thread doesn't attempt to use camera while initalizing and getting FPS
 	mMutex.Acquire();
 
 	// open the webcam
-  if (mUseDirectShow) mVCapture.open (mCameraIndex, OPENCV_API);
-  else                mVCapture.open (mCameraIndex);
+  mV4l2 = nullptr;
+  if (VirtualCamera::IsVirtual (mSource))
+  {
+    mVCapture = cv::makePtr<VirtualCamera> (mSource);
+    mVCapture->open (mCameraIndex);
+  }
+  else if (V4l2Camera::IsV4l2 (mSource))
+  {
+    cv::Ptr<V4l2Camera> camera = cv::makePtr<V4l2Camera> (mSource, mV4l2Buffers);
+    mV4l2     = camera.get ();
+    mVCapture = camera;
+    mVCapture->open (mCameraIndex);
+  }
+  else
+  {
+    mVCapture = cv::makePtr<cv::VideoCapture> ();
+    mVCapture->open (mCameraIndex, CameraEnumerator::CaptureApi (mUseDirectShow));
+  }
 
-  if (!mVCapture.isOpened ())
+  if (!mVCapture->isOpened ())
   {
     mMutex.Release ();
     return false;
   }
 
-  mVCapture.set (cv::CAP_PROP_FOURCC,       mFourcc);
-  mVCapture.set (cv::CAP_PROP_FRAME_WIDTH,  mSourceWidth);
-  mVCapture.set (cv::CAP_PROP_FRAME_HEIGHT, mSourceHeight);
+  mVCapture->set (cv::CAP_PROP_FOURCC,       mFourcc);
+  mVCapture->set (cv::CAP_PROP_FRAME_WIDTH,  mSourceWidth);
+  mVCapture->set (cv::CAP_PROP_FRAME_HEIGHT, mSourceHeight);
 
-  int actualFOURCC = mVCapture.get (cv::CAP_PROP_FOURCC);
-  int actualWidth  = mVCapture.get (cv::CAP_PROP_FRAME_WIDTH);
-  int actualHeight = mVCapture.get (cv::CAP_PROP_FRAME_HEIGHT);
+  int actualFOURCC = mVCapture->get (cv::CAP_PROP_FOURCC);
+  int actualWidth  = mVCapture->get (cv::CAP_PROP_FRAME_WIDTH);
+  int actualHeight = mVCapture->get (cv::CAP_PROP_FRAME_HEIGHT);
 
   if (actualFOURCC != mFourcc)
   {
@@ -160,153 +181,508 @@ bool WebcamThread::Initalize()
     mSourceHeight = actualHeight;
   }
 
-	// get FPS over 60 frames
-	int nFrames = 60;
-	PrecisionTime t1 = PrecisionTime::Now();
-	for (int i = 0; i < nFrames; i++)
-	{
-		cv::Mat Frame;
-		mVCapture >> Frame;
-	}
-	PrecisionTime t2 = PrecisionTime::UnsignedDiff(PrecisionTime::Now(), t1);
-	int fps = 1000.0f / (float(t2) / nFrames);
-	mTargetFps = fps / mDecimation;
-	bciout << "Camera " << mCameraIndex << " Target FPS: " << mTargetFps;
+  // with passthrough, ask the backend for the camera's bitstream instead of decoded pixels
+  mCompressed = false;
+  if (mPassthrough && !Mp4Muxer::CodecFor (mFourcc, mCodec))
+    bciwarn << "WebcamLogger: Passthrough for camera " << mCameraIndex
+            << " needs FOURCC MJPG or H264; its frames will be encoded" << std::endl;
+  else if (mPassthrough)
+  {
+    mVCapture->set (cv::CAP_PROP_CONVERT_RGB, 0);
+    mCompressed = true;
+  }
 
-	mMutex.Release();
-		
-	mWinName = "Camera " + std::to_string(mCameraIndex);
+  // the first frame tells us the pixel format the camera delivers
+	cv::Mat Frame;
+	*mVCapture >> Frame;
+
+  // backends that cannot hand out the bitstream decode anyway; then we encode as usual
+  if (mCompressed && !(Frame.rows == 1 && Frame.type () == CV_8UC1 && Frame.isContinuous ()
+                       && Mp4Muxer::IsSample (mCodec, Frame.data, Frame.total ())))
+  {
+    bciwarn << "WebcamLogger: The capture backend of camera " << mCameraIndex
+            << " does not deliver the camera's compressed stream; its frames will be encoded" << std::endl;
+    mCompressed = false;
+    mVCapture->set (cv::CAP_PROP_CONVERT_RGB, 1);
+    *mVCapture >> Frame;
+  }
+  if (mCompressed && mCodec == Mp4Muxer::H264 && mDecimation > 1)
+    bciwarn << "WebcamLogger: Decimation of camera " << mCameraIndex
+            << " is ignored, because H264 frames depend on the frames before them" << std::endl;
+  if (mCompressed && mCodec == Mp4Muxer::H264 && (mDisplayStream || mDateLocation != 0))
+    bciwarn << "WebcamLogger: Camera " << mCameraIndex
+            << " records H264 without decoding it, so it has no preview and no date/time overlay" << std::endl;
+
+  // the recorded region; a compressed stream is recorded as it is
+  std::string scaleError;
+  cv::Size    cameraSize = Frame.empty () || mCompressed ? cv::Size (mSourceWidth, mSourceHeight) : Frame.size ();
+  if (mCompressed && (!mRecordCrop.empty () || mRecordSize.width > 0))
+    bciwarn << "WebcamLogger: Camera " << mCameraIndex << " records its compressed stream as it is,"
+            << " so RecordSize and Crop do not apply" << std::endl;
+  if (!mScaler.Configure (cameraSize, mCompressed ? cv::Rect () : mRecordCrop,
+                          mCompressed ? cv::Size () : mRecordSize, scaleError))
+  {
+    bciwarn << "WebcamLogger: Camera " << mCameraIndex << " records its whole image, because "
+            << scaleError << std::endl;
+    mScaler.Configure (cameraSize, cv::Rect (), cv::Size (), scaleError);
+  }
 
+  // decode JPEG samples for the preview no larger than it is shown
+  mPreviewReduction = 1;
+  while (mCompressed && mPreviewReduction < 8 && mDisplay.Scale () * mPreviewReduction * 2 <= 1.0)
+    mPreviewReduction *= 2;
+
+  // use the frame rate of the negotiated mode. Only if the backend does not report one
+  //   do we time a few frames; the estimate is refined while streaming either way.
+  const char* fpsSource = "driver";
+  mCameraFps = mVCapture->get (cv::CAP_PROP_FPS);
+  if (!(mCameraFps > 0 && mCameraFps < 1000) && mFpsMeasureFrames > 0)
+  {
+    fpsSource = "measured";
+    Clock::time_point t1 = Clock::now ();
+    for (int i = 0; i < mFpsMeasureFrames; i++)
+      mVCapture->grab ();
+    std::chrono::duration<double> elapsed = Clock::now () - t1;
+    mCameraFps = elapsed.count () > 0 ? mFpsMeasureFrames / elapsed.count () : 0;
+  }
+  if (!(mCameraFps > 0 && mCameraFps < 1000))
+  {
+    fpsSource  = "assumed";
+    mCameraFps = DEFAULT_CAMERA_FPS;
+  }
+	mTargetFps = mCameraFps / mDecimation;
+  mFrameInterval = 1.0 / mCameraFps;
+
+  // size the frame pool from what the camera actually delivers. Every queue slot may
+  //   hold a frame, plus the ones being captured, displayed and encoded.
+  cv::Size frameSize = Frame.empty () ? cv::Size (mSourceWidth, mSourceHeight) : Frame.size ();
+  int      frameType = Frame.empty () ? CV_8UC3 : Frame.type ();
+  if (mScaler.Enabled ())
+    frameSize = mScaler.OutputSize ();
+  if (mCompressed)
+  {
+    // samples vary in size; each buffer holds a typical one with room to spare
+    frameSize = cv::Size (std::max<int> (static_cast<int> (Frame.total ()) * 2,
+                                         mSourceWidth * mSourceHeight * SAMPLE_BYTES_PER_PIXEL), 1);
+    frameType = CV_8UC1;
+  }
+  // Frames of a chunk stay leased until the pool has encoded them, so chunked encoding
+  //   needs room for as many chunks as the pool lets one camera have in flight.
+  int poolSize = mWriter.GetQueue ().Capacity () + FRAME_POOL_SPARE;
+  if (!mCompressed)
+    poolSize += (EncoderPool::Instance ().Threads () + 1) * mEncodeChunkFrames;
+  // Pages go to the memory node of the core that first touches them, so buffers allocated
+  //   while running on the capture cores are local to the capture thread.
+  std::vector<int> previousCores;
+  bool pinned = ThreadPlacement::PinCurrentThread (mCapturePlacement.Cores (), previousCores);
+  mBufferNode = pinned ? ThreadPlacement::CurrentNode () : -1;
+  mFramePool.Allocate (poolSize, frameSize, frameType);
+  if (pinned)
+    ThreadPlacement::PinCurrentThread (previousCores, previousCores);
+
+  mPreTrigger.Configure (mPreTriggerNs, mPreTriggerBytes);
+  mCameraFrames = 0;
+
+  // slots are as large as the pooled buffers; larger compressed samples are not published
+  mSharedRing.Close ();
+  if (mSharedFrames > 0
+      && !mSharedRing.Open (mCameraIndex, mSharedFrames, frameSize.area () * CV_ELEM_SIZE (frameType),
+                            mCompressed ? static_cast<uint32_t> (mFourcc) : 0))
+    bciwarn << "WebcamLogger: Could not share the frames of camera " << mCameraIndex
+            << " as " << SharedFramesName (mCameraIndex) << std::endl;
+
+  // gating needs the pixels, and H264 frames cannot be left out
+  if (mCompressed && mActivityThreshold > 0)
+    bciwarn << "WebcamLogger: Camera " << mCameraIndex << " records its compressed stream as it is,"
+            << " so it records every frame regardless of activity" << std::endl;
+  mGate.Configure (mCompressed ? 0 : mActivityThreshold, mIdleFps, mActivityHoldNs);
+
+  // features are measured on pixels, too
+  if (mCompressed && mFeatureSet != 0 && !mFeatureRegions.empty ())
+    bciwarn << "WebcamLogger: Camera " << mCameraIndex << " records its compressed stream as it is,"
+            << " so it publishes no video features" << std::endl;
+  mFeatures.Configure (mCompressed ? 0 : mFeatureSet, mFeatureRegions, RecordSize (), mCameraIndex);
+
+	mMutex.Release();
 
   this->InitalizeText();
 
-  // everthing has been successful up to this point, so we can start the thread
-  this->Start ();
+  // opening the video file at the start of a run should not have to wait for the codec
+  if (!mCompressed)
+    mWriter.Warmup (mFourcc, mTargetFps, RecordSize (), CV_MAT_CN (frameType) != 1);
+
+  // everthing has been successful up to this point, so we can start the threads
+  mWriter.StartIfNotRunning ();
+  if (mDisplayStream)
+    mDisplay.StartIfNotRunning ();
+  if (!mExternalCapture)
+    this->Start ();
+
+  std::chrono::duration<double, std::milli> readyTime = Clock::now () - configStart;
+	bciout << "Camera " << mCameraIndex << " ready in " << (int)readyTime.count () << " ms, "
+         << mCameraFps.load () << " fps (" << fpsSource << "), Target FPS: " << mTargetFps.load ();
+  if (mScaler.Enabled ())
+    bciout << "Camera " << mCameraIndex << " records " << mScaler.Crop ().width << "x" << mScaler.Crop ().height
+           << " at " << mScaler.Crop ().x << "," << mScaler.Crop ().y << " of its " << mSourceWidth << "x" << mSourceHeight
+           << " image, as " << mScaler.OutputSize ().width << "x" << mScaler.OutputSize ().height;
 
 	return true;
 }
 
 WebcamThread::~WebcamThread()
 {
-	cv::destroyWindow (mWinName);
   StopStream ();
 }
 
+cv::Size WebcamThread::RecordSize () const
+{
+  return mScaler.Enabled () ? mScaler.OutputSize () : cv::Size (mSourceWidth, mSourceHeight);
+}
+
 void WebcamThread::StartRecording(std::string _outputFile)
 {
-  this->StartIfNotRunning ();
+  if (!mExternalCapture)
+    this->StartIfNotRunning ();
 
-	// open video recorder
-	std::string outputFileName = _outputFile + "_" + std::to_string(mCameraIndex) + "_vid.mp4";
+  // the running estimate is more accurate than what we had at Initalize ()
+  double interval = mFrameInterval;
+  if (interval > 0)
+  {
+    float cameraFps = static_cast<float> (1.0 / interval);
+    mCameraFps = cameraFps;
+    mTargetFps = cameraFps / mDecimation;
+  }
 
-	mVideoWriter.open(outputFileName, mFourcc, mTargetFps, cv::Size(mSourceWidth, mSourceHeight), true);
+	// open video recorder and its frame index. Frames captured meanwhile are held, and
+  //   recorded ahead of the later ones.
+	std::string outputFileBase = _outputFile + "_" + std::to_string(mCameraIndex) + "_vid";
 
-	if (!mVideoWriter.isOpened())
+  mPreTrigger.Hold (true);
+  bool isColor = CV_MAT_CN (mFramePool.FrameType ()) != 1;
+	if (!mWriter.Open(outputFileBase + ".mp4", outputFileBase + ".frameidx", mFourcc, mTargetFps, RecordSize (), isColor, mCompressed))
 	{
 		bciwarn << "WebcamLogger Error: Could not open file for recording camera " << mCameraIndex << " video." 
 						<< " Trying a different FOURCC codec may resolve this issue";
+    mPreTrigger.Hold (false);
 		return;
 	}
 
 	bciout << "Started Recording Camera " << mCameraIndex;
 
-	mFrameNum  = 0;
-	mCount     = 0;
-  mRecording = true;
+  // capture goes on while the writer opens, and the pre-trigger keeps the gate going, so
+  //   the capture thread resets its own state before it uses it again
+  mRestart = true;
+  mTelemetry.Reset ();
+  mRecording    = true;
 }
 
-void WebcamThread::StopRecording()
+void WebcamThread::StopRecording(Clock::time_point _deadline)
 {
+  bool wasRecording = mRecording;
   mRecording = false;
-	if (mVideoWriter.isOpened())
+
+  // wait for the writer to encode what is still queued before closing the file
+  Clock::time_point flushStart = Clock::now ();
+  mWriter.Close (_deadline);
+  std::chrono::duration<double, std::milli> flushTime = Clock::now () - flushStart;
+	if (wasRecording)
 	{
-		bciout << "Stopped Recording Camera " << mCameraIndex;
+    const WebcamWriter::Queue& queue = mWriter.GetQueue ();
+		bciout << "Stopped Recording Camera " << mCameraIndex << " in " << static_cast<int> (flushTime.count ()) << " ms: "
+           << mWriter.FramesWritten () << " frames written, "
+           << queue.Dropped () << " dropped, queue high water "
+           << queue.HighWater () << "/" << queue.Capacity ()
+           << ", frame pool high water " << mFramePool.HighWater () << "/" << mFramePool.Size ()
+           << " (" << mFramePool.Misses () << " misses)";
+    bciout << mTelemetry.Summary (mCameraIndex, queue.Dropped ());
+    if (queue.Dropped () > 0)
+      bciwarn << "WebcamLogger: Camera " << mCameraIndex << " dropped " << queue.Dropped ()
+              << " frames because the encoder could not keep up" << std::endl;
+    if (mWriter.FramesDiscarded () > 0)
+      bciwarn << "WebcamLogger: Camera " << mCameraIndex << " discarded " << mWriter.FramesDiscarded ()
+              << " frames that were not written by the end of StopTimeoutSeconds" << std::endl;
+    if (mTelemetry.missed > 0)
+      bciwarn << "WebcamLogger: Camera " << mCameraIndex << " did not deliver " << mTelemetry.missed
+              << " frames; the camera or its USB bus may be overloaded" << std::endl;
 	}
-	mVideoWriter.release();
 }
 
 void WebcamThread::InitalizeText()
 {
-	std::string currentTime = TimeToString(Now());
-	int baseline;
-
-	// get the size of bounding box of text
-	cv::Size textSize = cv::getTextSize(currentTime, cv::FONT_HERSHEY_SIMPLEX, 0.5, 1, &baseline);
-
-	// find appropriate point to put the text
-  mAddDate = true;
-	switch (mDateLocation) {
-	case 1: // Upper Right
-		mDatePoint = cv::Point(mSourceWidth - 10 - textSize.width, 10 + textSize.height);
-		break;
-	case 2: // Upper Left
-    mDatePoint = cv::Point(10, 10 + textSize.height);
-		break;
-	case 3: // Lower Right
-    mDatePoint = cv::Point(mSourceWidth - 10 - textSize.width, mSourceHeight - 10 - baseline);
-		break;
-	case 4: // Lower Left
-    mDatePoint = cv::Point(10, mSourceHeight - 10 - baseline);
-		break;
-	default:
-    mAddDate = false;
-    mDatePoint = cv::Point(10, 10);
-		break;
-	}
+  // the overlay is rendered in the size and pixel type of the pooled frames, or of the
+  //   preview when frames are recorded compressed
+  if (!mCompressed)
+    mOverlay.Initialize (mDateLocation, mDateDetail, mFramePool.FrameSize (), mFramePool.FrameType ());
+  else if (mCodec == Mp4Muxer::Jpeg)
+    mOverlay.Initialize (mDateLocation, mDateDetail,
+                         cv::Size ((mSourceWidth  + mPreviewReduction - 1) / mPreviewReduction,
+                                   (mSourceHeight + mPreviewReduction - 1) / mPreviewReduction), CV_8UC3);
+  else
+    mOverlay.Initialize (0, mDateDetail, cv::Size (), CV_8UC3);
+}
+
+bool WebcamThread::KeepFrame(Clock::time_point _grabTime)
+{
+  float targetFps = mTargetFps;
+  float cameraFps = mCameraFps;
+  if (mDecimation <= 1 || targetFps <= 0)
+    return true;
+  if (mCompressed && mCodec == Mp4Muxer::H264)
+    return true;
+
+  if (mDecimationMode == DecimateByCount)
+    return (mCount % mDecimation) == 0;
+
+  // Keep the first frame at or after the scheduled time. Half a camera frame interval of
+  //   slack keeps jitter in the frame arrival from skipping the frame that was due.
+  Clock::duration outputPeriod = std::chrono::duration_cast<Clock::duration> (
+    std::chrono::duration<double> (1.0 / targetFps));
+  Clock::duration slack = std::chrono::duration_cast<Clock::duration> (
+    std::chrono::duration<double> (0.5 / cameraFps));
+
+  if (_grabTime + slack < mNextKeepTime)
+    return false;
+
+  // schedule the next frame; re-anchor to this one if we fell more than a period behind
+  mNextKeepTime += outputPeriod;
+  if (mNextKeepTime + outputPeriod < _grabTime)
+    mNextKeepTime = _grabTime + outputPeriod;
+  return true;
 }
 
 void WebcamThread::GetFrame()
 {
+	// wait for the next frame from the device. grab() does not decode, so frames that
+  //   are decimated away cost almost nothing but still keep the driver buffer fresh.
+  if (!mVCapture->grab ())
+  {
+    std::this_thread::sleep_for (std::chrono::milliseconds (10));
+    return;
+  }
+  Clock::time_point grabTime = Clock::now ();
+  if (mRestart.exchange (false))
+  {
+    mCount            = 0;
+    mNextKeepTime     = Clock::time_point ();
+    mLastDriverTimeMs = -1;
+    mGate.Reset ();
+    mFeatures.Reset ();
+  }
 	mCount++;
-	if ((mCount % mDecimation) == 0)
+  mCameraFrames++;
+
+  // refine the camera frame rate; gaps of a second or more are stalls, not the frame rate
+  if (mLastGrabTime != Clock::time_point ())
+  {
+    double dt       = std::chrono::duration<double> (grabTime - mLastGrabTime).count ();
+    double interval = mFrameInterval;
+    if (dt > 0 && dt < 1)
+      mFrameInterval = (1 - FPS_ESTIMATE_WEIGHT) * interval + FPS_ESTIMATE_WEIGHT * dt;
+    if (mRecording && interval > 0)
+    {
+      mTelemetry.captureJitterUs.Record ((uint64_t)(std::abs (dt - interval) * 1e6));
+      if (dt > MISSED_FRAME_INTERVALS * interval)
+        mTelemetry.missed.fetch_add ((uint64_t)(dt / interval + 0.5) - 1, std::memory_order_relaxed);
+    }
+  }
+  mLastGrabTime = grabTime;
+
+	if (!this->KeepFrame (grabTime))
+    return;
+
+	// wrap the driver buffer if the backend can lend it, else decode the new frame into a pooled buffer
+	WebcamFrame Frame;
+  if (mScaler.Enabled ())
+  {
+    // the camera image is only the source of the recorded region, which goes to a pooled buffer
+    WebcamFrame source;
+    bool leased = mV4l2 && mV4l2->Lease (source);
+    if (!leased && !mVCapture->retrieve (mCaptured))
+      return;
+    mFramePool.Lease (Frame);
+    mScaler.Apply (leased ? source.image : mCaptured, Frame.image);
+  }
+  else if (!(mV4l2 && mV4l2->Lease (Frame)))
+  {
+    mFramePool.Lease (Frame);
+    if (mCompressed ? !this->RetrieveSample (Frame) : !mVCapture->retrieve (Frame.image))
+      return;
+  }
+  Frame.captureTime   = PrecisionTime::Now ();
+  Frame.captureTimeNs = FrameIndexTime (grabTime);
+  Frame.driverTimeMs  = mVCapture->get (cv::CAP_PROP_POS_MSEC);
+  Frame.cameraFrame   = mCameraFrames;
+  Frame.flags         = 0;
+  if (mV4l2 && mV4l2->KernelTimestampNs () > 0)
+    Frame.captureTimeNs = mV4l2->KernelTimestampNs ();   // when the driver received it, same clock
+
+  // on a static scene only some frames are recorded; decided before the overlay changes the image
+  bool isStatic = false;
+  bool keep     = true;
+  if (mGate.Enabled () && (mRecording || mPreTrigger.Active ()))
+  {
+    keep        = mGate.Keep (Frame.image, Frame.captureTimeNs, isStatic);
+    Frame.flags = isStatic ? FRAMEINDEX_FLAG_STATIC : 0;
+    if (!keep && mRecording)
+      mTelemetry.gated.fetch_add (1, std::memory_order_relaxed);
+  }
+
+  // a driver timestamp that did not advance means the same frame was delivered again
+  if (Frame.driverTimeMs > 0 && Frame.driverTimeMs == mLastDriverTimeMs && mRecording)
+    mTelemetry.duplicated.fetch_add (1, std::memory_order_relaxed);
+  mLastDriverTimeMs = Frame.driverTimeMs;
+
+  // other processes get the frame as the camera delivered it, without the overlay
+  if (mSharedRing.IsOpen ())
+    mSharedRing.Publish (Frame);
+
+  // features are published right away, and measured before the overlay is drawn
+  if (mRecording && mFeatures.Enabled ())
+  {
+    mFeatures.Compute (Frame.image);
+    mFeatures.Publish ();
+    mTelemetry.featureLatencyUs.Record ((FrameIndexTime (Clock::now ()) - Frame.captureTimeNs) / 1000);
+  }
+
+	if (mCompressed)
+  {
+    // the recording is left as the camera compressed it; only the preview needs pixels
+    this->ShowSample (Frame, grabTime);
+  }
+	else if (mOverlay.Enabled ())
+	{
+		// add text to the image
+    Clock::time_point overlayStart = Clock::now ();
+    mOverlay.Apply (Frame.image, std::chrono::system_clock::now (), Frame.cameraFrame);
+    mTelemetry.overlayUs.Record (std::chrono::duration_cast<std::chrono::microseconds> (Clock::now () - overlayStart).count ());
+	}
+
+	if (mDisplayStream && !mCompressed && mDisplay.FrameDue (grabTime))
 	{
-		// get new frame
-		cv::Mat Frame;
-		mVCapture >> Frame;
-
-		if (mAddDate)
-		{
-			// add text to the image
-			cv::putText(Frame, TimeToString(Now()), mDatePoint, cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(255, 255, 255));
-		}
-
-		if (mDisplayStream)
-		{
-			// display image to window
-			cv::imshow(mWinName, Frame);
-			cv::waitKey(5);
-		}
-	
-		if (mRecording)
-		{
-			// write image to file
-			mVideoWriter << Frame;
-			bcievent << "WebcamFrame" + std::to_string(mCameraIndex) + " " << ++mFrameNum;
-		}
+		// hand a scaled copy to the display thread, at most at the preview rate
+    mDisplay.Offer (Frame.image, grabTime);
 	}
-	else
+
+	if (mRecording && keep)
 	{
-		if (mRecording)
-			bcievent << "WebcamFrame" + std::to_string(mCameraIndex) + " " << 0;
+    // frames from before the recording go first
+    if (!mPreTrigger.Empty ())
+    {
+      std::deque<WebcamFrame> early;
+      mPreTrigger.Take (early);
+      mWriter.Preload (early);
+    }
+
+		// hand the image to the writer thread, which encodes it, sets the state
+    //   and returns the buffer to the pool
+    mTelemetry.queueDepth.Record (mWriter.GetQueue ().Depth ());
+    mWriter.Submit (Frame);
+    mTelemetry.Publish (mCameraIndex, mTelemetryStates, mWriter.GetQueue ().Dropped (), TELEMETRY_STATE_PERIOD_MS);
 	}
+  else if (!mRecording && keep && mPreTrigger.Active ())
+    mPreTrigger.Keep (Frame);
+}
+
+bool WebcamThread::RetrieveSample (WebcamFrame& _frame)
+{
+  if (!mVCapture->retrieve (mPacket) || mPacket.empty ())
+    return false;
+  if (!mPacket.isContinuous ())
+    mPacket = mPacket.clone ();
+
+  // copy the sample into the front of the pooled buffer, or a buffer of its own if it is larger
+  int bytes = static_cast<int> (mPacket.total () * mPacket.elemSize ());
+  if (bytes <= _frame.image.cols)
+    _frame.image = _frame.image.colRange (0, bytes);
+  else
+    _frame.image.create (1, bytes, CV_8UC1);
+  ::memcpy (_frame.image.data, mPacket.data, bytes);
+  return true;
+}
+
+void WebcamThread::ShowSample (const WebcamFrame& _frame, Clock::time_point _grabTime)
+{
+  if (!mDisplayStream || mCodec != Mp4Muxer::Jpeg || !mDisplay.FrameDue (_grabTime))
+    return;
+
+  // decoded at most at the preview rate, and at reduced size where the preview is scaled down
+  int flags = mPreviewReduction == 8 ? cv::IMREAD_REDUCED_COLOR_8
+            : mPreviewReduction == 4 ? cv::IMREAD_REDUCED_COLOR_4
+            : mPreviewReduction == 2 ? cv::IMREAD_REDUCED_COLOR_2
+            : cv::IMREAD_COLOR;
+  cv::imdecode (_frame.image, flags, &mPreview);
+  if (mPreview.empty ())
+    return;
+  if (mOverlay.Enabled ())
+    mOverlay.Apply (mPreview, std::chrono::system_clock::now (), _frame.cameraFrame);
+  mDisplay.Offer (mPreview, _grabTime, mPreviewReduction);
+}
+
+WebcamThread::Clock::time_point WebcamThread::NextFrameTime () const
+{
+  // devices are waited on; only virtual cameras know when their next frame is due
+  const VirtualCamera* camera = dynamic_cast<const VirtualCamera*> (mVCapture.get ());
+  return camera ? camera->NextFrameTime () : Clock::now ();
 }
 
 int WebcamThread::OnExecute()
 {
-	mFrameNum = 0;
+  mCapturePlacement.Apply ();
 	bciout << "Camera " << mCameraIndex << " thread started";
 	while (!this->Terminating())
 	{
-		if (mVCapture.isOpened())
+		if (mVCapture && mVCapture->isOpened())
 			this->GetFrame();
+    else
+      std::this_thread::sleep_for (std::chrono::milliseconds (10));
 	}
 	bciout << "Camera " << mCameraIndex << " thread ended";
 	return 0;
 }
 
+void WebcamThread::SetPlacement (const std::vector<int>& _captureCores, const std::vector<int>& _encodeCores,
+                                 const std::vector<int>& _displayCores, ThreadPlacement::Priority _capturePriority,
+                                 ThreadPlacement::Priority _encodePriority)
+{
+  mCapturePlacement.Configure (_captureCores, _capturePriority);
+  mWriter.SetPlacement  (_encodeCores,  _encodePriority);
+  mDisplay.SetPlacement (_displayCores, _encodePriority);
+}
+
+bool WebcamThread::PlacementReport (std::string& _report, int _timeoutMs) const
+{
+  std::ostringstream oss;
+  bool succeeded = true;
+  oss << "Camera " << mCameraIndex << " threads: capture ";
+  if (mExternalCapture)
+    oss << "on a shared capture thread";
+  else
+  {
+    mCapturePlacement.WaitApplied (_timeoutMs);
+    oss << "on " << mCapturePlacement.Report ();
+    succeeded = mCapturePlacement.Succeeded ();
+  }
+  mWriter.Placement ().WaitApplied (_timeoutMs);
+  oss << "; encode on " << mWriter.Placement ().Report ();
+  succeeded = succeeded && mWriter.Placement ().Succeeded ();
+  if (mDisplayStream)
+  {
+    mDisplay.Placement ().WaitApplied (_timeoutMs);
+    oss << "; display on " << mDisplay.Placement ().Report ();
+    succeeded = succeeded && mDisplay.Placement ().Succeeded ();
+  }
+  if (mBufferNode >= 0)
+    oss << "; frame buffers on memory node " << mBufferNode;
+  _report = oss.str ();
+  return succeeded;
+}
+
 void WebcamThread::StopStream ()
 { 
   this->TerminateAndWait ();
-  if (mVCapture.isOpened())
-    mVCapture.release ();
+  mDisplay.TerminateAndWait ();
+  mWriter.Shutdown ();
+  if (mVCapture && mVCapture->isOpened())
+    mVCapture->release ();
+  mSharedRing.Close ();
 }
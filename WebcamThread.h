@@ -36,18 +36,41 @@
 #include <ctime>
 #include <iomanip>
 #include <iostream>
+#include <chrono>
+#include <atomic>
 
 #include "WebcamLogger.h"
 #include "Thread.h"
 #include "Mutex.h"
 #include "PrecisionTime.h"
 #include "BCIEvent.h"
+#include "WebcamWriter.h"
+#include "FramePool.h"
+#include "TimestampOverlay.h"
+#include "WebcamDisplay.h"
+#include "VirtualCamera.h"
+#include "V4l2Camera.h"
+#include "PipelineTelemetry.h"
+#include "PreTriggerBuffer.h"
+#include "FrameScaler.h"
+#include "ActivityGate.h"
+#include "ThreadPlacement.h"
+#include "SharedFrameRing.h"
+#include "VideoFeatures.h"
 
 class WebcamLogger;
 
 class WebcamThread : public Thread
 {
 public:
+  typedef std::chrono::steady_clock Clock;
+
+  enum DecimationMode
+  {
+    DecimateByCount = 0,   // keep every n-th frame
+    DecimateByTime  = 1,   // keep frames at camera fps / n, chosen by timestamp
+  };
+
   WebcamThread ( int         _camIndex, 
                  int         _width, 
                  int         _height, 
@@ -55,35 +78,112 @@ public:
                  bool        _displayStream, 
                  int         _dateLocation,
                  bool        _useDirectShow,
-                 std::string _fourcc
+                 std::string _fourcc,
+                 int         _queueLength,
+                 int         _dropPolicy
   );
 
 	~WebcamThread      ();
 	int  OnExecute     () override;
 	void StartRecording(std::string _outputFile);
-	void StopRecording ();
+	// frames not written by _deadline are discarded
+	void StopRecording (Clock::time_point _deadline = Clock::time_point::max ());
 	bool Initalize     ();
-	bool Connected     () const { return mVCapture.isOpened(); }
+	bool Connected     () const { return mVCapture && mVCapture->isOpened(); }
   void StopStream    ();
 
+  // pipeline statistics of the last recording
+  const WebcamWriter& Writer () const { return mWriter; }
+  const FramePool&    Pool   () const { return mFramePool; }
+  const PipelineTelemetry& Telemetry () const { return mTelemetry; }
+
+  void SetDecimationMode   (int _mode)   { mDecimationMode = _mode; }
+  void SetDateTimeDetail   (int _detail) { mDateDetail = _detail; }
+  void SetFpsMeasureFrames (int _frames) { mFpsMeasureFrames = _frames; }
+  void SetSource           (const std::string& _source) { mSource = _source; }
+  void SetPreview          (double _refreshRate, double _scale) { mDisplay.Configure (_refreshRate, _scale); }
+  // PipelineTelemetry::Metric bits published as states while recording
+  void SetTelemetryStates  (int _states) { mTelemetryStates = _states; }
+  // when set before Initalize (), frames are captured by a CaptureReactor instead of this thread
+  void SetExternalCapture  (bool _external) { mExternalCapture = _external; }
+  // driver buffers of the v4l2 backend
+  void SetV4l2Buffers      (int _buffers) { mV4l2Buffers = _buffers; }
+  // record MJPG and H264 streams as the camera compressed them; takes effect at Initalize ()
+  void SetPassthrough      (bool _passthrough) { mPassthrough = _passthrough; }
+  bool Passthrough         () const { return mCompressed; }
+  // frames per chunk encoded on the shared EncoderPool, 0 to encode on the writer thread
+  void SetEncodeChunkFrames (int _frames) { mEncodeChunkFrames = _frames; mWriter.SetChunkFrames (_frames); }
+  // write the video in segments of this length, 0 for one file per run
+  void SetSegmentSeconds   (double _seconds) { mWriter.SetSegmentSeconds (_seconds); }
+  void SetVideoIo          (const VideoIoOptions& _options) { mWriter.SetVideoIo (_options); }
+  // region of the camera image that is recorded, and its recorded size; empty for the whole
+  //   image at the camera's size. Takes effect at Initalize ().
+  void SetRecordRegion     (cv::Rect _crop, cv::Size _size) { mRecordCrop = _crop; mRecordSize = _size; }
+  // size of the recorded frames
+  cv::Size RecordSize      () const;
+  // record every frame only while the scene moves, see ActivityGate; takes effect at Initalize ()
+  void SetActivityGate     (double _threshold, double _idleFps, double _holdSeconds)
+    { mActivityThreshold = _threshold; mIdleFps = _idleFps; mActivityHoldNs = static_cast<int64_t> (_holdSeconds * 1e9); }
+  // cores and priorities of the camera's capture, encode and display threads; frame buffers
+  //   are placed on the memory node of the capture cores. Takes effect at Initalize ().
+  void SetPlacement (const std::vector<int>& _captureCores, const std::vector<int>& _encodeCores,
+                     const std::vector<int>& _displayCores, ThreadPlacement::Priority _capturePriority,
+                     ThreadPlacement::Priority _encodePriority);
+  const ThreadPlacement& CapturePlacement () const { return mCapturePlacement; }
+  bool PlacementConfigured () const
+    { return mCapturePlacement.Configured () || mWriter.Placement ().Configured () || mDisplay.Placement ().Configured (); }
+  // waits for the threads to apply their placement and describes what they got; false if
+  //   the system refused any of it
+  bool PlacementReport (std::string& _report, int _timeoutMs) const;
+  // seconds before StartRecording () that are recorded with it; takes effect at Initalize ()
+  void SetPreTriggerSeconds (double _seconds) { mPreTriggerNs = static_cast<int64_t> (_seconds * 1e9); }
+  void SetPreTriggerLimit   (int _megabytes)  { mPreTriggerBytes = static_cast<size_t> (_megabytes) << 20; }
+  // recent frames published for other processes, see SharedFrameRing; 0 for none. Takes
+  //   effect at Initalize ().
+  void SetSharedFrames     (int _frames) { mSharedFrames = _frames; }
+  // VideoFeatures::Feature bits measured in _regions of the recorded image and published
+  //   while recording; takes effect at Initalize ()
+  void SetVideoFeatures    (int _features, const std::vector<cv::Rect>& _regions)
+    { mFeatureSet = _features; mFeatureRegions = _regions; }
+
+  // used by CaptureReactor to wait for and capture frames
+  bool              IsVirtual     () const { return VirtualCamera::IsVirtual (mSource); }
+  const cv::Ptr<cv::VideoCapture>& Capture () const { return mVCapture; }
+  int               PollFd        () const { return mV4l2 ? mV4l2->Fd () : -1; }
+  Clock::time_point NextFrameTime () const;
+  void              CaptureFrame  () { GetFrame (); }
+
 private:
 	void InitalizeText();
   void GetFrame     ();
+  bool KeepFrame    (Clock::time_point _grabTime);
+  bool RetrieveSample (WebcamFrame& _frame);
+  void ShowSample   (const WebcamFrame& _frame, Clock::time_point _grabTime);
 
 	Tiny::Mutex			   mMutex;
 	
   bool               mUseDirectShow;
-  cv::VideoCapture   mVCapture;
-	cv::VideoWriter    mVideoWriter;
-  std::string			   mWinName;
+  std::string        mSource;
+  cv::Ptr<cv::VideoCapture> mVCapture;   // a device, a V4l2Camera or a VirtualCamera
+  V4l2Camera*        mV4l2;         // mVCapture, if it is a V4l2Camera
+  int                mV4l2Buffers;
+  PipelineTelemetry  mTelemetry;
+  FramePool          mFramePool;   // must outlive the writer, whose queue holds leased frames
+  WebcamWriter       mWriter;
+  WebcamDisplay      mDisplay;
 
   bool						   mDisplayStream;
-  bool               mAddDate;
-	cv::Point				   mDatePoint;
+  TimestampOverlay   mOverlay;
   int                mDateLocation;
+  int                mDateDetail;
 
-  unsigned long		   mFrameNum;
+  // decimation state of the capture thread; StartRecording () asks for it, the activity
+  //   gate, the video features and the driver clock to be reset
   unsigned long		   mCount;
+  uint32_t           mCameraFrames;      // frames grabbed since Initalize ()
+  int                mDecimationMode;
+  Clock::time_point  mNextKeepTime;
+  std::atomic<bool>  mRestart;
 
   int 						   mSourceWidth;
   int                mSourceHeight;
@@ -91,7 +191,56 @@ private:
   int                mCameraIndex;
   int                mDecimation;
   int                mFourcc;
-	float						   mTargetFps;
+  int                mFpsMeasureFrames;
+  // updated by StartRecording () while the capture thread decimates with them
+  std::atomic<float> mCameraFps;
+  std::atomic<float> mTargetFps;
+
+  // running estimate of the camera frame interval in seconds, updated by the capture thread
+  std::atomic<double> mFrameInterval;
+  Clock::time_point  mLastGrabTime;
+  double             mLastDriverTimeMs;
+  int                mTelemetryStates;
+  bool               mExternalCapture;
+
+  // passthrough of the camera's compressed stream
+  bool               mPassthrough;
+  int                mEncodeChunkFrames;
+  bool               mCompressed;        // frames hold compressed samples of mCodec
+  Mp4Muxer::Codec    mCodec;
+  cv::Mat            mPacket;            // sample as retrieved, before it is copied to a pooled buffer
+  cv::Mat            mPreview;           // sample decoded for the preview
+  int                mPreviewReduction;  // the preview is decoded at 1/n of the camera size
+
+  // crop and resize ahead of the overlay and the encoder
+  cv::Rect           mRecordCrop;
+  cv::Size           mRecordSize;
+  FrameScaler        mScaler;
+  cv::Mat            mCaptured;          // camera image the recorded one is made from
+
+  // where the camera's threads run, and where its frame buffers were allocated
+  ThreadPlacement    mCapturePlacement;
+  int                mBufferNode;
+
+  // activity gating of the recording
+  double             mActivityThreshold;
+  double             mIdleFps;
+  int64_t            mActivityHoldNs;
+  ActivityGate       mGate;
+
+  // frames from before the recording, handed to the writer when it starts
+  PreTriggerBuffer   mPreTrigger;
+  int64_t            mPreTriggerNs;
+  size_t             mPreTriggerBytes;
+
+  // recent frames for other processes
+  int                mSharedFrames;
+  SharedFrameRing    mSharedRing;
+
+  // video features published as states
+  int                   mFeatureSet;
+  std::vector<cv::Rect> mFeatureRegions;
+  VideoFeatures         mFeatures;
 
   Synchronized<bool> mRecording;
 };
@@ -0,0 +1,370 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: WebcamWriter.cpp
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: The WebcamWriter is the encode stage of a camera. It drains
+// the frame queue filled by its WebcamThread, encodes the frames to the
+// video file and sets the frame number as a state value.
+//
+// Event Variables:
+//   WebcamFrame<n> - The current frame number for camera index n
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+
+#include "WebcamWriter.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+// longest an idle writer sleeps before it checks whether it is to terminate
+#define WRITER_WAIT_MS 100
+// how long the writer sleeps while the encoder pool is behind on its chunks
+#define WRITER_BUSY_MS 1
+
+WebcamWriter::WebcamWriter ( int               _camIndex,
+                             int               _queueLength,
+                             Queue::DropPolicy _dropPolicy ) :
+  mQueue       (_queueLength, _dropPolicy),
+  mTelemetry   (nullptr),
+  mEvents      (_camIndex),
+  mGopEncoder  (_camIndex),
+  mChunkFrames (0),
+  mSegmentNs   (0),
+  mSegmented   (false),
+  mManifestEntries (0),
+  mFourcc      (0),
+  mFps         (0),
+  mIsColor     (true),
+  mCameraIndex (_camIndex),
+  mFrameNum    (0),
+  mDiscarded   (0)
+{
+  mGopEncoder.SetFrameIndex (&mFrameIndex);
+  mQueue.Close ();
+}
+
+WebcamWriter::~WebcamWriter ()
+{
+  Shutdown ();
+}
+
+bool WebcamWriter::Open (const std::string& _videoFile, const std::string& _indexFile,
+                         int _fourcc, double _fps, cv::Size _size, bool _isColor,
+                         bool _passthrough)
+{
+  this->StartIfNotRunning ();
+
+  mMutex.Acquire ();
+  // the manifest goes next to the video, named after it
+  mSegmentBase = _videoFile.substr (0, _videoFile.rfind (".mp4"));
+  SegmentManifest* manifest = nullptr;
+  if (mSegmentNs > 0 && mManifest.Open (mSegmentBase + ".segments"))
+    manifest = &mManifest;
+  else if (mSegmentNs > 0)
+    bciwarn << "WebcamLogger: Could not create segment manifest " << mSegmentBase << ".segments"
+            << " for camera " << mCameraIndex << std::endl;
+  mManifestEntries = 0;
+  mMuxer.SetFragments      (mSegmentNs, manifest);
+  mGopEncoder.SetFragments (mSegmentNs, manifest);
+
+  bool opened = false;
+  mSegmented  = false;
+  Mp4Muxer::Codec codec;
+  if (_passthrough && Mp4Muxer::CodecFor (_fourcc, codec))
+    opened = mMuxer.Open (_videoFile, codec, _size.width, _size.height, _fps);
+  else if (!_passthrough && mChunkFrames > 0)
+    opened = mGopEncoder.Open (_videoFile, _fourcc, _fps, _size, _isColor, mChunkFrames);
+  else if (!_passthrough && mSegmentNs > 0)
+  {
+    mFourcc     = _fourcc;
+    mFps        = _fps;
+    mSize       = _size;
+    mIsColor    = _isColor;
+    mSegmented  = true;
+    mSegment.segment     = 0;
+    mSegment.offset      = 0;
+    mSegment.firstSample = 1;
+    opened = OpenSegment ();
+  }
+  else if (!_passthrough)
+  {
+    mVideoWriter.open (_videoFile, _fourcc, _fps, _size, _isColor);
+    opened = mVideoWriter.isOpened ();
+  }
+  if (mVideoIo.bufferBytes > 0 && mVideoIo.direct && (mMuxer.IsOpen () || mGopEncoder.IsOpen ())
+      && !mMuxer.DirectIo () && !mGopEncoder.DirectIo ())
+    bciwarn << "WebcamLogger: The file system of " << _videoFile << " does not support direct I/O;"
+            << " camera " << mCameraIndex << " writes its video through the cache" << std::endl;
+  else if (mVideoIo.bufferBytes > 0 && mVideoWriter.isOpened ())
+    bciwarn << "WebcamLogger: Camera " << mCameraIndex << " encodes on its writer thread, whose"
+            << " video file is not written through VideoIoBufferKB buffers; set EncodeChunkFrames"
+            << " to have its video muxed" << std::endl;
+  if (opened && !mFrameIndex.Open (_indexFile, mCameraIndex, _fps))
+    bciwarn << "WebcamLogger: Could not create frame index " << _indexFile
+            << " for camera " << mCameraIndex << std::endl;
+  mFrameNum = 0;
+  mQueue.ResetStatistics ();
+  mMutex.Release ();
+
+  if (opened)
+  {
+    FrameEvents::Instance ().Attach (&mEvents);
+    mQueue.Open ();
+  }
+  return opened;
+}
+
+void WebcamWriter::Close (std::chrono::steady_clock::time_point _deadline)
+{
+  // refuse new frames, then let the writer thread drain what is still queued
+  mQueue.Close ();
+  mDrained.WaitUntil (_deadline, [this] () { return !this->Running () || !Pending (); });
+
+  mMutex.Acquire ();
+  // frames left over past the deadline, or if the thread is not running, are discarded
+  WebcamFrame leftover;
+  mDiscarded = mPreload.size ();
+  while (mQueue.TryPop (leftover))
+    mDiscarded++;
+  mPreload.clear ();
+  if (mSegmented && mVideoWriter.isOpened ())
+    CloseSegment ();
+  else if (mVideoWriter.isOpened ())
+    mVideoWriter.release ();
+  mSegmented = false;
+  if (mMuxer.Skipped () > 0)
+    bciwarn << "WebcamLogger: Camera " << mCameraIndex << " sent " << mMuxer.Skipped ()
+            << " frames before its first key frame; they were not recorded" << std::endl;
+  mMuxer.Close ();
+  if (mGopEncoder.IsOpen ())
+  {
+    mGopEncoder.Close (_deadline);
+    if (mGopEncoder.LostFrames () > 0)
+      bciwarn << "WebcamLogger: " << mGopEncoder.LostFrames () << " frames of camera " << mCameraIndex
+              << " are missing from the video file; see its frame index for which were recorded" << std::endl;
+  }
+  mFrameIndex.Close ();
+  mManifest.Close ();
+  mMutex.Release ();
+  // the events of all written frames are set before the run ends
+  FrameEvents::Instance ().Detach (&mEvents);
+}
+
+bool WebcamWriter::Pending ()
+{
+  mMutex.Acquire ();
+  bool pending = !mPreload.empty () || !mQueue.Empty ();
+  mMutex.Release ();
+  return pending;
+}
+
+void WebcamWriter::Preload (std::deque<WebcamFrame>& _frames)
+{
+  mMutex.Acquire ();
+  while (!_frames.empty ())
+  {
+    mPreload.push_back (std::move (_frames.front ()));
+    _frames.pop_front ();
+  }
+  mMutex.Release ();
+  mQueue.Wake ();
+}
+
+void WebcamWriter::Warmup (int _fourcc, double _fps, cv::Size _size, bool _isColor)
+{
+  if (mChunkFrames > 0)
+    EncoderPool::Instance ().Start ();
+
+  // the first writer a process opens loads and initializes the codec; a throwaway one
+  //   takes that time out of the start of the run
+  std::string file = cv::tempfile (".mp4");
+  cv::VideoWriter writer;
+  if (writer.open (file, _fourcc, _fps, _size, _isColor))
+  {
+    writer << cv::Mat::zeros (_size, _isColor ? CV_8UC3 : CV_8UC1);
+    writer.release ();
+  }
+  std::remove (file.c_str ());
+}
+
+bool WebcamWriter::OpenSegment ()
+{
+  char number[16];
+  ::snprintf (number, sizeof (number), ".%04u.mp4", mSegment.segment);
+  std::string file = mSegmentBase + number;
+  mSegment.file    = file.substr (file.find_last_of ("/\\") + 1);
+  mSegment.samples = 0;
+  mVideoWriter.open (file, mFourcc, mFps, mSize, mIsColor);
+  return mVideoWriter.isOpened ();
+}
+
+void WebcamWriter::CloseSegment ()
+{
+  // releasing the writer completes the file
+  mVideoWriter.release ();
+  if (mSegment.samples > 0)
+    mManifest.Append (mSegment);
+  mSegment.segment++;
+  mSegment.firstSample += mSegment.samples;
+}
+
+void WebcamWriter::SetVideoIo (const VideoIoOptions& _options)
+{
+  mVideoIo = _options;
+  mMuxer.SetVideoIo      (_options);
+  mGopEncoder.SetVideoIo (_options);
+}
+
+void WebcamWriter::Shutdown ()
+{
+  Close ();
+  this->Terminate ();
+  mQueue.Wake ();
+  this->TerminateAndWait ();
+}
+
+bool WebcamWriter::Submit (WebcamFrame& _frame)
+{
+  return mQueue.Push (_frame);
+}
+
+void WebcamWriter::WriteFrame (WebcamFrame& _frame)
+{
+  // write image to file, or the compressed sample as it came from the camera
+  std::chrono::steady_clock::time_point encodeStart = std::chrono::steady_clock::now ();
+  if (mMuxer.IsOpen ())
+  {
+    uint64_t samples = mMuxer.Samples ();
+    mMuxer.Write (_frame.image.data, _frame.image.total () * _frame.image.elemSize (), _frame.captureTimeNs);
+    // frames that were not muxed get no event, so that every event refers to the file
+    if (mMuxer.Samples () == samples)
+      return;
+  }
+  else if (mGopEncoder.IsOpen ())
+    ; // handed to the pool below, together with its index record
+  else if (mVideoWriter.isOpened ())
+  {
+    // a segment file ends before the first frame past its length, so each begins with a key frame
+    if (mSegmented && mSegment.samples > 0 && _frame.captureTimeNs - mSegment.firstTimeNs >= mSegmentNs)
+    {
+      CloseSegment ();
+      if (!OpenSegment ())
+      {
+        bciwarn << "WebcamLogger: Could not create video segment " << mSegment.file
+                << " for camera " << mCameraIndex << "; recording stops" << std::endl;
+        return;
+      }
+    }
+    mVideoWriter << _frame.image;
+    if (mSegmented)
+    {
+      if (mSegment.samples++ == 0)
+        mSegment.firstTimeNs = _frame.captureTimeNs;
+      mSegment.lastTimeNs = _frame.captureTimeNs;
+    }
+  }
+  else
+    return;
+  std::chrono::steady_clock::time_point encodeEnd = std::chrono::steady_clock::now ();
+  ++mFrameNum;
+  // the camera frame number, as burned in by the overlay; the index maps it to the file position
+  mEvents.Post (_frame.cameraFrame, _frame.captureTimeNs);
+
+  if (mTelemetry)
+    mTelemetry->encodeUs.Record (std::chrono::duration_cast<std::chrono::microseconds> (encodeEnd - encodeStart).count ());
+
+  // a chunked frame is indexed by the encoder once its chunk is in the file
+  if (mGopEncoder.IsOpen ())
+    mGopEncoder.Add (_frame, IndexRecord (_frame, encodeEnd));
+  else
+  {
+    mFrameIndex.Append (IndexRecord (_frame, encodeEnd));
+    FlushIndex ();
+  }
+}
+
+FrameIndexRecord WebcamWriter::IndexRecord (const WebcamFrame& _frame, std::chrono::steady_clock::time_point _encoded) const
+{
+  FrameIndexRecord record;
+  record.frameNumber          = static_cast<uint32_t> (mFrameNum);
+  record.capturePrecisionTime = _frame.captureTime;
+  record.encodedPrecisionTime = PrecisionTime::Now ();
+  record.captureTimeNs        = _frame.captureTimeNs;
+  record.driverTimeMs         = _frame.driverTimeMs;
+  record.encodedTimeNs        = FrameIndexTime (_encoded);
+  record.cameraFrame          = _frame.cameraFrame;
+  record.flags                = _frame.flags;
+  return record;
+}
+
+void WebcamWriter::FlushIndex ()
+{
+  // once a segment is on disk, so are the index records of its frames
+  if (mManifest.Entries () != mManifestEntries)
+  {
+    mFrameIndex.Flush ();
+    mManifestEntries = mManifest.Entries ();
+  }
+}
+
+int WebcamWriter::OnExecute ()
+{
+  mPlacement.Apply ();
+  while (!this->Terminating ())
+  {
+    // scoped to the iteration so that the pooled buffer goes back right after encoding
+    WebcamFrame frame;
+    mMutex.Acquire ();
+    // while the pool is behind on this camera's chunks, leave frames queued, so that the
+    //   frame drop policy applies instead of memory growing without bound
+    bool got_frame = false;
+    if (mGopEncoder.IsOpen ())
+    {
+      mGopEncoder.Collect ();
+      FlushIndex ();
+    }
+    bool busy = mGopEncoder.IsOpen () && mGopEncoder.Busy ();
+    if (!busy && !mPreload.empty ())
+    {
+      // frames from before the recording began go first
+      frame = std::move (mPreload.front ());
+      mPreload.pop_front ();
+      got_frame = true;
+    }
+    else if (!busy)
+      got_frame = mQueue.TryPop (frame);
+    if (got_frame)
+      WriteFrame (frame);
+    mMutex.Release ();
+
+    // Frames are popped under the mutex, so that Close () never sees the queue empty while
+    //   a frame is on its way to the file; the wait for one happens outside of it.
+    if (got_frame)
+      mDrained.Notify ();
+    else if (busy)
+      std::this_thread::sleep_for (std::chrono::milliseconds (WRITER_BUSY_MS));
+    else
+      mQueue.Wait (WRITER_WAIT_MS);
+  }
+  return 0;
+}
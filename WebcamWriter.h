@@ -0,0 +1,158 @@
+/////////////////////////////////////////////////////////////////////////////
+// $Id: WebcamWriter.h
+// Authors: Alexander Belsten belsten@neurotechcenter.org
+//
+// Description: The WebcamWriter is the encode stage of a camera. It drains
+// the frame queue filled by its WebcamThread, encodes the frames to the
+// video file and sets the frame number as a state value, so that capture
+// cadence never depends on encoder speed. Next to the video it writes a
+// FrameIndex sidecar with the capture and encode times of every frame.
+// In passthrough mode the frames hold what the camera compressed, and are
+// muxed into the file as they are instead of being encoded. With a chunk
+// length set, frames are encoded in independent chunks on the shared
+// EncoderPool instead of on this thread, see GopEncoder.
+//
+// With a segment length set, the video is written in segments that are
+// complete on disk as soon as the next one begins: fragments of one MP4
+// file when muxing, separate files <name>.<nnnn>.mp4 when encoding on this
+// thread. Completed segments are listed in a SegmentManifest, <name>.segments.
+//
+// Video that is muxed, whether passed through or encoded in chunks, goes
+// through a VideoSink; cv::VideoWriter writes its files itself.
+//
+// Frames from before the recording began, see PreTriggerBuffer, are handed
+// over with Preload () and written ahead of the queued ones.
+//
+// Event Variables:
+//   WebcamFrame<n> - The camera frame number of the last frame written for
+//                    camera index n, set by FrameEvents once the frame is
+//                    written; the frame index maps it to the file position
+//
+// $BEGIN_BCI2000_LICENSE$
+//
+// This file is part of BCI2000, a platform for real-time bio-signal research.
+// [ Copyright (C) 2000-2021: BCI2000 team and many external contributors ]
+//
+// BCI2000 is free software: you can redistribute it and/or modify it under the
+// terms of the GNU General Public License as published by the Free Software
+// Foundation, either version 3 of the License, or (at your option) any later
+// version.
+//
+// BCI2000 is distributed in the hope that it will be useful, but
+//                         WITHOUT ANY WARRANTY
+// - without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+// A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// $END_BCI2000_LICENSE$
+/////////////////////////////////////////////////////////////////////////////
+#ifndef WEBCAMWRITER_H
+#define WEBCAMWRITER_H
+
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <deque>
+#include <string>
+
+#include "Thread.h"
+#include "Mutex.h"
+#include "BCIEvent.h"
+#include "BCIStream.h"
+#include "WebcamFrame.h"
+#include "FrameQueue.h"
+#include "FrameIndex.h"
+#include "Mp4Muxer.h"
+#include "GopEncoder.h"
+#include "SegmentManifest.h"
+#include "PipelineTelemetry.h"
+#include "FrameEvents.h"
+#include "ThreadPlacement.h"
+#include "WakeSignal.h"
+
+class WebcamWriter : public Thread
+{
+public:
+  typedef FrameQueue<WebcamFrame> Queue;
+
+  WebcamWriter ( int                _camIndex,
+                 int                _queueLength,
+                 Queue::DropPolicy  _dropPolicy
+  );
+  ~WebcamWriter ();
+
+  int  OnExecute () override;
+
+  // called from the controlling thread. With _passthrough, submitted frames are
+  //   compressed samples of _fourcc as a 1xN byte image, see Mp4Muxer.
+  bool Open      (const std::string& _videoFile, const std::string& _indexFile,
+                  int _fourcc, double _fps, cv::Size _size, bool _isColor,
+                  bool _passthrough = false);
+  // frames still queued at _deadline are discarded, so that stopping takes bounded time
+  void Close     (std::chrono::steady_clock::time_point _deadline = std::chrono::steady_clock::time_point::max ());
+  void Shutdown  ();
+  // gets the encoder ready ahead of Open (), so that opening does not delay the recording
+  void Warmup    (int _fourcc, double _fps, cv::Size _size, bool _isColor);
+
+  // called from the capture thread
+  bool Submit    (WebcamFrame& _frame);
+  // takes over frames captured before the recording began, to be written before any submitted ones
+  void Preload   (std::deque<WebcamFrame>& _frames);
+
+  // encode time and event latency are recorded here; not owned
+  void SetTelemetry (PipelineTelemetry* _telemetry) { mTelemetry = _telemetry; mEvents.SetTelemetry (_telemetry); }
+  // cores and priority of the writer thread; takes effect when the thread starts
+  void SetPlacement (const std::vector<int>& _cores, ThreadPlacement::Priority _priority) { mPlacement.Configure (_cores, _priority); }
+  const ThreadPlacement& Placement () const { return mPlacement; }
+  // frames per independently encoded chunk, 0 to encode on this thread; takes effect at Open ()
+  void SetChunkFrames (int _frames) { mChunkFrames = _frames; }
+  // length of a segment, 0 for a video that is complete only once closed; takes effect at Open ()
+  void SetSegmentSeconds (double _seconds) { mSegmentNs = static_cast<int64_t> (_seconds * 1e9); }
+  // how muxed video files are written, see VideoSink; takes effect at Open ()
+  void SetVideoIo (const VideoIoOptions& _options);
+
+  unsigned long FramesWritten () const { return mFrameNum; }
+  // frames discarded by the last Close ()
+  uint64_t      FramesDiscarded () const { return mDiscarded; }
+  const Queue&  GetQueue      () const { return mQueue; }
+
+private:
+  void WriteFrame   (WebcamFrame& _frame);
+  FrameIndexRecord IndexRecord (const WebcamFrame& _frame, std::chrono::steady_clock::time_point _encoded) const;
+  void FlushIndex   ();   // the index records of frames in manifested segments
+  bool Pending      ();
+  // segment files of the video writer
+  bool OpenSegment  ();
+  void CloseSegment ();
+
+  Tiny::Mutex        mMutex;
+  cv::VideoWriter    mVideoWriter;
+  Mp4Muxer           mMuxer;
+  GopEncoder         mGopEncoder;
+  int                mChunkFrames;
+  VideoIoOptions     mVideoIo;
+  int64_t            mSegmentNs;
+  bool               mSegmented;         // the video writer writes segment files
+  SegmentRecord      mSegment;           // the segment file being written
+  SegmentManifest    mManifest;
+  unsigned int       mManifestEntries;   // known to be covered by the frame index on disk
+  std::string        mSegmentBase;
+  int                mFourcc;
+  double             mFps;
+  cv::Size           mSize;
+  bool               mIsColor;
+  FrameIndexWriter   mFrameIndex;
+  Queue              mQueue;
+  std::deque<WebcamFrame> mPreload;
+  WakeSignal         mDrained;           // notified after each written frame, for Close ()
+  PipelineTelemetry* mTelemetry;
+  ThreadPlacement    mPlacement;
+  FrameEventChannel  mEvents;
+
+  int                mCameraIndex;
+  unsigned long      mFrameNum;
+  uint64_t           mDiscarded;
+};
+
+#endif // WEBCAMWRITER_H